@@ -0,0 +1,188 @@
+#ifndef ADJACENCY_HH
+#define ADJACENCY_HH
+
+/*
+ * Containers for the edges between executions, i.e., for the parents
+ * and children of an Execution.  Almost all executions have between one
+ * and four parents and children, but a few targets that are depended on
+ * by very many others have huge numbers of parents.  Therefore, up to
+ * SIZE_INLINE elements are stored directly in the object, in order of
+ * insertion.  When more elements are inserted, all of them are moved to
+ * a separately allocated vector, together with a hash table mapping
+ * the keys to the indexes in the vector.  Elements are erased in
+ * constant time by moving the last element into their place; the
+ * order of elements is thus arbitrary.
+ *
+ * Iterators and references are invalidated by inserting and erasing.
+ */
+
+#include <unordered_map>
+
+template <class K, class E>
+class Small_Table
+/* Elements of type E, identified by a key of type K, which is either
+ * E itself or the first element of E  */
+{
+public:
+
+	Small_Table(): n(0), spill(nullptr) {  }
+	~Small_Table() {  delete spill;  }
+
+	Small_Table(const Small_Table &)= delete;
+	Small_Table &operator=(const Small_Table &)= delete;
+
+	size_t size() const {  return spill ? spill->elements.size() : n;  }
+	bool empty() const {  return size() == 0;  }
+
+	E *begin() {  return spill ? spill->elements.data() : elements;  }
+	E *end() {  return begin() + size();  }
+	const E *begin() const {  return spill ? spill->elements.data() : elements;  }
+	const E *end() const {  return begin() + size();  }
+
+	size_t count(K key) const {  return find(key) != NOT_FOUND;  }
+
+	size_t erase(K key);
+	/* Return the number of erased elements, i.e., zero or one */
+
+protected:
+
+	static const size_t NOT_FOUND= ~(size_t) 0;
+
+	size_t find(K key) const;
+	/* The index of the element with KEY, or NOT_FOUND */
+
+	E &push(E &&e);
+	/* Append E, whose key must not be present yet */
+
+private:
+
+	static const unsigned SIZE_INLINE= 4;
+
+	struct Spill {
+		vector <E> elements;
+		unordered_map <K, size_t> indexes;
+	};
+
+	E elements[SIZE_INLINE];
+	/* The first N elements are used when SPILL is null.  Unused
+	 * elements are default-constructed.  */
+
+	unsigned n;
+
+	Spill *spill;
+	/* Null when the elements are in ELEMENTS */
+
+	static const K &get_key(const K &e) {  return e;  }
+	template <class V>
+	static const K &get_key(const pair <K, V> &e) {  return e.first;  }
+};
+
+template <class K, class V>
+class Small_Map
+	:  public Small_Table <K, pair <K, V> >
+{
+public:
+
+	V &operator[](K key);
+	/* Insert a default-constructed value when KEY is not present */
+
+	const V &at(K key) const;
+	/* KEY must be present */
+};
+
+template <class K>
+class Small_Set
+	:  public Small_Table <K, K>
+{
+public:
+
+	void insert(K key) {
+		if (this->find(key) == this->NOT_FOUND)
+			this->push(std::move(key));
+	}
+};
+
+template <class K, class E>
+size_t Small_Table <K, E> ::erase(K key)
+{
+	const size_t i= find(key);
+	if (i == NOT_FOUND)
+		return 0;
+	E *const data= begin();
+	const size_t last= size() - 1;
+	if (spill)
+		spill->indexes.erase(key);
+	if (i != last) {
+		data[i]= std::move(data[last]);
+		if (spill)
+			spill->indexes[get_key(data[i])]= i;
+	}
+	if (spill) {
+		spill->elements.pop_back();
+		if (spill->elements.empty()) {
+			delete spill;
+			spill= nullptr;
+		}
+	} else {
+		data[last]= E();
+		--n;
+	}
+	return 1;
+}
+
+template <class K, class E>
+size_t Small_Table <K, E> ::find(K key) const
+{
+	if (spill) {
+		auto i= spill->indexes.find(key);
+		if (i == spill->indexes.end())
+			return NOT_FOUND;
+		return i->second;
+	}
+	for (unsigned i= 0;  i < n;  ++i)
+		if (get_key(elements[i]) == key)
+			return i;
+	return NOT_FOUND;
+}
+
+template <class K, class E>
+E &Small_Table <K, E> ::push(E &&e)
+{
+	assert(find(get_key(e)) == NOT_FOUND);
+	if (! spill) {
+		if (n < SIZE_INLINE) {
+			elements[n]= std::move(e);
+			return elements[n++];
+		}
+		spill= new Spill;
+		spill->elements.reserve(2 * SIZE_INLINE);
+		for (unsigned i= 0;  i < n;  ++i) {
+			spill->indexes[get_key(elements[i])]= i;
+			spill->elements.push_back(std::move(elements[i]));
+			elements[i]= E();
+		}
+		n= 0;
+	}
+	spill->indexes[get_key(e)]= spill->elements.size();
+	spill->elements.push_back(std::move(e));
+	return spill->elements.back();
+}
+
+template <class K, class V>
+V &Small_Map <K, V> ::operator[](K key)
+{
+	const size_t i= this->find(key);
+	if (i != this->NOT_FOUND)
+		return this->begin()[i].second;
+	return this->push(make_pair(key, V())).second;
+}
+
+template <class K, class V>
+const V &Small_Map <K, V> ::at(K key) const
+{
+	const size_t i= this->find(key);
+	assert(i != this->NOT_FOUND);
+	return this->begin()[i].second;
+}
+
+#endif /* ! ADJACENCY_HH */
@@ -0,0 +1,126 @@
+#ifndef ARENA_HH
+#define ARENA_HH
+
+/*
+ * Allocation of the many small objects that make up the dependency
+ * graph, i.e., Dep and Execution objects.  Memory is taken from large
+ * chunks by incrementing a pointer, and freed objects are kept in a
+ * free list per size class to be reused by objects of the same size.
+ * Chunks are never returned to the system; this is not a problem
+ * because most such objects live until the end of Stu anyway.  This
+ * avoids most of the cost of malloc() and free(), and the overhead and
+ * fragmentation of individually allocated objects.
+ *
+ * The arena is used when USE_ARENA is set, which is the default.  With
+ * USE_ARENA=0, the functions fall back to the global operator new, e.g.
+ * to detect memory errors with tools.  Stu is single-threaded, and
+ * therefore no locking is done.
+ */
+
+#ifndef USE_ARENA
+#    define USE_ARENA 1
+#endif
+
+#include <new>
+
+/* With the address sanitizer, freed objects are poisoned while they are
+ * in a free list, so that uses after free are detected also when the
+ * arena is used.  */
+#if defined(__SANITIZE_ADDRESS__)
+#    define ARENA_ASAN 1
+#elif defined(__has_feature)
+#    if __has_feature(address_sanitizer)
+#        define ARENA_ASAN 1
+#    endif
+#endif
+#ifdef ARENA_ASAN
+#    include <sanitizer/asan_interface.h>
+#    define ARENA_POISON(p, size)    ASAN_POISON_MEMORY_REGION(p, size)
+#    define ARENA_UNPOISON(p, size)  ASAN_UNPOISON_MEMORY_REGION(p, size)
+#else
+#    define ARENA_POISON(p, size)    ((void) (p), (void) (size))
+#    define ARENA_UNPOISON(p, size)  ((void) (p), (void) (size))
+#endif
+
+class Arena
+{
+public:
+
+	static void *allocate(size_t size);
+
+	static void deallocate(void *p, size_t size);
+	/* SIZE must be the same as was passed to allocate() */
+
+	static const size_t ALIGN= alignof(void *);
+	/* The alignment of objects, and the granularity of the size
+	 * classes.  Smaller than alignof(max_align_t), so that objects
+	 * are packed tighter.  Classes allocated in the arena check with
+	 * static_assert() that they do not need more.  */
+
+private:
+
+	static const size_t SIZE_MAX_ARENA= 1024;
+	/* Larger objects are not allocated in the arena.  All
+	 * dependencies and executions are smaller.  */
+
+	static const size_t SIZE_CHUNK= 1 << 16;
+
+	static void *free_lists[SIZE_MAX_ARENA / ALIGN];
+	/* Singly linked lists of freed objects, by size class.  The
+	 * first bytes of a freed object point to the next one.  */
+
+	static char *chunk_begin, *chunk_end;
+	/* The unused part of the current chunk */
+};
+
+void *Arena::free_lists[SIZE_MAX_ARENA / ALIGN];
+char *Arena::chunk_begin= nullptr;
+char *Arena::chunk_end= nullptr;
+
+void *Arena::allocate(size_t size)
+{
+#if USE_ARENA
+	if (size == 0 || size > SIZE_MAX_ARENA)
+		return ::operator new(size);
+
+	const size_t index= (size - 1) / ALIGN;
+	const size_t size_rounded= (index + 1) * ALIGN;
+	if (void *ret= free_lists[index]) {
+		ARENA_UNPOISON(ret, size_rounded);
+		free_lists[index]= *(void **) ret;
+		return ret;
+	}
+
+	if ((size_t)(chunk_end - chunk_begin) < size_rounded) {
+		/* The rest of the previous chunk is lost */
+		chunk_begin= (char *) ::operator new(SIZE_CHUNK);
+		chunk_end= chunk_begin + SIZE_CHUNK;
+	}
+	void *ret= chunk_begin;
+	chunk_begin += size_rounded;
+	return ret;
+#else
+	return ::operator new(size);
+#endif
+}
+
+void Arena::deallocate(void *p, size_t size)
+{
+#if USE_ARENA
+	if (p == nullptr)
+		return;
+	if (size == 0 || size > SIZE_MAX_ARENA) {
+		::operator delete(p);
+		return;
+	}
+	const size_t index= (size - 1) / ALIGN;
+	*(void **) p= free_lists[index];
+	free_lists[index]= p;
+	ARENA_POISON(p, (index + 1) * ALIGN);
+#else
+	(void) size;
+	::operator delete(p);
+#endif
+}
+
+#endif /* ! ARENA_HH */
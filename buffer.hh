@@ -7,7 +7,8 @@
  * targets are built in depth-first order (the default), or in random
  * order.  Which is used is determined by the global variable OPTION_VEC
  * defined in global.hh, which is set once before any Buffer object is
- * created.
+ * created.  With -m critical, a priority queue is used instead, ordered
+ * by the length of the critical paths recorded in the state file.
  */
 
 #include <queue>
@@ -28,25 +29,57 @@ size_t random_number(size_t n)
 class Buffer
 {
 private:
-	/* Since we only ever use one of the two, we could use a
+	/* Since we only ever use one of the three, we could use a
 	 * union-like data structure, but we don't in this
 	 * implementation  */   
 
 	/* All contained dependencies are normalized */
 
-	queue <shared_ptr <const Dep> > q;
-	vector <shared_ptr <const Dep> > v;
+	struct Entry
+	{
+		uint64_t critical;
+		size_t index;
+		Ref <const Dep> dep;
+
+		bool operator < (const Entry &that) const {
+			/* The longest critical path first; in order
+			 * of insertion for equal lengths, which includes
+			 * all dependencies without recorded durations */ 
+			return critical < that.critical ||
+				(critical == that.critical && index > that.index); 
+		}
+	};
+
+	vector <Ref <const Dep> > q;
+	size_t q_begin;
+	/* The queue consists of the elements of Q from Q_BEGIN onwards.
+	 * Q is cleared when the queue becomes empty.  This is used
+	 * instead of std::queue, because std::deque allocates memory
+	 * even when empty.  */ 
+
+	vector <Ref <const Dep> > v;
+	priority_queue <Entry> h;
+
+	size_t count_pushed; 
+	/* Number of dependencies ever pushed; used to order H */
 
 public:
 
+	Buffer()
+		:  q_begin(0),
+		   count_pushed(0)
+	{  }
+
 	size_t size() const {
 		if (order_vec) 
 			return v.size();
+		else if (order == Order::CRITICAL)
+			return h.size(); 
 		else
-			return q.size();
+			return q.size() - q_begin;
 	}
 
-	shared_ptr <const Dep> next() 
+	Ref <const Dep> next() 
 	/* Return the next element, removing it from the buffer at the
 	 * same time  */
 	{
@@ -55,35 +88,62 @@ public:
 			size_t k= random_number(s);
 			if (k + 1 < s) 
 				swap(v[k], v[s - 1]); 
-			shared_ptr <const Dep> ret= v[s - 1];
+			Ref <const Dep> ret= v[s - 1];
 			v.resize(s - 1); 
 			return ret; 
+		} else if (order == Order::CRITICAL) {
+			Ref <const Dep> ret= h.top().dep;
+			h.pop();
+			return ret; 
 		} else {
-			shared_ptr <const Dep> ret= q.front();
-			q.pop(); 
+			Ref <const Dep> ret= std::move(q[q_begin++]);
+			if (q_begin == q.size()) {
+				q.clear();
+				q_begin= 0; 
+			}
 			return ret; 
 		}
 	}
 
-	void push(shared_ptr <const Dep> d)
+	void push(Ref <const Dep> d)
 	/* Add to the end of the queue (if sorted, otherwise, just
 	 * add) */ 
 	{
 		assert(d->is_normalized()); 
 		if (order_vec) {
 			v.emplace_back(d); 
+		} else if (order == Order::CRITICAL) {
+			uint64_t critical= 0;
+			Ref <const Plain_Dep> plain_d= to <Plain_Dep> (d); 
+			if (plain_d) 
+				critical= State::get_critical
+					(plain_d->place_param_target.unparametrized().get_text()); 
+			h.push(Entry{critical, count_pushed++, d}); 
 		} else {
-			q.push(d); 
+			q.emplace_back(d); 
 		}
 	}
 
 	bool empty() const {
 		if (order_vec) {
 			return v.empty();
+		} else if (order == Order::CRITICAL) {
+			return h.empty(); 
 		} else {
 			return q.empty(); 
 		}
 	}
+
+	size_t release()
+	/* Remove all elements and free the memory.  Return the number
+	 * of bytes freed, not counting that of the elements.  */
+	{
+		size_t ret= (q.capacity() + v.capacity()) * sizeof(Ref <const Dep>); 
+		vector <Ref <const Dep> > ().swap(q);
+		vector <Ref <const Dep> > ().swap(v);
+		priority_queue <Entry> ().swap(h); 
+		return ret; 
+	}
 };
 
 #endif /* ! BUFFER_HH */
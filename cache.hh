@@ -0,0 +1,479 @@
+#ifndef CACHE_HH
+#define CACHE_HH
+
+/*
+ * The artifact cache, used with the -A option.  Before the command of
+ * file targets is run, a key is computed from the text of the signature
+ * of the command (see state.hh), and from the names and digests of the
+ * targets' input files.  When the cache contains an entry with that
+ * key, the targets are restored from the cache instead of running the
+ * command.  Otherwise, the targets are stored in the cache after the
+ * command has succeeded.  Since a collision would silently restore the
+ * wrong files, the digests of the input files and the key are computed
+ * with SHA-256, and not with the 64-bit hash function of the state
+ * file.
+ *
+ * Each entry is a directory named by the key, containing the files '0',
+ * '1', etc., which are the file targets in order.  Entries are created
+ * under a temporary name and then renamed, so that incomplete entries
+ * are never used.  The modification time of an entry is the time it
+ * was last used.  When the total size of the cache exceeds its maximal
+ * size ($STU_CACHE_SIZE), the least recently used entries are removed.
+ *
+ * Files are copied using reflinks where supported (Linux), and by
+ * copying their content otherwise.  Hard links are not used, because a
+ * command that modifies its target in place would then also modify the
+ * cache.
+ */
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <unordered_map>
+
+#ifdef __linux__
+#   include <sys/ioctl.h>
+#   include <linux/fs.h>
+#endif
+
+#ifndef USE_FICLONE
+#   if defined(__linux__) && defined(FICLONE)
+#      define USE_FICLONE 1
+#   else
+#      define USE_FICLONE 0
+#   endif
+#endif
+
+#include "sha256.hh"
+
+class Cache
+{
+public:
+
+	static bool enabled() {  return directory != "";  }
+
+	static void open(const char *directory_);
+	/* Use the given cache directory, creating it if it does not
+	 * exist.  Called for the -A option.  */
+
+	static string get_key(const string &signature,
+			      const vector <Target> &targets,
+			      const set <string> &inputs);
+	/* The key of the entry for the given targets.  SIGNATURE is
+	 * the text of the signature of the command, and INPUTS are the
+	 * names of the input files.  Empty when one of the inputs cannot be
+	 * hashed, in which case the cache cannot be used.  */
+
+	static bool restore(const string &key, const vector <Target> &targets);
+	/* Restore the targets from the cache.  Return false when there
+	 * is no entry, or the targets could not be restored.  In that
+	 * case, the command must be run.  */
+
+	static void store(const string &key, const vector <Target> &targets);
+	/* Store the targets, which must exist, in the cache.  Errors
+	 * are ignored, as the cache is only an optimization.  */
+
+	static void print_statistics();
+
+private:
+
+	static string directory;
+	/* Empty when not used */
+
+	static uint64_t size_max;
+	/* Maximal size of the cache in bytes */
+
+	static uint64_t size_total;
+	/* Total size of the entries in the cache.  Only valid when
+	 * SIZE_KNOWN is set.  */
+
+	static bool size_known;
+
+	static unsigned count_hit, count_miss, count_stored, count_evicted;
+
+	struct Digest
+	{
+		uint64_t dev, ino, size, sec, nsec;
+		string digest;
+	};
+
+	static unordered_map <string, Digest> digests;
+	/* The digests of the files hashed in this run, by filename.  A
+	 * file is hashed again when it has changed since, or when it
+	 * was modified within the second in which it was hashed.  */
+
+	static bool digest(const string &name, string &ret);
+	/* Get the SHA-256 digest of the content of the given file.
+	 * Return false when the file cannot be hashed.  */
+
+	static bool copy(const char *from, const char *to, mode_t mode);
+	/* Copy the file FROM to TO, which is created or truncated, and
+	 * given the mode MODE.  Return false on error.  */
+
+	static void evict();
+	/* Compute SIZE_TOTAL, and remove the least recently used
+	 * entries when it exceeds SIZE_MAX */
+
+	static uint64_t remove_entry(const string &path);
+	/* Remove the given entry directory, and return the size of the
+	 * removed files */
+
+	static bool is_key(const char *name);
+};
+
+string Cache::directory;
+uint64_t Cache::size_max= (uint64_t) 5 << 30;
+uint64_t Cache::size_total= 0;
+bool Cache::size_known= false;
+unsigned Cache::count_hit= 0;
+unsigned Cache::count_miss= 0;
+unsigned Cache::count_stored= 0;
+unsigned Cache::count_evicted= 0;
+unordered_map <string, Cache::Digest> Cache::digests;
+
+void Cache::open(const char *directory_)
+{
+	Place place(Place::Type::OPTION, 'A');
+	if (*directory_ == '\0') {
+		place << "expected a non-empty argument";
+		exit(ERROR_FATAL);
+	}
+
+	if (mkdir(directory_, S_IRWXU | S_IRWXG | S_IRWXO) < 0 && errno != EEXIST) {
+		place << system_format(name_format_word(directory_));
+		exit(ERROR_FATAL);
+	}
+	struct stat buf;
+	if (stat(directory_, &buf) < 0) {
+		place << system_format(name_format_word(directory_));
+		exit(ERROR_FATAL);
+	}
+	if (! S_ISDIR(buf.st_mode)) {
+		place << fmt("%s must be a directory", name_format_word(directory_));
+		exit(ERROR_FATAL);
+	}
+
+	/* $STU_CACHE_SIZE is a number of bytes, optionally followed by
+	 * one of the suffixes K, M or G */
+	const char *size= getenv("STU_CACHE_SIZE");
+	if (size != nullptr && *size != '\0') {
+		errno= 0;
+		char *end;
+		unsigned long long n= strtoull(size, &end, 10);
+		int shift= 0;
+		switch (*end) {
+		case 'k': case 'K':  shift= 10;  ++end;  break;
+		case 'm': case 'M':  shift= 20;  ++end;  break;
+		case 'g': case 'G':  shift= 30;  ++end;  break;
+		}
+		if (errno != 0 || end == size || *end != '\0' || ! isdigit((unsigned char) *size)
+		    || (n << shift) >> shift != n) {
+			print_error(fmt("Invalid value %s of %s$STU_CACHE_SIZE%s",
+					name_format_word(size),
+					Color::word, Color::end));
+			exit(ERROR_FATAL);
+		}
+		size_max= (uint64_t) n << shift;
+	}
+
+	directory= directory_;
+}
+
+string Cache::get_key(const string &signature,
+		      const vector <Target> &targets,
+		      const set <string> &inputs)
+{
+	assert(enabled());
+
+	string text= signature;
+	text += '\0';
+	for (const Target &target:  targets) {
+		text += target.get_name_nondynamic();
+		text += '\0';
+	}
+	text += '\0';
+	for (const string &input:  inputs) {
+		string d;
+		if (! digest(input, d))
+			return "";
+		text += input;
+		text += '\0';
+		text += d;
+	}
+
+	const string key= Sha256::hash(text.data(), text.size());
+	string ret;
+	for (unsigned char c:  key) 
+		ret += frmt("%02x", (unsigned) c);
+	return ret;
+}
+
+bool Cache::digest(const string &name, string &ret)
+{
+	int fd= ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	struct stat buf;
+	if (fstat(fd, &buf) < 0 || ! S_ISREG(buf.st_mode)) {
+		::close(fd);
+		return false;
+	}
+
+	Digest d;
+	d.dev= buf.st_dev;
+	d.ino= buf.st_ino;
+	d.size= buf.st_size;
+	d.sec= buf.st_mtime;
+#if USE_MTIM
+	d.nsec= buf.st_mtim.tv_nsec;
+#else
+	d.nsec= 0;
+#endif
+	auto i= digests.find(name);
+	if (i != digests.end() && i->second.dev == d.dev && i->second.ino == d.ino
+	    && i->second.size == d.size && i->second.sec == d.sec 
+	    && i->second.nsec == d.nsec) {
+		::close(fd);
+		ret= i->second.digest;
+		return true;
+	}
+
+	Sha256 sha256;
+	char b[0x10000];
+	ssize_t r;
+	while ((r= read(fd, b, sizeof(b))) != 0) {
+		if (r < 0) {
+			::close(fd);
+			return false;
+		}
+		sha256.update(b, r);
+	}
+	::close(fd);
+	d.digest= sha256.finish();
+	ret= d.digest;
+
+	/* As in the state file, a file modified within the current
+	 * second may be modified again without changing its timestamp */
+	if ((time_t) d.sec < time(nullptr))
+		digests[name]= move(d);
+	else
+		digests.erase(name); 
+	return true;
+}
+
+bool Cache::restore(const string &key, const vector <Target> &targets)
+{
+	assert(enabled());
+
+	string path= directory + '/' + key;
+	struct stat buf;
+	if (stat(path.c_str(), &buf) < 0 || ! S_ISDIR(buf.st_mode)) {
+		++count_miss;
+		return false;
+	}
+
+	/* First copy all files to temporary names, and only then rename
+	 * them, so that no target is changed when one file cannot be
+	 * copied */
+	vector <string> filenames_tmp;
+	bool ok= true;
+	for (size_t i= 0;  ok && i < targets.size();  ++i) {
+		string source= frmt("%s/%u", path.c_str(), (unsigned) i);
+		string filename_tmp= targets[i].get_name_nondynamic() + ".stu-restore";
+		struct stat buf_source;
+		ok= stat(source.c_str(), &buf_source) == 0 &&
+			copy(source.c_str(), filename_tmp.c_str(), buf_source.st_mode & 07777);
+		filenames_tmp.push_back(filename_tmp);
+	}
+	for (size_t i= 0;  ok && i < targets.size();  ++i) {
+		ok= rename(filenames_tmp[i].c_str(),
+			   targets[i].get_name_c_str_nondynamic()) == 0;
+	}
+	if (! ok) {
+		for (const string &filename_tmp:  filenames_tmp)
+			unlink(filename_tmp.c_str());
+		++count_miss;
+		return false;
+	}
+
+	/* Mark the entry as recently used */
+	utimensat(AT_FDCWD, path.c_str(), nullptr, 0);
+
+	++count_hit;
+	return true;
+}
+
+void Cache::store(const string &key, const vector <Target> &targets)
+{
+	assert(enabled());
+
+	string path= directory + '/' + key;
+	static unsigned count_tmp= 0;
+	string path_tmp= frmt("%s/tmp.%ld.%u", directory.c_str(),
+			      (long) getpid(), count_tmp++);
+	if (mkdir(path_tmp.c_str(), S_IRWXU | S_IRWXG | S_IRWXO) < 0)
+		return;
+
+	uint64_t size= 0;
+	bool ok= true;
+	for (size_t i= 0;  ok && i < targets.size();  ++i) {
+		/* Symbolic links and other special files are not cached */
+		struct stat buf;
+		ok= lstat(targets[i].get_name_c_str_nondynamic(), &buf) == 0
+			&& S_ISREG(buf.st_mode)
+			&& copy(targets[i].get_name_c_str_nondynamic(),
+				frmt("%s/%u", path_tmp.c_str(), (unsigned) i).c_str(),
+				buf.st_mode & 07777);
+		if (ok)
+			size += buf.st_size;
+	}
+
+	/* When the entry exists already (e.g., created by a concurrent
+	 * invocation of Stu), rename() fails and the new entry is
+	 * discarded */
+	if (! ok || rename(path_tmp.c_str(), path.c_str()) < 0) {
+		remove_entry(path_tmp);
+		return;
+	}
+
+	++count_stored;
+	if (size_known)
+		size_total += size;
+	if (! size_known || size_total > size_max)
+		evict();
+}
+
+void Cache::print_statistics()
+{
+	printf("STATISTICS  cache:  %u hits, %u misses, %u stored, %u evicted\n",
+	       count_hit, count_miss, count_stored, count_evicted);
+}
+
+bool Cache::copy(const char *from, const char *to, mode_t mode)
+{
+	int fd_from= ::open(from, O_RDONLY | O_CLOEXEC);
+	if (fd_from < 0)
+		return false;
+	int fd_to= ::open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd_to < 0) {
+		close(fd_from);
+		return false;
+	}
+
+	bool ok= true;
+	bool cloned= false;
+#if USE_FICLONE
+	cloned= ioctl(fd_to, FICLONE, fd_from) == 0;
+#endif
+	if (! cloned) {
+		char buf[0x10000];
+		ssize_t r;
+		while (ok && (r= read(fd_from, buf, sizeof(buf))) != 0) {
+			if (r < 0) {
+				ok= false;
+				break;
+			}
+			for (ssize_t k= 0;  k < r; ) {
+				ssize_t w= write(fd_to, buf + k, r - k);
+				if (w < 0) {
+					ok= false;
+					break;
+				}
+				k += w;
+			}
+		}
+	}
+
+	if (fchmod(fd_to, mode) < 0)
+		ok= false;
+	close(fd_from);
+	if (close(fd_to) < 0)
+		ok= false;
+	return ok;
+}
+
+void Cache::evict()
+{
+	DIR *dir= opendir(directory.c_str());
+	if (dir == nullptr)
+		return;
+
+	/* The entries with their time of last use and size */
+	vector <pair <time_t, pair <uint64_t, string> > > entries;
+	size_total= 0;
+	time_t now= time(nullptr);
+	struct dirent *entry;
+	while ((entry= readdir(dir)) != nullptr) {
+		string path= directory + '/' + entry->d_name;
+		struct stat buf;
+		if (is_key(entry->d_name)) {
+			if (stat(path.c_str(), &buf) < 0)
+				continue;
+			uint64_t size= 0;
+			for (unsigned i= 0; ; ++i) {
+				struct stat buf_file;
+				if (stat(frmt("%s/%u", path.c_str(), i).c_str(), &buf_file) < 0)
+					break;
+				size += buf_file.st_size;
+			}
+			entries.push_back(make_pair(buf.st_mtime, make_pair(size, path)));
+			size_total += size;
+		} else if (! strncmp(entry->d_name, "tmp.", 4)) {
+			/* Left over by an interrupted invocation of Stu */
+			if (stat(path.c_str(), &buf) == 0 && buf.st_mtime + 3600 < now)
+				remove_entry(path);
+		}
+	}
+	closedir(dir);
+	size_known= true;
+
+	if (size_total <= size_max)
+		return;
+
+	/* Remove the least recently used entries until the cache has
+	 * 90% of its maximal size, so that not every new entry leads to
+	 * an eviction */
+	sort(entries.begin(), entries.end());
+	for (const auto &e:  entries) {
+		if (size_total <= size_max / 10 * 9)
+			break;
+		size_total -= remove_entry(e.second.second);
+		++count_evicted;
+	}
+}
+
+uint64_t Cache::remove_entry(const string &path)
+{
+	uint64_t size= 0;
+	DIR *dir= opendir(path.c_str());
+	if (dir != nullptr) {
+		struct dirent *entry;
+		while ((entry= readdir(dir)) != nullptr) {
+			if (! strcmp(entry->d_name, ".") || ! strcmp(entry->d_name, ".."))
+				continue;
+			string filename= path + '/' + entry->d_name;
+			struct stat buf;
+			if (stat(filename.c_str(), &buf) == 0)
+				size += buf.st_size;
+			unlink(filename.c_str());
+		}
+		closedir(dir);
+	}
+	rmdir(path.c_str());
+	return size;
+}
+
+bool Cache::is_key(const char *name)
+/* Keys of 32 digits were written by earlier versions of Stu.  Such
+ * entries are never used, but are evicted like other entries.  */
+{
+	size_t i= 0;
+	for (;  name[i];  ++i) {
+		if (! isxdigit((unsigned char) name[i]))
+			return false;
+	}
+	return i == 2 * Sha256::SIZE || i == 32;
+}
+
+#endif /* ! CACHE_HH */
@@ -7,10 +7,12 @@
  * a Stu script get mapped to Dep objects.  
  *
  * Dependencies are polymorphous objects, and all dependencies derive
- * from the class Dep, and are used via shared_ptr<>, except in
- * cases where access is read-only.  This is necessary in cases where a
- * member function has to access its own THIS pointer, because we can't
- * put THIS into a shared pointer. 
+ * from the class Dep, and are used via Ref<>, except in
+ * cases where access is read-only.  Ref<> is an intrusive reference
+ * count:  the count is stored in the Dep object itself, and therefore a
+ * member function can build a new Ref<> from its own THIS pointer,
+ * which shares ownership with all other Ref<> objects of the
+ * dependency. 
  *
  * All dependency classes allow parametrized targets.  
  */
@@ -42,50 +44,160 @@
  */
 
 #include <map>
+#include <type_traits>
 
 #ifndef NDEBUG
 #	include <bitset>
 #endif
 
+#include "arena.hh"
 #include "error.hh"
 #include "target.hh"
 #include "flags.hh"
 
+template <typename T>
+class Ref
+/*
+ * A reference-counted pointer to a dependency, used like shared_ptr<>.
+ * The count is stored in the Dep object itself, and is not atomic, as
+ * Stu is single-threaded.  May be null.  Only the operations used in
+ * Stu are implemented.
+ */
+{
+public:
+
+	Ref():  p(nullptr) {  }
+	Ref(nullptr_t):  p(nullptr) {  }
+
+	explicit Ref(T *p_)
+		/* P_ is newly allocated, or already owned by other Ref
+		 * objects */ 
+		:  p(p_)
+	{
+		acquire(); 
+	}
+
+	Ref(const Ref &that)
+		:  p(that.p)
+	{
+		acquire(); 
+	}
+
+	Ref(Ref &&that) noexcept
+		:  p(that.p)
+	{
+		that.p= nullptr; 
+	}
+
+	template <typename U,
+		  typename= typename enable_if <is_convertible <U *, T *>::value>::type>
+	Ref(const Ref <U> &that)
+		:  p(that.p)
+	{
+		acquire(); 
+	}
+
+	template <typename U,
+		  typename= typename enable_if <is_convertible <U *, T *>::value>::type>
+	Ref(Ref <U> &&that) noexcept
+		:  p(that.p)
+	{
+		that.p= nullptr; 
+	}
+
+	~Ref() {  release();  }
+
+	Ref &operator= (Ref that) noexcept {
+		swap(p, that.p); 
+		return *this; 
+	}
+
+	T *get() const {  return p;  }
+	T &operator* () const {  return *p;  }
+	T *operator-> () const {  return p;  }
+	explicit operator bool() const {  return p != nullptr;  }
+
+	void reset() {
+		release(); 
+		p= nullptr; 
+	}
+
+private:
+
+	template <typename U>
+	friend class Ref;
+
+	T *p;
+
+	void acquire() {
+		if (p)  ++p->refcount; 
+	}
+
+	void release() {
+		if (p && --p->refcount == 0)
+			delete p; 
+	}
+};
+
+template <typename T, typename U>
+bool operator == (const Ref <T> &a, const Ref <U> &b) {  return a.get() == b.get();  }
+template <typename T, typename U>
+bool operator != (const Ref <T> &a, const Ref <U> &b) {  return a.get() != b.get();  }
+template <typename T>
+bool operator == (const Ref <T> &a, nullptr_t) {  return a.get() == nullptr;  }
+template <typename T>
+bool operator != (const Ref <T> &a, nullptr_t) {  return a.get() != nullptr;  }
+
 template <typename T, typename U>
-shared_ptr <const T> to(shared_ptr <const U> d)
+Ref <const T> to(const Ref <U> &d)
+/* Cast to the given type of dependency, or return null when D is of
+ * another type or is null.  Used instead of dynamic_pointer_cast<>.  */ 
 {
-	return dynamic_pointer_cast <const T> (d); 
+	if (d == nullptr || d->kind != T::KIND)
+		return nullptr; 
+	return Ref <const T> (static_cast <const T *> (d.get())); 
 }
 
 template <typename T, typename U>
-shared_ptr <const T> to(shared_ptr <U> d)
+const T *to(const U *d)
+/* The same for plain pointers */ 
 {
-	return dynamic_pointer_cast <const T> (d); 
+	if (d == nullptr || d->kind != T::KIND)
+		return nullptr; 
+	return static_cast <const T *> (d); 
+}
+
+template <typename T, typename... Args>
+Ref <T> make_dep(Args&&... args)
+/* Create a dependency.  Used for all dependencies, like
+ * make_shared<>().  */ 
+{
+	static_assert(alignof(T) <= Arena::ALIGN, "alignment of arena"); 
+	return Ref <T> (new T(std::forward <Args> (args)...)); 
 }
 
 class Dep
 /* 
  * The abstract base class for all dependencies.  Objects of this type
- * are used via shared_ptr<>.
+ * are used via Ref<>.
  *
  * The flags only represent immediate flags.  Compound dependencies for
  * instance may contain additional inner flags. 
  *
  * Objects of type Dep and subclasses are always handled through
- * shared_ptr<>.  All objects may have many persistent pointers to it,
+ * Ref<>.  All objects may have many persistent pointers to it,
  * so they are considered final, i.e., immutable, except if we just
  * created the object in which case we know that it is not shared.
- * Therefore, we always use shared_ptr <const ...>, except when we just
+ * Therefore, we always use Ref <const ...>, except when we just
  * created the dependency.  All dependencies are created via
- * make_shared<>. 
+ * make_dep<>. 
+ *
+ * Certain functions are static functions taking an argument of type
+ * Ref<> instead of member functions:  clone(), normalize(), etc., as
+ * they may return or store their argument itself. 
  *
- * The use of shared_ptr<> also means that certain functions cannot be
- * member functions but must be static functions instead:  clone(),
- * normalize(), etc.  This is because we cannot use a construct like
- * shared_ptr <Dep> (this), which is erroneous (the object would
- * be released twice, etc.).  As a result, we replace THIS by an
- * argument of type shared_ptr<>.  [Note:  there is also
- * std::enable_shared_from_this as a possibility.]
+ * The type of a dependency is stored in KIND, and checked with to<>,
+ * which is used instead of dynamic casts. 
  *
  * The constructors of Dep and derived classes do not set the TOP and
  * INDEX fields.  These are set manually when needed. 
@@ -93,33 +205,48 @@ class Dep
 {
 public:
 
+	enum Kind {
+		K_PLAIN, K_DYNAMIC, K_CONCAT, K_COMPOUND, K_ROOT
+	};
+
+	const Kind kind;
+	/* The type of the object, i.e., the derived class */ 
+
 	Flags flags;
 
 	Place places[C_PLACED]; 
 	/* For each transitive flag that is set, the place.  An empty
 	 * place if a flag is not set  */
 
-	shared_ptr <const Dep> top; 
+	Ref <const Dep> top; 
 	/* Additional place used for constructing traces.  Most of the
 	 * properties (such as extra flags) are ignored.  */
 
-	ssize_t index; 
+	int index; 
 	/* Used by concatenated executions; the index of the dependency
-	 * within the array of concatenation.  -1 when not used. */
-
-	Dep()
-		:  flags(0),
-		   index(-1)
+	 * within the array of concatenation.  -1 when not used.  Not a
+	 * size_t, so that it fits together with REFCOUNT into eight
+	 * bytes.  */
+
+	Dep(Kind kind_)
+		:  kind(kind_),
+		   flags(0),
+		   index(-1),
+		   refcount(0)
 	{  }
 
-	Dep(Flags flags_) 
-		:  flags(flags_),
-		   index(-1)
+	Dep(Kind kind_, Flags flags_) 
+		:  kind(kind_),
+		   flags(flags_),
+		   index(-1),
+		   refcount(0)
 	{  }
 
-	Dep(Flags flags_, const Place places_[C_PLACED])
-		:  flags(flags_),
-		   index(-1)
+	Dep(Kind kind_, Flags flags_, const Place places_[C_PLACED])
+		:  kind(kind_),
+		   flags(flags_),
+		   index(-1),
+		   refcount(0)
 	{
 		assert(places != places_);
 		for (unsigned i= 0;  i < C_PLACED;  ++i)
@@ -127,9 +254,11 @@ public:
 	}
 
 	Dep(const Dep &that)
-		:  flags(that.flags),
+		:  kind(that.kind),
+		   flags(that.flags),
 		   top(that.top),
-		   index(that.index)
+		   index(that.index),
+		   refcount(0)
 	{
 		assert(places != that.places);
 		for (unsigned i= 0;  i < C_PLACED;  ++i)
@@ -138,6 +267,9 @@ public:
 
 	virtual ~Dep(); 
 
+	static void *operator new(size_t size) {  return Arena::allocate(size);  }
+	static void operator delete(void *p, size_t size) {  Arena::deallocate(p, size);  }
+
 	const Place &get_place_flag(unsigned i) const {
 		assert(i < C_PLACED);
 		return places[i];
@@ -153,7 +285,7 @@ public:
 		places[i]= place; 
 	}
 
-	void add_flags(shared_ptr <const Dep> dep, 
+	void add_flags(Ref <const Dep> dep, 
 		       bool overwrite_places);
 	/* Add the flags from DEP.  Also copy over the
 	 * corresponding places.  If a place is already given in THIS,
@@ -171,7 +303,7 @@ public:
 	void check() const {  }
 #endif		
 
-	virtual shared_ptr <const Dep> instantiate(const map <string, string> &mapping) const= 0;
+	virtual Ref <const Dep> instantiate(const map <string, string> &mapping) const= 0;
 	virtual bool is_unparametrized() const= 0; 
 
 	virtual const Place &get_place() const= 0;
@@ -188,8 +320,8 @@ public:
 
 	virtual bool is_normalized() const= 0;
 
-	static void normalize(shared_ptr <const Dep> dep,
-			      vector <shared_ptr <const Dep> > &deps,
+	static void normalize(Ref <const Dep> dep,
+			      vector <Ref <const Dep> > &deps,
 			      int &error);
 	/* Split DEP into multiple DEPS that are each
 	 * normalized.  The resulting dependencies are appended to
@@ -199,14 +331,22 @@ public:
 	 * if not in keep-going mode, the function returns immediately. 
 	 */
 
-	static shared_ptr <Dep> clone(shared_ptr <const Dep> dep);
+	static Ref <Dep> clone(Ref <const Dep> dep);
 	/* A shallow clone */
 
-	static shared_ptr <const Dep> strip_dynamic(shared_ptr <const Dep> d);
+	static Ref <const Dep> strip_dynamic(Ref <const Dep> d);
 	/* Strip dynamic dependencies from the given dependency.
 	 * Perform recursively:  If D is a dynamic dependency, return
 	 * its contained dependency, otherwise return D.  Thus, never
 	 * return null.  */
+
+private:
+
+	template <typename T>
+	friend class Ref; 
+
+	mutable unsigned refcount;
+	/* Number of Ref objects pointing to this object */ 
 };
 
 class Plain_Dep
@@ -223,6 +363,8 @@ class Plain_Dep
 {
 public:
 
+	static const Kind KIND= K_PLAIN;
+
 	Place_Param_Target place_param_target; 
 	/* The target of the dependency.  Has its own place, which may
 	 * differ from the dependency's place, e.g. in '@all'.  Is
@@ -236,7 +378,7 @@ public:
 	 * Otherwise:  empty.  */
 
 	explicit Plain_Dep(const Place_Param_Target &place_param_target_)
-		:  Dep(place_param_target_.flags),
+		:  Dep(K_PLAIN, place_param_target_.flags),
 		   place_param_target(place_param_target_),
 		   place(place_param_target_.place)
 	{
@@ -244,11 +386,11 @@ public:
 	}
 	
 	Plain_Dep(Flags flags_,
-		  const Place_Param_Target &place_param_target_)
+		  Place_Param_Target place_param_target_)
 		/* Take the dependency place from the target place */ 
-		:  Dep(flags_),
-		   place_param_target(place_param_target_),
-		   place(place_param_target_.place)
+		:  Dep(K_PLAIN, flags_),
+		   place_param_target(move(place_param_target_)),
+		   place(place_param_target.place)
 	{ 
 		check(); 
 	}
@@ -257,7 +399,7 @@ public:
 		  const Place places_[C_PLACED],
 		  const Place_Param_Target &place_param_target_)
 		/* Take the dependency place from the target place */ 
-		:  Dep(flags_, places_),
+		:  Dep(K_PLAIN, flags_, places_),
 		   place_param_target(place_param_target_),
 		   place(place_param_target_.place)
 	{ 
@@ -269,7 +411,7 @@ public:
 		  const Place &place_,
 		  const string &variable_name_)
 		/* Use an explicit dependency place */ 
-		:  Dep(flags_),
+		:  Dep(K_PLAIN, flags_),
 		   place_param_target(place_param_target_),
 		   place(place_),
 		   variable_name(variable_name_)
@@ -283,7 +425,7 @@ public:
 		  const Place &place_,
 		  const string &variable_name_)
 		/* Use an explicit dependency place */ 
-		:  Dep(flags_, places_),
+		:  Dep(K_PLAIN, flags_, places_),
 		   place_param_target(place_param_target_),
 		   place(place_),
 		   variable_name(variable_name_)
@@ -293,12 +435,12 @@ public:
 
 	Plain_Dep(Flags flags_,
 		  const Place places_[C_PLACED],
-		  const Place_Param_Target &place_param_target_,
+		  Place_Param_Target place_param_target_,
 		  const string &variable_name_)
 		/* Use an explicit dependency place */ 
-		:  Dep(flags_, places_),
-		   place_param_target(place_param_target_),
-		   place(place_param_target_.place),
+		:  Dep(K_PLAIN, flags_, places_),
+		   place_param_target(move(place_param_target_)),
+		   place(place_param_target.place),
 		   variable_name(variable_name_)
 	{ 
 		check(); 
@@ -315,7 +457,7 @@ public:
 		return place; 
 	}
 
-	virtual shared_ptr <const Dep> instantiate(const map <string, string> &mapping) const;
+	virtual Ref <const Dep> instantiate(const map <string, string> &mapping) const;
 
 	bool is_unparametrized() const {
 		return place_param_target.place_name.get_n() == 0; 
@@ -340,20 +482,22 @@ class Dynamic_Dep
 {
 public:
 
-	shared_ptr <const Dep> dep;
+	static const Kind KIND= K_DYNAMIC;
+
+	Ref <const Dep> dep;
 	/* The contained dependency.  Non-null. */ 
 
-	Dynamic_Dep(shared_ptr <const Dep> dep_)
+	Dynamic_Dep(Ref <const Dep> dep_)
 		/* Set the contained dependency.  NOT a copy constructor. */
-		:  Dep(F_TARGET_DYNAMIC),
+		:  Dep(K_DYNAMIC, F_TARGET_DYNAMIC),
 		   dep(dep_)
 	{
 		assert(dep_ != nullptr); 
 	}
 
 	Dynamic_Dep(Flags flags_,
-		    shared_ptr <const Dep> dep_)
-		:  Dep(flags_ | F_TARGET_DYNAMIC), 
+		    Ref <const Dep> dep_)
+		:  Dep(K_DYNAMIC, flags_ | F_TARGET_DYNAMIC), 
 		   dep(dep_)
 	{
 		assert((flags & F_VARIABLE) == 0); 
@@ -362,15 +506,15 @@ public:
 
 	Dynamic_Dep(Flags flags_,
 		    const Place places_[C_PLACED],
-		    shared_ptr <const Dep> dep_)
-		:  Dep(flags_ | F_TARGET_DYNAMIC, places_),
+		    Ref <const Dep> dep_)
+		:  Dep(K_DYNAMIC, flags_ | F_TARGET_DYNAMIC, places_),
 		   dep(dep_)
 	{
 		assert((flags & F_VARIABLE) == 0); /* Variables cannot be dynamic */
 		assert(dep_ != nullptr); 
 	}
 
-	virtual shared_ptr <const Dep>  instantiate(const map <string, string> &mapping) const;
+	virtual Ref <const Dep>  instantiate(const map <string, string> &mapping) const;
 	bool is_unparametrized() const {  return dep->is_unparametrized();  }
 
 	const Place &get_place() const 
@@ -418,7 +562,9 @@ class Concat_Dep
 {
 public:
 
-	vector <shared_ptr <const Dep> > deps;
+	static const Kind KIND= K_CONCAT;
+
+	vector <Ref <const Dep> > deps;
 	/* The dependencies for each part.  No entry is null.  
 	 * May be empty in code, which is something
 	 * that is not allowed in Stu code.  Otherwise, there are at
@@ -426,20 +572,21 @@ public:
 
 	Concat_Dep()
 	/* An empty concatenation, i.e., a concatenation of zero dependencies */ 
+		:  Dep(K_CONCAT)
 	{  }
 
 	Concat_Dep(Flags flags_, const Place places_[C_PLACED])
 		/* The list of dependencies is empty */ 
-		:  Dep(flags_, places_)
+		:  Dep(K_CONCAT, flags_, places_)
 	{  }
 
 	/* Append a dependency to the list */
-	void push_back(shared_ptr <const Dep> dep)
+	void push_back(Ref <const Dep> dep)
 	{
 		deps.push_back(dep); 
 	}
 
-	virtual shared_ptr <const Dep> instantiate(const map <string, string> &mapping) const;
+	virtual Ref <const Dep> instantiate(const map <string, string> &mapping) const;
 
 	virtual bool is_unparametrized() const; 
 
@@ -454,20 +601,20 @@ public:
 
 	virtual Target get_target() const;
 
-	static shared_ptr <const Dep> concat(shared_ptr <const Dep> a,
-					     shared_ptr <const Dep> b,
+	static Ref <const Dep> concat(Ref <const Dep> a,
+					     Ref <const Dep> b,
 					     int &error); 
 	/* Concatenate two dependencies to a single dependency.  On
 	 * error, a message is printed, bits are set in ERROR, and null
 	 * is returned.  Only plain and dynamic dependencies can be passed.  */
 
-	static shared_ptr <const Plain_Dep> concat_plain(shared_ptr <const Plain_Dep> a,
-							 shared_ptr <const Plain_Dep> b);
-	static shared_ptr <const Concat_Dep> concat_complex(shared_ptr <const Dep> a,
-							    shared_ptr <const Dep> b);
+	static Ref <const Plain_Dep> concat_plain(Ref <const Plain_Dep> a,
+							 Ref <const Plain_Dep> b);
+	static Ref <const Concat_Dep> concat_complex(Ref <const Dep> a,
+							    Ref <const Dep> b);
 
-	static void normalize_concat(shared_ptr <const Concat_Dep> dep,
-				     vector <shared_ptr <const Dep> > &deps,
+	static void normalize_concat(Ref <const Concat_Dep> dep,
+				     vector <Ref <const Dep> > &deps,
 				     int &error); 
 	/* Normalize this object's dependencies into a list of individual
 	 * dependencies.  The generated dependencies are appended to
@@ -477,8 +624,8 @@ public:
 	 * if not in keep-going mode, the function returns immediately. 
 	 */
 
-	static void normalize_concat(shared_ptr <const Concat_Dep> dep,
-				     vector <shared_ptr <const Dep> > &deps,
+	static void normalize_concat(Ref <const Concat_Dep> dep,
+				     vector <Ref <const Dep> > &deps,
 				     size_t start_index,
 				     int &error);
 	/* Helper function.  Write result into DEPS,
@@ -506,39 +653,43 @@ class Compound_Dep
 {
 public:
 
+	static const Kind KIND= K_COMPOUND;
+
 	Place place; 
 	/* The place of the compound ; usually the opening parenthesis
 	 * or brace.  May be empty to denote no place, in particular if
 	 * this is a "logical" compound dependency not coming from a
 	 * parenthesised expression.  */
 
-	vector <shared_ptr <const Dep> > deps;
+	vector <Ref <const Dep> > deps;
 	/* The contained dependencies, in given order */ 
 
 	Compound_Dep(const Place &place_) 
 		/* Empty, with zero dependencies */
-		:  place(place_)
+		:  Dep(K_COMPOUND),
+		   place(place_)
 	{  }
 	
 	Compound_Dep(Flags flags_, const Place places_[C_PLACED], const Place &place_)
-		:  Dep(flags_, places_),
+		:  Dep(K_COMPOUND, flags_, places_),
 		   place(place_)
 	{
 		/* The list of dependencies is empty */ 
 	}
 
-	Compound_Dep(vector <shared_ptr <const Dep> > &&deps_, 
+	Compound_Dep(vector <Ref <const Dep> > &&deps_, 
 		     const Place &place_)
-		:  place(place_),
+		:  Dep(K_COMPOUND),
+		   place(place_),
 		   deps(deps_)
 	{  }
 
-	void push_back(shared_ptr <const Dep> dep)
+	void push_back(Ref <const Dep> dep)
 	{
 		deps.push_back(dep); 
 	}
 
-	virtual shared_ptr <const Dep> instantiate(const map <string, string> &mapping) const;
+	virtual Ref <const Dep> instantiate(const map <string, string> &mapping) const;
 
 	virtual bool is_unparametrized() const; 
 
@@ -567,8 +718,14 @@ class Root_Dep
 	:  public Dep
 {
 public:
-	virtual shared_ptr <const Dep> instantiate(const map <string, string> &) const {
-		return shared_ptr <const Dep> (make_shared <Root_Dep> ()); 
+	static const Kind KIND= K_ROOT;
+
+	Root_Dep()
+		:  Dep(K_ROOT)
+	{  }
+
+	virtual Ref <const Dep> instantiate(const map <string, string> &) const {
+		return Ref <const Dep> (make_dep <Root_Dep> ()); 
 	}
 	virtual bool is_unparametrized() const {  return false;  }
 	virtual const Place &get_place() const {  return Place::place_empty;  }
@@ -584,29 +741,29 @@ public:
 
 Dep::~Dep() { }
 
-void Dep::normalize(shared_ptr <const Dep> dep,
-		    vector <shared_ptr <const Dep> > &deps,
+void Dep::normalize(Ref <const Dep> dep,
+		    vector <Ref <const Dep> > &deps,
 		    int &error)
 {
 	if (to <Plain_Dep> (dep)) {
 		deps.push_back(dep);
-	} else if (shared_ptr <const Dynamic_Dep> dynamic_dep= to <Dynamic_Dep> (dep)) {
-		vector <shared_ptr <const Dep> > deps_child;
+	} else if (Ref <const Dynamic_Dep> dynamic_dep= to <Dynamic_Dep> (dep)) {
+		vector <Ref <const Dep> > deps_child;
 		normalize(dynamic_dep->dep, deps_child, error);
 		if (error && ! option_keep_going)
 			return;
 		for (auto &d:  deps_child) {
-			shared_ptr <Dep> dep_new= 
-				make_shared <Dynamic_Dep> 
+			Ref <Dep> dep_new= 
+				make_dep <Dynamic_Dep> 
 				(dynamic_dep->flags, dynamic_dep->places, d);
 			if (dynamic_dep->index >= 0)
 				dep_new->index= dynamic_dep->index;
 			dep_new->top= dynamic_dep->top;
 			deps.push_back(dep_new); 
 		}
-	} else if (shared_ptr <const Compound_Dep> compound_dep= to <Compound_Dep> (dep)) {
+	} else if (Ref <const Compound_Dep> compound_dep= to <Compound_Dep> (dep)) {
 		for (auto &d:  compound_dep->deps) {
-			shared_ptr <Dep> dd= Dep::clone(d); 
+			Ref <Dep> dd= Dep::clone(d); 
 			dd->add_flags(compound_dep, false);  
 			if (compound_dep->index >= 0)
 				dd->index= compound_dep->index;
@@ -624,27 +781,27 @@ void Dep::normalize(shared_ptr <const Dep> dep,
 	}
 }
 
-shared_ptr <Dep> Dep::clone(shared_ptr <const Dep> dep)
+Ref <Dep> Dep::clone(Ref <const Dep> dep)
 {
 	assert(dep); 
 
 	if (to <Plain_Dep> (dep)) {
-		return make_shared <Plain_Dep> (* to <Plain_Dep> (dep)); 
+		return make_dep <Plain_Dep> (* to <Plain_Dep> (dep)); 
 	} else if (to <Dynamic_Dep> (dep)) {
-		return make_shared <Dynamic_Dep> (* to <Dynamic_Dep> (dep)); 
+		return make_dep <Dynamic_Dep> (* to <Dynamic_Dep> (dep)); 
 	} else if (to <Compound_Dep> (dep)) {
-		return make_shared <Compound_Dep> (* to <Compound_Dep> (dep)); 
+		return make_dep <Compound_Dep> (* to <Compound_Dep> (dep)); 
 	} else if (to <Concat_Dep> (dep)) {
-		return make_shared <Concat_Dep> (* to <Concat_Dep> (dep)); 
+		return make_dep <Concat_Dep> (* to <Concat_Dep> (dep)); 
 	} else if (to <Root_Dep> (dep)) {
-		return make_shared <Root_Dep> (* to <Root_Dep> (dep)); 
+		return make_dep <Root_Dep> (* to <Root_Dep> (dep)); 
 	} else {
 		assert(false); 
 		/* Bug:  Unhandled dependency type */ 
 	}
 }
 
-void Dep::add_flags(shared_ptr <const Dep> dep, 
+void Dep::add_flags(Ref <const Dep> dep, 
 		    bool overwrite_places)
 {
 	for (unsigned i= 0;  i < C_PLACED;  ++i) {
@@ -657,7 +814,7 @@ void Dep::add_flags(shared_ptr <const Dep> dep,
 	this->flags |= dep->flags; 
 }
 
-shared_ptr <const Dep> Dep::strip_dynamic(shared_ptr <const Dep> d)
+Ref <const Dep> Dep::strip_dynamic(Ref <const Dep> d)
 {
 	assert(d != nullptr); 
 	while (to <Dynamic_Dep> (d)) {
@@ -676,7 +833,7 @@ void Dep::check() const
 		assert(((flags & (1 << i)) == 0) == get_place_flag(i).empty()); 
 	}
 
-	if (auto plain_this= dynamic_cast <const Plain_Dep *> (this)) {
+	if (auto plain_this= to <Plain_Dep> (this)) {
 		/* The F_TARGET_TRANSIENT flag is always set in the
 		 * dependency flags, even though that is redundant.  */
 		assert((plain_this->flags & F_TARGET_TRANSIENT) == (plain_this->place_param_target.flags)); 
@@ -687,14 +844,14 @@ void Dep::check() const
 		}
 	}
 
-	if (auto dynamic_this= dynamic_cast <const Dynamic_Dep *> (this)) {
+	if (auto dynamic_this= to <Dynamic_Dep> (this)) {
 		assert(flags & F_TARGET_DYNAMIC); 
 		dynamic_this->dep->check(); 
 	} else {
 		assert(!(flags & F_TARGET_DYNAMIC)); 
 	}
 
-	if (auto concat_this= dynamic_cast <const Concat_Dep *> (this)) {
+	if (auto concat_this= to <Concat_Dep> (this)) {
 		assert(concat_this->deps.size() >= 2); 
 		for (auto i:  concat_this->deps) {
 			assert(i); 
@@ -775,15 +932,15 @@ Target Dynamic_Dep::get_target() const
 {
 	string text;
 	const Dep *d= this; 
-	while (dynamic_cast <const Dynamic_Dep *> (d)) {
+	while (to <Dynamic_Dep> (d)) {
 		Flags f= F_TARGET_DYNAMIC; 
 		assert(d->flags & F_TARGET_DYNAMIC); 
 		f |= d->flags & F_TARGET_BYTE; 
 		text += Target::string_from_word(f); 
-		d= dynamic_cast <const Dynamic_Dep *> (d)->dep.get(); 
+		d= to <Dynamic_Dep> (d)->dep.get(); 
 	}
-	assert(dynamic_cast <const Plain_Dep *> (d)); 
-	const Plain_Dep *sin= dynamic_cast <const Plain_Dep *> (d); 
+	assert(to <Plain_Dep> (d)); 
+	const Plain_Dep *sin= to <Plain_Dep> (d); 
 	assert(!(sin->flags & F_TARGET_DYNAMIC)); 
 	Flags f= sin->flags & F_TARGET_BYTE;
 	text += Target::string_from_word(f); 
@@ -832,19 +989,19 @@ string Dynamic_Dep::format_word() const
 	return format(S_NOFLAGS | S_WORD | S_COLOR_WORD, quotes);
 }
 
-shared_ptr <const Dep> Dynamic_Dep::instantiate(const map <string, string> &mapping) const
+Ref <const Dep> Dynamic_Dep::instantiate(const map <string, string> &mapping) const
 {
-	shared_ptr <Dynamic_Dep> ret= make_shared <Dynamic_Dep> (flags, places, dep->instantiate(mapping));
+	Ref <Dynamic_Dep> ret= make_dep <Dynamic_Dep> (flags, places, dep->instantiate(mapping));
 	ret->index= index;
 	ret->top= top; 
 	return ret;
 }
 
-shared_ptr <const Dep> Plain_Dep::instantiate(const map <string, string> &mapping) const
+Ref <const Dep> Plain_Dep::instantiate(const map <string, string> &mapping) const
 {
 	shared_ptr <Place_Param_Target> ret_target= place_param_target.instantiate(mapping);
 
-	shared_ptr <Dep> ret= make_shared <Plain_Dep> (flags, places, *ret_target, place, variable_name);
+	Ref <Dep> ret= make_dep <Plain_Dep> (flags, places, *ret_target, place, variable_name);
 	ret->index= index;
 	ret->top= top; 
 
@@ -862,14 +1019,14 @@ shared_ptr <const Dep> Plain_Dep::instantiate(const map <string, string> &mappin
 	return ret;
 }
 
-shared_ptr <const Dep> 
+Ref <const Dep> 
 Compound_Dep::instantiate(const map <string, string> &mapping) const
 {
-	shared_ptr <Compound_Dep> ret= make_shared <Compound_Dep> (flags, places, place);
+	Ref <Compound_Dep> ret= make_dep <Compound_Dep> (flags, places, place);
 	ret->index= index;
 	ret->top= top; 
 
-	for (const shared_ptr <const Dep> &d:  deps) {
+	for (const Ref <const Dep> &d:  deps) {
 		ret->push_back(d->instantiate(mapping));
 	}
 	
@@ -880,7 +1037,7 @@ bool Compound_Dep::is_unparametrized() const
 /* A compound dependency is parametrized when any of its contained
  * dependency is parametrized.  */
 {
-	for (shared_ptr <const Dep> d:  deps) {
+	for (Ref <const Dep> d:  deps) {
 		if (! d->is_unparametrized())
 			return false;
 	}
@@ -894,7 +1051,7 @@ string Compound_Dep::format(Style style, bool &) const
 {
 	string ret;
 	bool quotes= false;
-	for (const shared_ptr <const Dep> &d:  deps) {
+	for (const Ref <const Dep> &d:  deps) {
 		if (! ret.empty())
 			ret += " ";
 		ret += d->format(style, quotes); 
@@ -931,13 +1088,13 @@ string Compound_Dep::format_src() const
 	return ret; 
 }
 
-shared_ptr <const Dep> Concat_Dep::instantiate(const map <string, string> &mapping) const
+Ref <const Dep> Concat_Dep::instantiate(const map <string, string> &mapping) const
 {
-	shared_ptr <Concat_Dep> ret= make_shared <Concat_Dep> (flags, places);
+	Ref <Concat_Dep> ret= make_dep <Concat_Dep> (flags, places);
 	ret->index= index;
 	ret->top= top; 
 
-	for (const shared_ptr <const Dep> &d:  deps) {
+	for (const Ref <const Dep> &d:  deps) {
 		ret->push_back(d->instantiate(mapping)); 
 	}
 
@@ -948,7 +1105,7 @@ bool Concat_Dep::is_unparametrized() const
 /* A concatenated dependency is parametrized when any of its contained 
  * dependency is parametrized.  */
 {
-	for (shared_ptr <const Dep> d:  deps) {
+	for (Ref <const Dep> d:  deps) {
 		if (! d->is_unparametrized())
 			return false;
 	}
@@ -979,7 +1136,7 @@ string Concat_Dep::format(Style style, bool &quotes) const
 		ret += f;
 	}
 	bool quotes_ret= true; 
-	for (const shared_ptr <const Dep> &d:  deps) {
+	for (const Ref <const Dep> &d:  deps) {
 		bool quotes_d= quotes;
 		ret += d->format(style, quotes_d); 
 		if (! quotes_d)
@@ -1027,8 +1184,8 @@ bool Concat_Dep::is_normalized() const
 	return true;
 }
 
-void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
-				  vector <shared_ptr <const Dep> > &deps_,
+void Concat_Dep::normalize_concat(Ref <const Concat_Dep> dep,
+				  vector <Ref <const Dep> > &deps_,
 				  int &error) 
 {
 	size_t k_init= deps_.size(); 
@@ -1042,7 +1199,7 @@ void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
 
 	if (dep->flags || dep->index >= 0 || dep->top) {
 		for (size_t k= k_init;  k < deps_.size();  ++k) {
-			shared_ptr <Dep> d_new= Dep::clone(deps_[k]); 
+			Ref <Dep> d_new= Dep::clone(deps_[k]); 
 			/* The innermost flag is kept */
 			d_new->add_flags(dep, false); 
 			if (dep->index >= 0)
@@ -1053,15 +1210,15 @@ void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
 	}
 }
 
-void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep, 
-				  vector <shared_ptr <const Dep> > &deps_,
+void Concat_Dep::normalize_concat(Ref <const Concat_Dep> dep, 
+				  vector <Ref <const Dep> > &deps_,
 				  size_t start_index,
 				  int &error) 
 {
 	assert(start_index < dep->deps.size()); 
 
 	if (start_index + 1 == dep->deps.size()) {
-		shared_ptr <const Dep> dd= dep->deps.at(start_index);
+		Ref <const Dep> dd= dep->deps.at(start_index);
 		if (auto compound_dd= to <Compound_Dep> (dd)) {
 			for (const auto &d:  compound_dd->deps) {
 				normalize(d, deps_, error); 
@@ -1082,11 +1239,11 @@ void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
 			assert(false); 
 		}
 	} else {
-		vector <shared_ptr <const Dep> > vec1, vec2;
+		vector <Ref <const Dep> > vec1, vec2;
 		normalize_concat(dep, vec2, start_index + 1, error); 
 		if (error && ! option_keep_going)
 			return; 
-		shared_ptr <const Dep> dd= dep->deps.at(start_index); 
+		Ref <const Dep> dd= dep->deps.at(start_index); 
 		if (auto compound_dd= to <Compound_Dep> (dd)) {
 			for (const auto &d:  compound_dd->deps) {
 				normalize(d, vec1, error); 
@@ -1109,7 +1266,7 @@ void Concat_Dep::normalize_concat(shared_ptr <const Concat_Dep> dep,
 
 		for (const auto &d1:  vec1) {
 			for (const auto &d2:  vec2) {
-				shared_ptr <const Dep> d= concat(d1, d2, error);
+				Ref <const Dep> d= concat(d1, d2, error);
 				if (error && ! option_keep_going) 
 					return; 
 				if (d) 
@@ -1125,8 +1282,8 @@ Target Concat_Dep::get_target() const
 	assert(false);
 }
 
-shared_ptr <const Dep> Concat_Dep::concat(shared_ptr <const Dep> a,
-					  shared_ptr <const Dep> b,
+Ref <const Dep> Concat_Dep::concat(Ref <const Dep> a,
+					  Ref <const Dep> b,
 					  int &error)
 {
 	assert(a);
@@ -1205,8 +1362,8 @@ shared_ptr <const Dep> Concat_Dep::concat(shared_ptr <const Dep> a,
 		return concat_complex(a, b); 
 }
 
-shared_ptr <const Plain_Dep> Concat_Dep::concat_plain(shared_ptr <const Plain_Dep> a,
-						      shared_ptr <const Plain_Dep> b)
+Ref <const Plain_Dep> Concat_Dep::concat_plain(Ref <const Plain_Dep> a,
+						      Ref <const Plain_Dep> b)
 {
 	assert(a);
 	assert(b);
@@ -1226,8 +1383,8 @@ shared_ptr <const Plain_Dep> Concat_Dep::concat_plain(shared_ptr <const Plain_De
 				       b->place_param_target.place_name.unparametrized(),
 				       a->place_param_target.place_name.place); 
 
-	shared_ptr <Plain_Dep> ret= 
-		make_shared <Plain_Dep> (flags_combined,
+	Ref <Plain_Dep> ret= 
+		make_dep <Plain_Dep> (flags_combined,
 					 a->places,
 					 Place_Param_Target(flags_combined & F_TARGET_TRANSIENT,
 							    place_name_combined,
@@ -1239,8 +1396,8 @@ shared_ptr <const Plain_Dep> Concat_Dep::concat_plain(shared_ptr <const Plain_De
 	return ret; 
 }
 
-shared_ptr <const Concat_Dep> Concat_Dep::concat_complex(shared_ptr <const Dep> a,
-							 shared_ptr <const Dep> b)
+Ref <const Concat_Dep> Concat_Dep::concat_complex(Ref <const Dep> a,
+							 Ref <const Dep> b)
 /* We don't have to make any checks here because any errors will be
  * caught later when the resulting plain dependencies are concatenated.
  * However, checking errors here is faster, since it avoids building
@@ -1248,7 +1405,7 @@ shared_ptr <const Concat_Dep> Concat_Dep::concat_complex(shared_ptr <const Dep>
 {
 	assert(! (to <const Plain_Dep> (a) && to <const Plain_Dep> (b))); 
 
-	shared_ptr <Concat_Dep> ret= make_shared <Concat_Dep> (); 
+	Ref <Concat_Dep> ret= make_dep <Concat_Dep> (); 
 
 	if (auto concat_a= to <const Concat_Dep> (a)) {
 		for (auto d:  concat_a->deps) 
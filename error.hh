@@ -85,6 +85,8 @@
 
 #include <assert.h>
 
+#include <unordered_map>
+
 #include "options.hh"
 #include "text.hh"
 #include "color.hh"
@@ -233,6 +235,10 @@ class Place
  *
  * Places are used to show the location of an error on standard error
  * output.
+ *
+ * Place objects are stored in all dependencies, and therefore are kept
+ * small:  filenames are interned, and only formatted when a message is
+ * printed. 
  */ 
 {
 public:
@@ -245,12 +251,6 @@ public:
 		ENV_OPTIONS   /* In $STU_OPTIONS */
 	} type;
 
-	string text;
-	/* INPUT_FILE:  Name of the file in which the error occurred.
-	 *              Empty string for standard input.  
-	 * OPTION:  Name of the option (a single character)
-	 * Others:  Unused  */ 
-
 	unsigned line; 
 	/* INPUT_FILE:  Line number, one-based.  
 	 * Others:  unused.  */ 
@@ -263,25 +263,31 @@ public:
 
 	Place() 
 	/* Empty */ 
-		:  type(Type::EMPTY) 
+		:  type(Type::EMPTY),
+		   line(0),
+		   column(0),
+		   text(0)
 	{ }
 
 	Place(Type type_,
-	      string filename_, 
+	      const string &filename_, 
 	      unsigned line_, 
 	      unsigned column_)
 	/* Generic constructor */ 
 		:  type(type_),
-		   text(filename_),
 		   line(line_),
-		   column(column_)
+		   column(column_),
+		   text(intern(filename_))
 	{ 
 		assert(line >= 1);
 	}
 
 	Place(Type type_)
 	/* In command line argument (ARGV) */ 
-		:  type(type_)
+		:  type(type_),
+		   line(0),
+		   column(0),
+		   text(0)
 	{
 		assert(type == Type::ARGUMENT); 
 	}
@@ -289,7 +295,9 @@ public:
 	Place(Type type_, char option)
 	/* In an option (OPTION) */
 		:  type(type_),
-		   text(string(&option, 1))
+		   line(0),
+		   column(0),
+		   text(intern(string(&option, 1)))
 	{ 
 		assert(type == Type::OPTION); 
 	}
@@ -298,6 +306,12 @@ public:
 	Type get_type() const { return type; }
 	const char *get_filename_str() const;
 
+	const string &get_text() const {  return texts[text];  }
+	/* INPUT_FILE:  Name of the file in which the error occurred.
+	 *              Empty string for standard input.  
+	 * OPTION:  Name of the option (a single character)
+	 * Others:  Unused  */ 
+
 	const Place &operator<<(string message) const; 
 	/* Print the trace to STDERR as part of an error message.  The 
 	 * trace is printed as a single line, which can be parsed by
@@ -327,6 +341,28 @@ public:
 	/* A static empty place object, used in various places when a
 	 * reference to an empty place object is needed.  Otherwise,
 	 * Place() is an empty place.  */
+
+	static bool quiet;
+	/* When set, print() prints nothing.  Set while files are
+	 * tokenized in advance by Tokenizer::parse_includes(); errors
+	 * are then printed when they are tokenized for real.  */
+
+private:
+
+	unsigned text;
+	/* Index into TEXTS; see get_text() */ 
+
+	static vector <string> texts;
+	/* All interned texts.  Element zero is the empty string.  */ 
+
+	static unordered_map <string, unsigned> indexes;
+	/* The indexes into TEXTS */ 
+
+	static unsigned index_last;
+	/* The text interned last.  Most places are in the same file as
+	 * the previous one.  */ 
+
+	static unsigned intern(const string &text_);
 };
 
 class Trace
@@ -357,7 +393,27 @@ public:
 	}
 };
 
+vector <string> Place::texts(1);
+unordered_map <string, unsigned> Place::indexes;
+unsigned Place::index_last= 0;
 const Place Place::place_empty;
+bool Place::quiet= false;
+
+unsigned Place::intern(const string &text_)
+{
+	if (texts[index_last] == text_)
+		return index_last;
+
+	if (text_.empty())
+		return index_last= 0;
+	auto i= indexes.find(text_);
+	if (i != indexes.end())
+		return index_last= i->second;
+	index_last= texts.size();
+	texts.push_back(text_);
+	indexes[text_]= index_last;
+	return index_last;
+}
 
 const Place &Place::operator<<(string message) const
 {
@@ -371,6 +427,9 @@ void Place::print(string message,
 {
 	assert(message != "");
 
+	if (quiet)
+		return; 
+
 	switch (type) {
 	default:  
 	case Type::EMPTY:
@@ -401,12 +460,12 @@ void Place::print(string message,
 		break;
 
 	case Type::OPTION:
-		assert(text.size() == 1); 
+		assert(get_text().size() == 1); 
 		fprintf(stderr,
 			"%sOption %s-%c%s: %s\n",
 			color,
 			color_word,
-			text[0],
+			get_text()[0],
 			Color::end,
 			message.c_str());
 		break;
@@ -446,9 +505,9 @@ string Place::as_argv0() const
 const char *Place::get_filename_str() const
 {
 	assert(type == Type::INPUT_FILE);
-	return text == ""
+	return text == 0
 		? "<stdin>"
-		: text.c_str();
+		: get_text().c_str();
 }
 
 void print_warning(const Place &place, string message)
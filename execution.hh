@@ -28,12 +28,20 @@
 
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <unordered_set>
+
+#include "state.hh"
 #include "buffer.hh"
 #include "parser.hh"
 #include "job.hh"
+#include "jobserver.hh"
 #include "tokenizer.hh"
 #include "rule.hh"
 #include "timestamp.hh"
+#include "cache.hh"
+#include "order.hh"
+#include "adjacency.hh"
 
 typedef unsigned Proceed;
 /* This is used as the return value of the functions execute*() Defined
@@ -57,8 +65,27 @@ enum {
 	 * P_FINISHED is also set.  This does not imply that there was
 	 * an error -- for instance, the trivial flag -t may mean that
 	 * nothing more should be done.  */
+
+	P_SLOT     = 1 << 4,
+	/* More work could have been started, but no job slot was free,
+	 * either because of -j, because the pool of the rule is full,
+	 * because the system is under pressure (-L), or because no
+	 * jobserver token was available.  Only set together
+	 * with P_WAIT.  An execution that returned
+	 * this bit must be executed again as soon as a job slot becomes
+	 * free, and is therefore never put to sleep.  */
 };
 
+namespace std {
+	template <>
+	struct hash <pair <const Rule *, int> >
+	{
+		size_t operator()(const pair <const Rule *, int> &p) const {
+			return hash <const Rule *> ()(p.first) ^ p.second; 
+		}
+	};
+}
+
 class Execution
 /*
  * Base class of all executions.
@@ -102,6 +129,24 @@ public:
 		/* At least one file target is known not to exist (only
 		 * possible if there is at least one file target in
 		 * File_Execution).  */
+
+		B_SLEEPING	= 1 << 4,
+		/* The execution is waiting only for jobs that are
+		 * currently running (its own or those of its
+		 * descendants), and will not make any progress before
+		 * one of them finishes.  It is therefore not executed
+		 * by its parents until it is woken up again by
+		 * wake_up().  */
+
+		B_UNHASHED	= 1 << 5,
+		/* A dependency may have changed in a way that cannot be
+		 * detected from the content of files, e.g., a transient
+		 * target was executed.  Only used with the state file
+		 * and the cache.  Propagated to the parent executions
+		 * like INPUTS.  */
+
+		B_COMPACTED	= 1 << 6,
+		/* compact() was called */
 	};
 
 	void raise(int error_);
@@ -109,7 +154,7 @@ public:
 	 * error code, and throw an error except with the keep-going
 	 * option.  Does not print any error message.  */
 
-	Proceed execute_base_A(shared_ptr <const Dep> dep_link);
+	Proceed execute_base_A(Ref <const Dep> dep_link);
 	/* DEPENDENCY_LINK must not be null.  In the return value, at
 	 * least one bit is set.  The P_FINISHED bit indicates only that
 	 * tasks related to this function are done, not the whole
@@ -117,9 +162,9 @@ public:
 
 	int get_error() const {  return error;  }
 
-	void read_dynamic(shared_ptr <const Plain_Dep> dep_target,
-			  vector <shared_ptr <const Dep> > &deps,
-			  shared_ptr <const Dep> dep,
+	void read_dynamic(Ref <const Plain_Dep> dep_target,
+			  vector <Ref <const Dep> > &deps,
+			  Ref <const Dep> dep,
 			  Execution *dynamic_execution); 
 	/* Read dynamic dependencies from the content of
 	 * PLACE_PARAM_TARGET.  The only reason this is not static is
@@ -135,11 +180,17 @@ public:
 	 * up to the root execution. 
 	 * TEXT may be "" to not print the first message.  */ 
 
-	const map <Execution *, shared_ptr <const Dep> > &get_parents() const {  return parents;  }
+	const Small_Map <Execution *, Ref <const Dep> > &get_parents() const {  return parents;  }
 	
 	virtual bool want_delete() const= 0; 
 
-	virtual Proceed execute(shared_ptr <const Dep> dep_this)= 0;
+	static void *operator new(size_t size) {  return Arena::allocate(size);  }
+	static void operator delete(void *p, size_t size) {  Arena::deallocate(p, size);  }
+	/* Execution objects of all types are allocated in the arena.
+	 * Since the destructor is virtual, SIZE is that of the actual
+	 * type.  */
+
+	virtual Proceed execute(Ref <const Dep> dep_this)= 0;
 	/* 
 	 * Start the next job(s).  This will also terminate jobs when
 	 * they don't need to be run anymore, and thus it can be called
@@ -170,10 +221,10 @@ public:
 
 	virtual string format_src() const= 0;
 
-	virtual void notify_result(shared_ptr <const Dep> dep,
+	virtual void notify_result(Ref <const Dep> dep,
 				   Execution *source,
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source)
+				   Ref <const Dep> dep_source)
 	/* The child execution SOURCE notifies THIS about a new result.
 	 * Only called when the dependency linking the two had one of the
 	 * F_RESULT_* flag.  The given flag contains only one of the two
@@ -202,13 +253,18 @@ public:
 	/* Set once before calling Execution::main().  Unchanging during
 	 * the whole call to Execution::main().  */ 
 
-	static void main(const vector <shared_ptr <const Dep> > &deps);
+	static void main(const vector <Ref <const Dep> > &deps);
 	/* Main execution loop.  This throws ERROR_BUILD and
 	 * ERROR_LOGICAL.  */
 
-	static Target get_target_for_cache(Target target); 
-	/* Get the target value used for caching.  I.e, return TARGET
-	 * with certain flags removed.  */
+	static void print_statistics();
+	/* Print the statistics about compacted executions, for the -z
+	 * option */
+
+	static Target_Id get_target_id_for_cache(const Dep *dep); 
+	/* Get the ID of the target used for caching.  I.e, the target of
+	 * DEP with certain flags removed.  DEP must be a Plain_Dep, or a
+	 * Dynamic_Dep of a Plain_Dep.  */
 
 protected: 
 
@@ -220,17 +276,24 @@ protected:
 	 * defined in error.hh; zero denotes the absence of an
 	 * error.  */ 
 
-	map <Execution *, shared_ptr <const Dep> > parents; 
-	/* The parent executions.  This is a map rather than an
-	 * unsorted_map because typically, the number of elements is
-	 * always very small, i.e., mostly one, and a map is better
-	 * suited in this case.  The map is sorted, but by the execution
-	 * pointer, i.e., the sorting is arbitrary as far as Stu is
+	Small_Map <Execution *, Ref <const Dep> > parents; 
+	/* The parent executions.  Typically, the number of elements is
+	 * very small, i.e., mostly one, and they are then stored
+	 * inline.  The order is arbitrary as far as Stu is
 	 * concerned.  */
 
-	set <Execution *> children;
+	Small_Set <Execution *> children;
 	/* Currently connected executions */
 
+	Small_Set <Execution *> children_ready;
+	/* The subset of CHILDREN that are not sleeping, i.e., that have
+	 * to be executed by execute_children().  A child is removed
+	 * from this set in all of its parents when it falls asleep, and
+	 * inserted back when it is woken up.  Thus, when a job
+	 * finishes, only the executions on the paths from the job's
+	 * execution to the root execution are executed again, instead
+	 * of the whole graph of active executions.  */
+
 	Timestamp timestamp; 
 	/* Latest timestamp of a (direct or indirect) dependency
 	 * that was not rebuilt.  Files that were rebuilt are not
@@ -239,7 +302,27 @@ protected:
 	 * itself, if any.  This final timestamp is then carried over to the
 	 * parent executions.  */
 
-	vector <shared_ptr <const Dep> > result; 
+	set <string> inputs;
+	/* The files whose timestamps were propagated to this execution,
+	 * i.e., the direct file dependencies, including those reached
+	 * through transients and dynamic dependencies.  Only used with
+	 * the state file, to decide by content whether File_Execution
+	 * must be rebuilt, and with the cache.  */
+
+	uint64_t critical;
+	/* The length of the longest chain of commands among the
+	 * finished dependencies of THIS, in microseconds, using the
+	 * durations measured in this run or recorded in the state file.
+	 * Does not include the command of THIS itself.  */
+
+	uint64_t priority;
+	/* The estimated length of the critical path of THIS, used with
+	 * -m critical to execute children with long critical paths
+	 * first.  For File_Execution, this is initialized from the
+	 * state file.  It is increased to the priority of children
+	 * when they are connected.  */
+
+	vector <Ref <const Dep> > result; 
 	/* The final list of dependencies represented by the target.
 	 * This does not include any dynamic dependencies, i.e., all
 	 * dependencies are flattened to Plain_Dep's.  Not used
@@ -261,17 +344,75 @@ protected:
 	 * used.  Null by default, and set by individual implementations
 	 * in their constructor if necessary.  */ 
 
+	Topological_Order::Node node;
+	/* The node of THIS in the graph of rules used to find cycles,
+	 * or NODE_NONE when not yet known.  Only accessed through
+	 * get_node().  */
+
 	Execution(shared_ptr <const Rule> param_rule_= nullptr)
 		:  bits(0),
 		   error(0),
 		   timestamp(Timestamp::UNDEFINED),
-		   param_rule(param_rule_)
+		   critical(0),
+		   priority(0),
+		   param_rule(param_rule_),
+		   node(Topological_Order::NODE_NONE)
 	{  }
 
+	Topological_Order::Node get_node(Topological_Order::Node after);
+	/* The node of THIS.  When it does not exist yet, it is placed
+	 * directly after AFTER in the order.  Must not be called
+	 * before PARAM_RULE is set.  */
+
+	void link_node(Execution *parent);
+	/* Insert the edge PARENT->THIS into the graph of rules without
+	 * checking for cycles.  Used when the link to PARENT is kept
+	 * without calling find_cycle().  */
+
+	virtual bool is_leaf() const {  return false;  }
+	/* Whether THIS never has children.  Such executions cannot be
+	 * part of a cycle, and have no node in the graph of rules.  */
+
+	virtual void compact();
+	/* Called by the first parent to disconnect from THIS once THIS
+	 * is finished with all flags.  Free everything that was only
+	 * needed to build THIS, and add its approximate size to
+	 * SIZE_COMPACTED.  Only what later parents still need is kept,
+	 * i.e., the bits, the error, the timestamps, the results, the
+	 * inputs and the targets.  Implementations call this
+	 * implementation.  */
+
+	static size_t count_compacted, size_compacted; 
+
+	static size_t get_size(const string &s);
+	static size_t get_size(const set <string> &s);
+	static size_t get_size(const map <string, string> &m);
+	/* The approximate size of the memory allocated by the given
+	 * container, for the statistics */ 
+
+	virtual uint64_t get_duration() const {  return 0;  }
+	/* The duration of the command of THIS, in microseconds, as
+	 * measured or recorded */ 
+
+	void update_priority(uint64_t priority_child); 
+	/* Increase the priority of THIS and its ancestors to at least
+	 * the given value */
+
 	Proceed execute_children();
-	/* Execute already-active children */
+	/* Execute already-active children that are not sleeping */
+
+	void update_sleeping(Proceed proceed, Execution *parent);
+	/* Called after THIS was executed by PARENT with the result
+	 * PROCEED.  Put THIS to sleep when it is waiting only for
+	 * running jobs, and make sure it is awake otherwise.  */
+
+	void fall_asleep();
+	void wake_up(); 
+	/* Set or clear B_SLEEPING, and update CHILDREN_READY in all
+	 * parents accordingly.  Waking up an execution also wakes up
+	 * all its ancestors.  */
 
-	Proceed execute_base_B(shared_ptr <const Dep> dep_link); 
+	Proceed execute_base_B(Ref <const Dep> dep_link); 
 	/* Second pass (trivial dependencies).  Called once we are sure
 	 * that the target must be built.  Arguments and return value
 	 * have the same semantics as execute_base_B().  */
@@ -280,19 +421,20 @@ protected:
 		assert(buffer_A.empty()); 
 		assert(buffer_B.empty()); 
 		assert(children.empty()); 
+		assert(children_ready.empty()); 
 	}
 
 	const Buffer &get_buffer_A() const {  return buffer_A;  }
 	const Buffer &get_buffer_B() const {  return buffer_B;  }
 
-	void push(shared_ptr <const Dep> dep);
+	void push(Ref <const Dep> dep);
 	/* Push a dependency to the default buffer, breaking down
 	 * non-normalized dependencies while doing so.  DEP does not
 	 * have to be normalized.  */
 
-	void push_result(shared_ptr <const Dep> dd); 
+	void push_result(Ref <const Dep> dd); 
 	void disconnect(Execution *const child,
-			shared_ptr <const Dep> dep_child);
+			Ref <const Dep> dep_child);
 	/* Remove an edge from the dependency graph.  Propagate
 	 * information from CHILD to THIS, and then delete CHILD if
 	 * necessary.  */
@@ -314,7 +456,7 @@ protected:
 	 * is always null.  Only used to check for cycles on the rule
 	 * level.  */ 
 
-	virtual bool optional_finished(shared_ptr <const Dep> dep_link)= 0;
+	virtual bool optional_finished(Ref <const Dep> dep_link)= 0;
 	/* Whether the execution would be finished if this was an
 	 * optional dependency.  Check whether this is an optional
 	 * dependency and if it is, return TRUE when the file does not
@@ -331,29 +473,51 @@ protected:
 	static bool out_message_done;
 	/* Whether the STDOUT message is not "Targets are up to date" */
 
-	static unordered_map <Target, Execution *> executions_by_target;
-	/* All cached Execution objects by each of their Target.  Such
-	 * Execution objects are never deleted.  */
+	static vector <Execution *> executions_children;
+	/* Used by execute_children() as a stack */
+
+	static vector <Execution *> executions_by_target;
+	/* All cached Execution objects by the ID of each of their
+	 * Target.  Null for targets without an Execution object.  Such
+	 * Execution objects are never deleted.  Only accessed through
+	 * get_execution_by_target().  */
+
+	static Execution *&get_execution_by_target(Target_Id id) {
+		if (id >= executions_by_target.size())
+			executions_by_target.resize(Target_Table::size(), nullptr); 
+		return executions_by_target[id]; 
+	}
+
+	static unordered_map <pair <const Rule *, int>, Topological_Order::Node> nodes_by_rule;
+	/* The nodes of executions that have a rule and a dynamic depth
+	 * of two or more, by the parametrized rule and the dynamic
+	 * depth, i.e., by what same_rule() compares.  For smaller
+	 * depths, the node is stored in the rule itself.  Executions
+	 * without a rule have their own node, except leaves, which have
+	 * none.  */
 
 	static bool find_cycle(Execution *parent,
 			       Execution *child,
-			       shared_ptr <const Dep> dep_link);
+			       Ref <const Dep> dep_link);
 	/* Find a cycle.  Assuming that the edge parent->child will be
-	 * added, find a directed cycle that would be created.  Start at
-	 * PARENT and perform a depth-first search upwards in the
-	 * hierarchy to find CHILD.  DEPENDENCY_LINK is the link that
-	 * would be added between child and parent, and would create a
-	 * cycle.  */
+	 * added, find a directed cycle that would be created.  The
+	 * edge is first inserted into the graph of rules given by
+	 * get_node(); only when that closes a cycle, start at PARENT
+	 * and perform a depth-first search upwards in the hierarchy to
+	 * find CHILD.  DEPENDENCY_LINK is the link that would be added
+	 * between child and parent, and would create a cycle.  */
 
 	static bool find_cycle(vector <Execution *> &path,
+			       unordered_set <const Execution *> &visited,
 			       Execution *child,
-			       shared_ptr <const Dep> dep_link); 
+			       Ref <const Dep> dep_link); 
 	/* Helper function.  PATH is the currently explored path.
 	 * PATH[0] is the original PARENT; PATH[end] is the oldest
-	 * grandparent found yet.  */ 
+	 * grandparent found yet.  VISITED contains the executions
+	 * from which CHILD was already searched without success.  */ 
 
 	static void cycle_print(const vector <Execution *> &path,
-				shared_ptr <const Dep> dep);
+				Ref <const Dep> dep);
 	/* Print the error message of a cycle on rule level.
 	 * Given PATH = [a, b, c, d, ..., x], the found cycle is
 	 * [x <- a <- b <- c <- d <- ... <- x], where A <- B denotes
@@ -367,10 +531,10 @@ protected:
 	/* Whether both executions have the same parametrized rule.
 	 * Only used for finding cycle.  */ 
 
-	shared_ptr <const Dep> append_top(shared_ptr <const Dep> dep, 
-					  shared_ptr <const Dep> top); 
-	shared_ptr <const Dep> set_top(shared_ptr <const Dep> dep,
-				       shared_ptr <const Dep> top); 
+	Ref <const Dep> append_top(Ref <const Dep> dep, 
+					  Ref <const Dep> top); 
+	Ref <const Dep> set_top(Ref <const Dep> dep,
+				       Ref <const Dep> top); 
 
 private: 
 
@@ -388,14 +552,14 @@ private:
 	 * dependencies, the target must be rebuilt anyway.  Does not
 	 * contain compound dependencies.  */
 
-	Proceed connect(shared_ptr <const Dep> dep_link_parent,
-			shared_ptr <const Dep> dep_child);
+	Proceed connect(Ref <const Dep> dep_link_parent,
+			Ref <const Dep> dep_child);
 	/* Add an edge to the dependency graph.  Deploy a new child
 	 * execution.  LINK is the link from the THIS's parent to THIS.
 	 * Note: the top-level flags of LINK.DEPENDENCY may be modified.
 	 * DEPENDENCY_CHILD must be normalized.  */
 
-	Execution *get_execution(shared_ptr <const Dep> dep);
+	Execution *get_execution(Ref <const Dep> dep);
 	/* Get an existing Execution or create a new one for the
 	 * given DEPENDENCY.  Return null when a strong cycle was found;
 	 * return the execution otherwise.  PLACE is the place of where
@@ -407,12 +571,12 @@ private:
 	static bool hide_link_from_message(Flags flags) {
 		return flags & F_RESULT_NOTIFY; 
 	}
-	static bool same_dependency_for_print(shared_ptr <const Dep> d1,
-					      shared_ptr <const Dep> d2)
+	static bool same_dependency_for_print(Ref <const Dep> d1,
+					      Ref <const Dep> d2)
 	{
-		shared_ptr <const Plain_Dep> p1=
+		Ref <const Plain_Dep> p1=
 			to <Plain_Dep> (d1); 
-		shared_ptr <const Plain_Dep> p2=
+		Ref <const Plain_Dep> p2=
 			to <Plain_Dep> (d2); 
 		if (!p1 && to <Dynamic_Dep> (d1))
 			p1= to <Plain_Dep>
@@ -448,7 +612,7 @@ class File_Execution
 {
 public:
 
-	File_Execution(shared_ptr <const Dep> dep_link,
+	File_Execution(Ref <const Dep> dep_link,
 		       Execution *parent,
 		       shared_ptr <const Rule> rule,
 		       shared_ptr <const Rule> param_rule,
@@ -460,7 +624,7 @@ public:
 	 * done in the constructor.  The parent is connected to this iff
 	 * ERROR_ADDITIONAL is zero after the call.  */
 
-	void read_variable(shared_ptr <const Dep> dep); 
+	void read_variable(Ref <const Dep> dep); 
 	/* Read the content of the file into a string as the
 	 * variable value.  THIS is the variable execution.  Write the
 	 * result into THIS's RESULT_VARIABLE.  */
@@ -476,7 +640,7 @@ public:
 	}
 
 	virtual bool want_delete() const {  return false;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(Ref <const Dep> dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual string format_src() const {
@@ -488,16 +652,32 @@ public:
 	}
 
 	static size_t executions_by_pid_size;
+	static size_t executions_by_pid_capacity; 
 	static pid_t *executions_by_pid_key;
 	static File_Execution **executions_by_pid_value; 
 	/* The currently running executions by process IDs.  Write
 	 * access to this is enclosed in a Signal_Blocker.  */
-	/* Both arrays are malloc'ed, have the same length, and are both
-	 * sorted by PID.  malloc() is only called once for each array,
-	 * giving the allocated memory a length that will be enough for
-	 * all jobs we will ever run, based on the value passed via the
-	 * -j option, so we avoid excessive calling of realloc(), and
-	 * race conditions while accessing this.  */
+	/* This is a hash table with open addressing and linear
+	 * probing, indexed by the PID.  Both arrays are malloc'ed and
+	 * have the length EXECUTIONS_BY_PID_CAPACITY, which is a power
+	 * of two.  Unused slots have the key zero, which is never the
+	 * PID of a job.  EXECUTIONS_BY_PID_SIZE is the number of used
+	 * slots.  malloc() is only called once for each array, giving
+	 * the allocated memory a length that will be enough for all
+	 * jobs we will ever run, based on the value passed via the -j
+	 * option, so we avoid excessive calling of realloc(), and
+	 * race conditions while accessing this.  The capacity is at
+	 * least twice the number of jobs, so that lookups, insertions
+	 * and removals take constant time.  */
+
+	static size_t find_pid(pid_t pid); 
+	/* The index of PID in EXECUTIONS_BY_PID_*, or
+	 * EXECUTIONS_BY_PID_CAPACITY if it is not present */
+
+	static size_t insert_pid(pid_t pid, File_Execution *execution);
+	static void erase_pid(size_t index); 
+	/* Must be called from within a Signal_Blocker.  Insertion
+	 * returns the index of the new entry.  */
 	/* For all file executions stored here, the following variables
 	 * are never changed as long as the File_Execution objects are
 	 * stored there, such that they can be accessed from
@@ -510,8 +690,11 @@ public:
 
 protected:
 
-	virtual bool optional_finished(shared_ptr <const Dep> dep_link);
+	virtual bool optional_finished(Ref <const Dep> dep_link);
 	virtual int get_depth() const {  return 0;  }
+	virtual uint64_t get_duration() const {  return duration;  }
+	virtual bool is_leaf() const {  return param_rule == nullptr;  }
+	virtual void compact(); 
 
 private:
 
@@ -557,7 +740,7 @@ private:
 	 * when a source code file is given as a dependency).
 	 * Individual dynamic dependencies do have rules, in order for
 	 * cycles to be detected.  Null if and only if PARAM_RULE is
-	 * null.  */ 
+	 * null, except after compact().  */ 
 
 	Job job;
 	/* The job used to execute this rule's command */ 
@@ -575,6 +758,23 @@ private:
 	 * passed will be set when the execution is finished.  Only the
 	 * first C_FINISHABLE flags are used.  */
 
+	uint64_t signature;
+	/* The signature of the command.  Only set when USE_SIGNATURE()
+	 * is true and the state file is used, once the targets have
+	 * been checked.  */ 
+
+	string cache_key;
+	/* The key of the targets in the cache.  Empty when the cache is
+	 * not used, or before the command is run.  */
+
+	uint64_t duration;
+	/* The duration of the command in microseconds.  Measured when
+	 * the command is run, and otherwise taken from the state file.
+	 * Zero when unknown.  */
+
+	uint64_t time_started;
+	/* When the job was started, as returned by get_time() */ 
+
 	~File_Execution(); 
 
 	bool remove_if_existing(bool output); 
@@ -599,6 +799,39 @@ private:
 	/* Print the command and its associated variable assignments,
 	 * according to the selected verbosity level.  */
 
+	bool use_signature() const;
+	/* Whether all targets are files built by a command, a copy rule
+	 * or with hardcoded content, i.e., whether the command has a
+	 * signature */
+
+	bool use_state() const;
+	/* Whether the state file is used to decide by content whether
+	 * THIS must be rebuilt, i.e., USE_SIGNATURE() is true, the
+	 * content is not hardcoded, all targets exist, and no
+	 * dependency changed in a way that is not visible in the
+	 * content of files */
+
+	bool use_cache() const;
+	/* Whether the cache is enabled and can be used for THIS */ 
+
+	string get_signature_text() const;
+	/* The text from which the signature of the command is
+	 * computed.  The cache uses the text itself, as it needs a
+	 * wider digest.  */
+
+	uint64_t get_signature() const {
+		const string text= get_signature_text(); 
+		return State::hash(text.data(), text.size()); 
+	}
+	/* Compute the signature of the command, as stored in the state
+	 * file */
+
+	void restored(); 
+	/* Called after the targets were restored from the cache */
+
+	static uint64_t get_time(); 
+	/* The current time of the monotonic clock in microseconds */
+
 	void print_as_job() const;
 	/* Print a line to stdout for a running job, as output of SIGUSR1.
 	 * Is currently running.  */ 
@@ -606,7 +839,7 @@ private:
 	void write_content(const char *filename, const Command &command); 
 	/* Create the file FILENAME with content from COMMAND */
 
-	static unordered_map <string, Timestamp> transients;
+	static unordered_map <Target_Id, Timestamp> transients;
 	/* The timestamps for transient targets.  This container plays
 	 * the role of the file system for transient targets, holding
 	 * their timestamps, and remembering whether they have been
@@ -628,7 +861,7 @@ class Transient_Execution
 {
 public:
 
-	Transient_Execution(shared_ptr <const Dep> dep_link,
+	Transient_Execution(Ref <const Dep> dep_link,
 			    Execution *parent,
 			    shared_ptr <const Rule> rule,
 			    shared_ptr <const Rule> param_rule,
@@ -642,14 +875,14 @@ public:
 	}
 
 	virtual bool want_delete() const {  return false;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(Ref <const Dep> dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual string format_src() const;
-	virtual void notify_result(shared_ptr <const Dep> dep, 
+	virtual void notify_result(Ref <const Dep> dep, 
 				   Execution *, 
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source);
+				   Ref <const Dep> dep_source);
 	virtual void notify_variable(const map <string, string> &result_variable_child) {  
 		result_variable.insert(result_variable_child.begin(), result_variable_child.end()); 
 	}
@@ -657,10 +890,11 @@ public:
 protected:
 
 	virtual int get_depth() const {  return 0;  }
-	virtual bool optional_finished(shared_ptr <const Dep> dep_link) {  
+	virtual bool optional_finished(Ref <const Dep> dep_link) {  
 		(void) dep_link; 
 		return false;  
 	}
+	virtual void compact(); 
 
 private:
 
@@ -669,7 +903,8 @@ private:
 	 * are transients.  Contains at least one element.  */
 
 	shared_ptr <const Rule> rule;
-	/* The instantiated file rule for this execution.  Never null. */ 
+	/* The instantiated file rule for this execution.  Never null,
+	 * except after compact().  */ 
 
 	Timestamp timestamp_old;
 
@@ -691,10 +926,10 @@ class Root_Execution
 {
 public:
 
-	Root_Execution(const vector <shared_ptr <const Dep> > &dep); 
+	Root_Execution(const vector <Ref <const Dep> > &dep); 
 
 	virtual bool want_delete() const {  return true;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(Ref <const Dep> dep_this);
 	virtual bool finished() const; 
 	virtual bool finished(Flags flags) const;
 	virtual string format_src() const { return "ROOT"; }
@@ -702,7 +937,7 @@ public:
 protected:
 
 	virtual int get_depth() const {  return -1;  }
-	virtual bool optional_finished(shared_ptr <const Dep> ) {  return false;  }
+	virtual bool optional_finished(Ref <const Dep> ) {  return false;  }
 
 private:
 
@@ -726,7 +961,7 @@ class Concat_Execution
 {
 public:
 
-	Concat_Execution(shared_ptr <const Concat_Dep> dep_,
+	Concat_Execution(Ref <const Concat_Dep> dep_,
 			 Execution *parent,
 			 int &error_additional); 
 	/* DEP_ is normalized.  See File_Execution::File_Execution() for
@@ -736,7 +971,7 @@ public:
 
 	virtual int get_depth() const {  return -1;  }
 	virtual bool want_delete() const {  return true;  }
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(Ref <const Dep> dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual string format_src() const {  return dep->format_src();  }
@@ -744,17 +979,17 @@ public:
 	virtual void notify_variable(const map <string, string> &result_variable_child) {  
 		result_variable.insert(result_variable_child.begin(), result_variable_child.end()); 
 	}
-	virtual void notify_result(shared_ptr <const Dep> dep, 
+	virtual void notify_result(Ref <const Dep> dep, 
 				   Execution *source, 
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source);
+				   Ref <const Dep> dep_source);
 protected:
 
-	virtual bool optional_finished(shared_ptr <const Dep> ) {  return false;  }
+	virtual bool optional_finished(Ref <const Dep> ) {  return false;  }
 
 private:
 
-	shared_ptr <const Concat_Dep> dep;
+	Ref <const Concat_Dep> dep;
 	/* Contains the concatenation.  This is a normalized. */
 
 	unsigned stage;
@@ -762,7 +997,7 @@ private:
 	 * 1:  running normal children
 	 * 2:  finished  */
 
-	vector <shared_ptr <Compound_Dep> > collected; 
+	vector <Ref <Compound_Dep> > collected; 
 
 	void launch_stage_1(); 
 };
@@ -789,35 +1024,41 @@ class Dynamic_Execution
 {
 public:
 
-	Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
+	Dynamic_Execution(Ref <const Dynamic_Dep> dep_,
 			  Execution *parent,
 			  int &error_additional); 
 
-	shared_ptr <const Dynamic_Dep> get_dep() const {  return dep;  }
+	Ref <const Dynamic_Dep> get_dep() const {  return dep;  }
 
 	virtual bool want_delete() const;
-	virtual Proceed execute(shared_ptr <const Dep> dep_this);
+	virtual Proceed execute(Ref <const Dep> dep_this);
 	virtual bool finished() const;
 	virtual bool finished(Flags flags) const; 
 	virtual int get_depth() const {  return dep->get_depth();  }
-	virtual bool optional_finished(shared_ptr <const Dep> ) {  return false;  }
+	virtual bool optional_finished(Ref <const Dep> ) {  return false;  }
 	virtual string format_src() const;
 	virtual void notify_variable(const map <string, string> &result_variable_child) {  
 		result_variable.insert(result_variable_child.begin(), result_variable_child.end()); 
 	}
-	virtual void notify_result(shared_ptr <const Dep> dep, 
+	virtual void notify_result(Ref <const Dep> dep, 
 				   Execution *source, 
 				   Flags flags,
-				   shared_ptr <const Dep> dep_source);
+				   Ref <const Dep> dep_source);
 
 private: 
 
-	const shared_ptr <const Dynamic_Dep> dep; 
+	const Ref <const Dynamic_Dep> dep; 
 	/* A dynamic of anything */
 
 	bool is_finished; 
 };
 
+static_assert(alignof(File_Execution) <= Arena::ALIGN, "alignment of arena"); 
+static_assert(alignof(Transient_Execution) <= Arena::ALIGN, "alignment of arena"); 
+static_assert(alignof(Root_Execution) <= Arena::ALIGN, "alignment of arena"); 
+static_assert(alignof(Concat_Execution) <= Arena::ALIGN, "alignment of arena"); 
+static_assert(alignof(Dynamic_Execution) <= Arena::ALIGN, "alignment of arena"); 
+
 class Debug
 /* 
  * Padding for debug output (option -d).  During the lifetime of an
@@ -844,7 +1085,9 @@ public:
 	static void print(const Execution *, string text);
 	/* Print a line for debug mode.  The given TEXT starts with the
 	 * lower-case name of the operation being performed, followed by
-	 * parameters, and not ending in a newline or period.  */
+	 * parameters, and not ending in a newline or period.  Callers
+	 * that format TEXT check OPTION_DEBUG first, so that nothing is
+	 * formatted when not in debug mode.  */
 
 private:
 	static string padding_current;
@@ -858,12 +1101,17 @@ Rule_Set Execution::rule_set;
 Timestamp Execution::timestamp_last;
 bool Execution::hide_out_message= false;
 bool Execution::out_message_done= false;
-unordered_map <Target, Execution *> Execution::executions_by_target;
+vector <Execution *> Execution::executions_by_target;
+vector <Execution *> Execution::executions_children;
+size_t Execution::count_compacted= 0;
+size_t Execution::size_compacted= 0;
+unordered_map <pair <const Rule *, int>, Topological_Order::Node> Execution::nodes_by_rule;
 
 size_t File_Execution::executions_by_pid_size= 0;
+size_t File_Execution::executions_by_pid_capacity= 0;
 pid_t *File_Execution::executions_by_pid_key= nullptr;
 File_Execution **File_Execution::executions_by_pid_value= nullptr; 
-unordered_map <string, Timestamp> File_Execution::transients;
+unordered_map <Target_Id, Timestamp> File_Execution::transients;
 
 string Debug::padding_current= "";
 vector <const Execution *> Debug::executions; 
@@ -873,13 +1121,13 @@ Execution::~Execution()
 	/* Nop */
 }
 
-void Execution::main(const vector <shared_ptr <const Dep> > &deps)
+void Execution::main(const vector <Ref <const Dep> > &deps)
 {
 	assert(jobs >= 0);
 	timestamp_last= Timestamp::now(); 
 	Root_Execution *root_execution= new Root_Execution(deps); 
 	int error= 0; 
-	shared_ptr <const Root_Dep> dep_root= make_shared <Root_Dep> (); 
+	Ref <const Root_Dep> dep_root= make_dep <Root_Dep> (); 
 
 	try {
 		while (! root_execution->finished()) {
@@ -936,9 +1184,9 @@ void Execution::main(const vector <shared_ptr <const Dep> > &deps)
 		throw error; 
 }
 
-void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
-			     vector <shared_ptr <const Dep> > &deps,
-			     shared_ptr <const Dep> dep,
+void Execution::read_dynamic(Ref <const Plain_Dep> dep_target,
+			     vector <Ref <const Dep> > &deps,
+			     Ref <const Dep> dep,
 			     Execution *dynamic_execution)
 {
 	try {
@@ -970,7 +1218,7 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 
 			/* Parse dynamic dependency in full Stu syntax */ 
 
-			vector <shared_ptr <Token> > tokens;
+			Token_List tokens;
 			Place place_end; 
 
 			Tokenizer::parse_tokens_file
@@ -1092,7 +1340,7 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 				}
 
 				deps.push_back
-					(make_shared <Plain_Dep>
+					(make_dep <Plain_Dep>
 					 (0,
 					  Place_Param_Target
 					  (0, 
@@ -1116,9 +1364,9 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 
 			/* Check that it is unparametrized */ 
 			if (! j->is_unparametrized()) {
-				shared_ptr <const Dep> depp= j;
+				Ref <const Dep> depp= j;
 				while (to <Dynamic_Dep> (depp)) {
-					shared_ptr <const Dynamic_Dep> depp2= 
+					Ref <const Dynamic_Dep> depp2= 
 						to <Dynamic_Dep> (depp);
 					depp= depp2->dep; 
 				}
@@ -1139,17 +1387,17 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 		}
 
 		assert(! found_error || option_keep_going); 
-		vector <shared_ptr <const Dep> > deps_new;
+		vector <Ref <const Dep> > deps_new;
 
-		shared_ptr <const Dep> top_top= dep_target->top;
-		shared_ptr <Dep> no_top= Dep::clone(dep_target);
+		Ref <const Dep> top_top= dep_target->top;
+		Ref <Dep> no_top= Dep::clone(dep_target);
 		no_top->top= nullptr; 
-		shared_ptr <Dep> top= make_shared <Dynamic_Dep> (no_top); 
+		Ref <Dep> top= make_dep <Dynamic_Dep> (no_top); 
 		top->top= top_top;
 		
 		for (auto &j:  deps) {
 			if (j) {
-				shared_ptr <Dep> j_new= Dep::clone(j);
+				Ref <Dep> j_new= Dep::clone(j);
 				j_new->top= top; 
 				deps_new.push_back(j_new); 
 			}
@@ -1162,16 +1410,34 @@ void Execution::read_dynamic(shared_ptr <const Plain_Dep> dep_target,
 
 bool Execution::find_cycle(Execution *parent, 
 			   Execution *child,
-			   shared_ptr <const Dep> dep_link)
+			   Ref <const Dep> dep_link)
 {
+	/* A file without a rule has no dependencies */ 
+	if (child->is_leaf())
+		return false;
+
+	Topological_Order::Node node_parent= 
+		parent->get_node(Topological_Order::NODE_NONE); 
+	Topological_Order::Node node_child= child->get_node(node_parent); 
+	if (! Topological_Order::insert(node_parent, node_child))
+		return false;
+
 	vector <Execution *> path;
 	path.push_back(parent); 
-	return find_cycle(path, child, dep_link); 
+	unordered_set <const Execution *> visited;
+	if (find_cycle(path, visited, child, dep_link))
+		return true;
+
+	/* Two executions have the same rule, but they are not on a
+	 * cycle */
+	Topological_Order::insert_cyclic(node_parent, node_child); 
+	return false;
 }
 
 bool Execution::find_cycle(vector <Execution *> &path,
+			   unordered_set <const Execution *> &visited,
 			   Execution *child,
-			   shared_ptr <const Dep> dep_link)
+			   Ref <const Dep> dep_link)
 {
 	if (same_rule(path.back(), child)) {
 		cycle_print(path, dep_link); 
@@ -1181,18 +1447,56 @@ bool Execution::find_cycle(vector <Execution *> &path,
 	for (auto &i:  path.back()->parents) {
 		Execution *next= i.first; 
 		assert(next != nullptr);
+		if (visited.count(next))
+			continue;
 		path.push_back(next); 
-		bool found= find_cycle(path, child, dep_link);
+		bool found= find_cycle(path, visited, child, dep_link);
 		if (found)
 			return true;
 		path.pop_back(); 
+		visited.insert(next); 
 	}
 	
 	return false; 
 }
 
+void Execution::link_node(Execution *parent)
+{
+	if (is_leaf())
+		return;
+
+	Topological_Order::Node node_parent= 
+		parent->get_node(Topological_Order::NODE_NONE); 
+	Topological_Order::Node node_this= get_node(node_parent); 
+	if (Topological_Order::insert(node_parent, node_this))
+		Topological_Order::insert_cyclic(node_parent, node_this); 
+}
+
+Topological_Order::Node Execution::get_node(Topological_Order::Node after)
+{
+	if (node != Topological_Order::NODE_NONE)
+		return node;
+
+	assert(! is_leaf()); 
+	if (param_rule == nullptr) {
+		node= Topological_Order::add_node(after); 
+	} else if (get_depth() < 2) {
+		unsigned &node_rule= param_rule->nodes[get_depth()]; 
+		if (node_rule == Topological_Order::NODE_NONE)
+			node_rule= Topological_Order::add_node(after); 
+		node= node_rule; 
+	} else {
+		auto ins= nodes_by_rule.emplace
+			(make_pair(param_rule.get(), get_depth()), 0); 
+		if (ins.second)
+			ins.first->second= Topological_Order::add_node(after); 
+		node= ins.first->second; 
+	}
+	return node;
+}
+
 void Execution::cycle_print(const vector <Execution *> &path,
-			    shared_ptr <const Dep> dep)
+			    Ref <const Dep> dep)
 /*
  * Given PATH = [a, b, c, d, ..., x], we print:
  *
@@ -1220,7 +1524,7 @@ void Execution::cycle_print(const vector <Execution *> &path,
 		
 	for (ssize_t i= path.size() - 1;  i >= 0;  --i) {
 
-		shared_ptr <const Dep> d= i == 0 
+		Ref <const Dep> d= i == 0 
 			? dep
 			: path[i - 1]->parents.at(const_cast <Execution *> (path[i])); 
 
@@ -1261,6 +1565,7 @@ void Execution::cycle_print(const vector <Execution *> &path,
 	 * path[end] (as a child).  */
 	path.back()->parents.erase(path.at(0)); 
 	path.at(0)->children.erase(path.back()); 
+	path.at(0)->children_ready.erase(path.back()); 
 
 	path.back()->print_traces();
 
@@ -1305,7 +1610,7 @@ void Execution::print_traces(string text) const
 	}
 
 	const Execution *execution= this->parents.begin()->first;
-	shared_ptr <const Dep> depp= this->parents.begin()->second; 
+	Ref <const Dep> depp= this->parents.begin()->second; 
 
 	string text_parent= depp->format_word(); 
 
@@ -1326,7 +1631,7 @@ void Execution::print_traces(string text) const
 		}
 
 		/* Increment */
-		shared_ptr <const Dep> depp_old= depp; 
+		Ref <const Dep> depp_old= depp; 
 		if (! depp->top) {
 			/* Assign DEPP first, because we change EXECUTION */
 			depp= execution->parents.begin()->second; 
@@ -1364,34 +1669,53 @@ void Execution::print_traces(string text) const
 Proceed Execution::execute_children()
 {
 	/* Since disconnect() may change execution->children, we must first
-	 * copy it over locally, and then iterate through it */ 
-
-	vector <Execution *> executions_children_vector
-		(children.begin(), children.end()); 
+	 * copy it over, and then iterate through it.  The copy is
+	 * pushed onto EXECUTIONS_CHILDREN, which is shared by the
+	 * nested calls, and therefore allocates nothing once it has
+	 * grown.  Each call only takes the elements it has pushed
+	 * itself, i.e., those from BEGIN onwards.  Sleeping children
+	 * are skipped, as executing them would not change
+	 * anything.  */ 
+
+	const size_t begin= executions_children.size(); 
+	executions_children.insert(executions_children.end(),
+				   children_ready.begin(), children_ready.end()); 
+
+	if (order == Order::CRITICAL) {
+		/* Children are taken from the end, so the longest
+		 * critical path must be last.  The sort is stable so that
+		 * children with equal priorities, in particular those
+		 * without recorded durations, keep their DFS order.  */ 
+		stable_sort(executions_children.begin() + begin,
+			    executions_children.end(),
+			    [](const Execution *a, const Execution *b) {
+				    return a->priority < b->priority; 
+			    }); 
+	}
 
 	Proceed proceed_all= 0;
 
-	while (! executions_children_vector.empty()) {
+	while (executions_children.size() > begin) {
 
 		assert(jobs >= 0);
 
 		if (order_vec) {
 			/* Exchange a random position with last position */ 
-			size_t p_last= executions_children_vector.size() - 1;
-			size_t p_random= random_number(executions_children_vector.size());
+			size_t p_last= executions_children.size() - 1;
+			size_t p_random= begin + random_number
+				(executions_children.size() - begin);
 			if (p_last != p_random) {
-				swap(executions_children_vector[p_last],
-				     executions_children_vector[p_random]); 
+				swap(executions_children[p_last],
+				     executions_children[p_random]); 
 			}
 		}
 
-		Execution *child= executions_children_vector.at
-			(executions_children_vector.size() - 1);
-		executions_children_vector.resize(executions_children_vector.size() - 1); 
+		Execution *child= executions_children.back(); 
+		executions_children.pop_back(); 
 		
 		assert(child != nullptr);
 
-		shared_ptr <const Dep> dep_child= child->parents.at(this);
+		Ref <const Dep> dep_child= child->parents.at(this);
 
 		Proceed proceed_child= child->execute(dep_child);
 		assert(proceed_child); 
@@ -1410,9 +1734,14 @@ Proceed Execution::execute_children()
 			/* If the child execution is not finished, it
 			 * must have returned either the P_WAIT or
 			 * P_PENDING bit.  */
+			child->update_sleeping(proceed_child, this); 
 		}
 	}
 
+	/* Sleeping children are waiting for running jobs */ 
+	if (children_ready.size() < children.size())
+		proceed_all |= P_WAIT; 
+
 	if (error) {
 		assert(option_keep_going); 
 		/* Otherwise, Stu would have aborted */ 
@@ -1430,12 +1759,50 @@ Proceed Execution::execute_children()
 	return proceed_all; 
 }
 
-void Execution::push(shared_ptr <const Dep> dep)
+void Execution::update_sleeping(Proceed proceed, Execution *parent)
+{
+	if (proceed == P_WAIT && children_ready.empty()) {
+		if (bits & B_SLEEPING) {
+			/* THIS is already sleeping, but PARENT may have
+			 * been newly connected to it.  The other parents
+			 * are already up to date; not iterating over
+			 * them avoids quadratic behavior when many
+			 * parents are connected to a sleeping child.  */
+			parent->children_ready.erase(this); 
+		} else {
+			fall_asleep(); 
+		}
+	} else {
+		wake_up(); 
+	}
+}
+
+void Execution::fall_asleep()
+{
+	assert(children_ready.empty()); 
+	bits |= B_SLEEPING;
+	for (auto &i:  parents) {
+		i.first->children_ready.erase(this); 
+	}
+}
+
+void Execution::wake_up()
+{
+	if (! (bits & B_SLEEPING))
+		return;
+	bits &= ~B_SLEEPING; 
+	for (auto &i:  parents) {
+		i.first->children_ready.insert(this); 
+		i.first->wake_up(); 
+	}
+}
+
+void Execution::push(Ref <const Dep> dep)
 {
 	assert(dep); 
 	dep->check();
 	
-	vector <shared_ptr <const Dep> > deps;
+	vector <Ref <const Dep> > deps;
 	int e= 0;
 	Dep::normalize(dep, deps, e); 
 	if (e) {
@@ -1453,22 +1820,21 @@ void Execution::push(shared_ptr <const Dep> dep)
 	}
 }
 
-Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
+Proceed Execution::execute_base_A(Ref <const Dep> dep_this)
 {
 	Debug debug(this);
 
 	assert(jobs >= 0); 
 	assert(dep_this); 
 
-	shared_ptr <Dep> dep_this2= Dep::clone(dep_this); 
 	Proceed proceed= 0; 
 
-	if (finished(dep_this2->flags)) {
+	if (finished(dep_this->flags)) {
 		Debug::print(this, "finished"); 
 		return proceed |= P_FINISHED; 
 	}
 
-	if (optional_finished(dep_this2)) {
+	if (optional_finished(dep_this)) {
 		Debug::print(this, "finished"); 
 		return proceed |= P_FINISHED; 
 	}
@@ -1482,15 +1848,15 @@ Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
 		proceed |= proceed_2;
 		if (proceed & P_WAIT) {
 			if (jobs == 0) 
-				return proceed; 
-		} else if (finished(dep_this2->flags) && ! option_keep_going) {
+				return proceed |= P_SLOT; 
+		} else if (finished(dep_this->flags) && ! option_keep_going) {
 			Debug::print(this, "finished"); 
 			return proceed |= P_FINISHED;
 		}
 	} 
 
 	/* Is this a trivial run?  Then skip the dependency. */
-	if (dep_this2->flags & F_TRIVIAL) {
+	if (dep_this->flags & F_TRIVIAL) {
 		return proceed |= P_ABORT | P_FINISHED; 
 	}
 
@@ -1501,22 +1867,22 @@ Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
 	 */ 
 
 	if (jobs == 0) {
-		return proceed |= P_WAIT;
+		return proceed |= P_WAIT | P_SLOT;
 	}
 
 	while (! buffer_A.empty()) {
-		shared_ptr <const Dep> dep_child= buffer_A.next(); 
+		Ref <const Dep> dep_child= buffer_A.next(); 
 		if ((dep_child->flags & (F_RESULT_NOTIFY | F_TRIVIAL)) == F_TRIVIAL) {
-			shared_ptr <Dep> dep_child_2= 
+			Ref <Dep> dep_child_2= 
 				Dep::clone(dep_child);
 			dep_child_2->flags &= ~F_TRIVIAL; 
 			dep_child_2->get_place_flag(I_TRIVIAL)= Place::place_empty; 
 			buffer_B.push(dep_child_2); 
 		}
-		Proceed proceed_2= connect(dep_this2, dep_child);
+		Proceed proceed_2= connect(dep_this, dep_child);
 		proceed |= proceed_2;
 		if (jobs == 0) {
-			return proceed |= P_WAIT; 
+			return proceed |= P_WAIT | P_SLOT; 
 		}
 	} 
 	assert(buffer_A.empty()); 
@@ -1546,15 +1912,16 @@ Proceed Execution::execute_base_A(shared_ptr <const Dep> dep_this)
 	return proceed |= P_FINISHED; 
 }
 
-Proceed Execution::connect(shared_ptr <const Dep> dep_this,
-			   shared_ptr <const Dep> dep_child)
+Proceed Execution::connect(Ref <const Dep> dep_this,
+			   Ref <const Dep> dep_child)
 {
-	Debug::print(this, fmt("connect %s",  dep_child->format_src())); 
+	if (option_debug)
+		Debug::print(this, fmt("connect %s",  dep_child->format_src())); 
 
 	assert(dep_child->is_normalized()); 
 	assert(! to <Root_Dep> (dep_child)); 
 
-	shared_ptr <const Plain_Dep> plain_dep_this=
+	Ref <const Plain_Dep> plain_dep_this=
 		to <Plain_Dep> (dep_this);
 
 	/*
@@ -1588,7 +1955,7 @@ Proceed Execution::connect(shared_ptr <const Dep> dep_this,
 
 	/* '-o' does not mix with '$[' */
 	if (dep_child->flags & F_VARIABLE && dep_child->flags & F_OPTIONAL) {
-		shared_ptr <const Plain_Dep> plain_dep_child=
+		Ref <const Plain_Dep> plain_dep_child=
 			to <Plain_Dep> (dep_child); 
 		assert(plain_dep_child); 
 		assert(!(dep_child->flags & F_TARGET_TRANSIENT)); 
@@ -1617,6 +1984,9 @@ Proceed Execution::connect(shared_ptr <const Dep> dep_this,
 	}
 
 	children.insert(child);
+	children_ready.insert(child); 
+	if (order == Order::CRITICAL)
+		update_priority(child->priority); 
 
 	if (dep_child->flags & F_RESULT_NOTIFY) {
 		for (const auto &dependency:  child->result) {
@@ -1626,8 +1996,10 @@ Proceed Execution::connect(shared_ptr <const Dep> dep_this,
 
 	Proceed proceed_child= child->execute(dep_child);
 	assert(proceed_child); 
-	if (proceed_child & (P_WAIT | P_PENDING))
+	if (proceed_child & (P_WAIT | P_PENDING)) {
+		child->update_sleeping(proceed_child, this); 
 		return proceed_child; 
+	}
 			
 	if (child->finished(dep_child->flags)) {
 		disconnect(child, dep_child);
@@ -1645,9 +2017,10 @@ void Execution::raise(int error_)
 }
 
 void Execution::disconnect(Execution *const child,
-			   shared_ptr <const Dep> dep_child)
+			   Ref <const Dep> dep_child)
 {
-	Debug::print(this, fmt("disconnect %s", dep_child->format_src())); 
+	if (option_debug)
+		Debug::print(this, fmt("disconnect %s", dep_child->format_src())); 
 
 	assert(child != nullptr); 
 	assert(child != this); 
@@ -1658,13 +2031,13 @@ void Execution::disconnect(Execution *const child,
 	if (dep_child->flags & F_RESULT_NOTIFY
 	    && dynamic_cast <File_Execution *> (child)
 	    ) {
-		shared_ptr <Dep> d= Dep::clone(dep_child);
+		Ref <Dep> d= Dep::clone(dep_child);
 		d->flags &= ~F_RESULT_NOTIFY; 
 		notify_result(d, child, F_RESULT_NOTIFY, dep_child); 
 	}
 
 	if (dep_child->flags & F_RESULT_COPY && dynamic_cast <File_Execution *> (child)) {
-		shared_ptr <Dep> d= Dep::clone(dep_child);
+		Ref <Dep> d= Dep::clone(dep_child);
 		d->flags &= ~F_RESULT_COPY; 
 		notify_result(d, child, F_RESULT_COPY, dep_child); 
 	}
@@ -1680,8 +2053,31 @@ void Execution::disconnect(Execution *const child,
 				timestamp= child->timestamp; 
 			}
 		}
+
+		if (State::enabled() || Cache::enabled()) {
+			File_Execution *file_child= dynamic_cast <File_Execution *> (child); 
+			if (file_child != nullptr) {
+				bool has_file= false;
+				for (const Target &target:  file_child->targets) {
+					if (! target.is_file())
+						continue;
+					has_file= true;
+					if (! (file_child->bits & B_MISSING))
+						inputs.insert(target.get_name_nondynamic()); 
+				}
+				if (! has_file) 
+					bits |= B_UNHASHED; 
+			} else {
+				inputs.insert(child->inputs.begin(), child->inputs.end());
+				bits |= child->bits & B_UNHASHED; 
+			}
+		}
 	}
 
+	/* Propagate the length of the critical path, regardless of
+	 * flags */
+	critical= max(critical, child->critical + child->get_duration()); 
+
 	/* Propagate variables */
 	if ((dep_child->flags & F_VARIABLE)) { 
 		assert(dynamic_cast <File_Execution *> (child)); 
@@ -1714,23 +2110,79 @@ void Execution::disconnect(Execution *const child,
 	assert(children.count(child) == 1); 
 	assert(child->parents.count(this) == 1);
 	children.erase(child);
+	children_ready.erase(child); 
 	child->parents.erase(this);
 
-	/* Delete the Execution object */
+	/* Delete the Execution object, or free what is not needed
+	 * anymore */
 	if (child->want_delete())
 		delete child; 
+	else if (child->finished() && ! (child->bits & B_COMPACTED))
+		child->compact(); 
+}
+
+void Execution::compact()
+{
+	assert(finished()); 
+	assert(children.empty()); 
+	bits |= B_COMPACTED; 
+	++count_compacted; 
+	/* BUFFER_B may still contain trivial dependencies that were
+	 * not needed */ 
+	size_compacted += buffer_A.release() + buffer_B.release(); 
 }
 
-Proceed Execution::execute_base_B(shared_ptr <const Dep> dep_link)
+size_t Execution::get_size(const string &s)
+{
+	/* Short strings are stored inside the object */
+	return s.capacity() < sizeof(string) ? 0 : s.capacity() + 1; 
+}
+
+size_t Execution::get_size(const set <string> &s)
+{
+	/* Each node has three pointers and the color in addition to the
+	 * element */
+	size_t ret= 0;
+	for (const string &i:  s)
+		ret += 4 * sizeof(void *) + sizeof(string) + get_size(i); 
+	return ret; 
+}
+
+size_t Execution::get_size(const map <string, string> &m)
+{
+	size_t ret= 0;
+	for (const auto &i:  m)
+		ret += 4 * sizeof(void *) + 2 * sizeof(string)
+			+ get_size(i.first) + get_size(i.second); 
+	return ret; 
+}
+
+void Execution::print_statistics()
+{
+	printf("STATISTICS  executions compacted = %zu (about %zu kB freed)\n", 
+	       count_compacted, (size_compacted + 512) / 1024); 
+}
+
+void Execution::update_priority(uint64_t priority_child)
+{
+	if (priority_child <= priority)
+		return;
+	priority= priority_child;
+	for (auto &i:  parents) {
+		i.first->update_priority(priority); 
+	}
+}
+
+Proceed Execution::execute_base_B(Ref <const Dep> dep_link)
 {
 	Proceed proceed= 0;
 	while (! buffer_B.empty()) {
-		shared_ptr <const Dep> dep_child= buffer_B.next(); 
+		Ref <const Dep> dep_child= buffer_B.next(); 
 		Proceed proceed_2= connect(dep_link, dep_child);
 		proceed |= proceed_2; 
 		assert(jobs >= 0);
 		if (jobs == 0) {
-			return proceed |= P_WAIT; 
+			return proceed |= P_WAIT | P_SLOT; 
 		}
 	} 
 	assert(buffer_B.empty()); 
@@ -1738,14 +2190,14 @@ Proceed Execution::execute_base_B(shared_ptr <const Dep> dep_link)
 	return proceed; 
 }
 
-Execution *Execution::get_execution(shared_ptr <const Dep> dep)
+Execution *Execution::get_execution(Ref <const Dep> dep)
 {
 	/*
 	 * Non-cached executions
 	 */
 
 	/* Concatenations */
-	if (shared_ptr <const Concat_Dep> concat_dep= to <const Concat_Dep> (dep)) {
+	if (Ref <const Concat_Dep> concat_dep= to <const Concat_Dep> (dep)) {
 		int error_additional= 0; 
 		Concat_Execution *execution= new Concat_Execution(concat_dep, this, error_additional); 
 		assert(execution); 
@@ -1777,23 +2229,18 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 	 * Cached executions
 	 */
 
-	const Target target= dep->get_target(); 
-
 	/* Set to the returned Execution object when one is found or created */    
-	Execution *execution= nullptr; 
-
-	const Target target_for_cache= get_target_for_cache(target); 
-	auto it= executions_by_target.find(target_for_cache);
+	Execution *execution= get_execution_by_target
+		(get_target_id_for_cache(dep.get())); 
 
-	if (it != executions_by_target.end()) {
+	if (execution != nullptr) {
 		/* An Execution object already exists for the target */ 
-		execution= it->second; 
 		if (execution->parents.count(this)) {
 			/* THIS and CHILD are already connected -- add the
 			 * necessary flags */ 
 			Flags flags= dep->flags; 
 			if (flags & ~execution->parents.at(this)->flags) {
-				shared_ptr <Dep> dep_new= Dep::clone(execution->parents.at(this));
+				Ref <Dep> dep_new= Dep::clone(execution->parents.at(this));
 				dep_new->flags |= flags;
 				dep= dep_new;
 				/* No need to check for cycles here,
@@ -1816,6 +2263,7 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 
 	/* Create a new Execution object */ 
 
+	const Target target= dep->get_target(); 
 	int error_additional= 0; /* Passed to the execution */
 	
 	if (! target.is_dynamic()) {
@@ -1873,7 +2321,7 @@ Execution *Execution::get_execution(shared_ptr <const Dep> dep)
 				 error_additional);
 		}
 	} else {
-		shared_ptr <const Dynamic_Dep> dynamic_dep= to <Dynamic_Dep> (dep); 
+		Ref <const Dynamic_Dep> dynamic_dep= to <Dynamic_Dep> (dep); 
 		execution= new Dynamic_Execution(dynamic_dep, 
 						 this,
 						 error_additional); 
@@ -1906,9 +2354,10 @@ void Execution::copy_result(Execution *parent, Execution *child)
 	}
 }
 
-void Execution::push_result(shared_ptr <const Dep> dd)
+void Execution::push_result(Ref <const Dep> dd)
 {
-	Debug::print(this, fmt("push_result %s", dd->format_src())); 
+	if (option_debug)
+		Debug::print(this, fmt("push_result %s", dd->format_src())); 
 
 	assert(! dynamic_cast <File_Execution *> (this)); 
 	assert(! (dd->flags & F_RESULT_NOTIFY)); 
@@ -1926,25 +2375,31 @@ void Execution::push_result(shared_ptr <const Dep> dd)
 	}
 }
 
-Target Execution::get_target_for_cache(Target target)
+Target_Id Execution::get_target_id_for_cache(const Dep *dep)
 {
-	if (target.is_file()) {
-		/* For file targets, we don't use flags for hashing. 
-		 * Zero is the word for file targets.  */
-		target.get_front_word_nondynamic()= (word_t)0; 
-	}
-
-	return target; 
+	if (const Plain_Dep *plain_dep= to <Plain_Dep> (dep)) {
+		/* Avoid building the Target.  For file targets, we
+		 * don't use flags for hashing.  Zero is the word for
+		 * file targets.  */
+		Flags flags= (plain_dep->flags | plain_dep->place_param_target.flags)
+			& F_TARGET_BYTE; 
+		if (! (flags & F_TARGET_TRANSIENT))
+			flags= 0; 
+		return Target_Table::intern
+			(flags, plain_dep->place_param_target.place_name.unparametrized()); 
+	}
+
+	return Target_Table::intern(dep->get_target()); 
 }
 
-shared_ptr <const Dep> Execution::append_top(shared_ptr <const Dep> dep, 
-					     shared_ptr <const Dep> top)
+Ref <const Dep> Execution::append_top(Ref <const Dep> dep, 
+					     Ref <const Dep> top)
 {
 	assert(dep);
 	assert(top); 
 	assert(dep != top); 
 
-	shared_ptr <Dep> ret= Dep::clone(dep);
+	Ref <Dep> ret= Dep::clone(dep);
 
 	if (dep->top) {
 		ret->top= append_top(dep->top, top); 
@@ -1955,8 +2410,8 @@ shared_ptr <const Dep> Execution::append_top(shared_ptr <const Dep> dep,
 	return ret; 
 }
 
-shared_ptr <const Dep> Execution::set_top(shared_ptr <const Dep> dep,
-					  shared_ptr <const Dep> top)
+Ref <const Dep> Execution::set_top(Ref <const Dep> dep,
+					  Ref <const Dep> top)
 {
 	assert(dep); 
 	assert(dep != top); 
@@ -1964,7 +2419,7 @@ shared_ptr <const Dep> Execution::set_top(shared_ptr <const Dep> dep,
 	if (dep->top == nullptr && top == nullptr)
 		return dep;
 
-	shared_ptr <Dep> ret= Dep::clone(dep);
+	Ref <Dep> ret= Dep::clone(dep);
 	ret->top= top;
 	return ret; 
 }
@@ -1987,58 +2442,196 @@ File_Execution::~File_Execution()
 	}
 }
 
+void File_Execution::compact()
+/* The job is not running anymore, and therefore FILENAMES and
+ * TIMESTAMPS_OLD are not accessed by signal handlers */
+{
+	if (timestamps_old) {
+		size_compacted += targets.size() * sizeof(timestamps_old[0]); 
+		free(timestamps_old);
+		timestamps_old= nullptr; 
+	}
+	if (filenames) {
+		size_compacted += targets.size() * sizeof(filenames[0]); 
+		for (size_t i= 0;  i < targets.size();  ++i) {
+			if (filenames[i]) {
+				size_compacted += strlen(filenames[i]) + 1; 
+				free(filenames[i]); 
+			}
+		}
+		free(filenames); 
+		filenames= nullptr; 
+	}
+
+	/* The rule is only owned by THIS when it was instantiated from
+	 * a parametrized rule */ 
+	if (rule != param_rule) {
+		if (rule.use_count() == 1)
+			size_compacted += sizeof(Rule); 
+		rule.reset(); 
+	}
+
+	size_compacted += get_size(mapping_parameter) + get_size(mapping_variable)
+		+ get_size(inputs) + get_size(cache_key); 
+	mapping_parameter.clear();
+	mapping_variable.clear();
+	inputs.clear(); 
+	string().swap(cache_key); 
+
+	Execution::compact(); 
+}
+
 void File_Execution::wait() 
-/* We wait for a single job to finish, and then return so that the next
- * job can be started.  It would also be possible to process as many
- * finished jobs as possible, and then return, but the current
- * implementation prefers to first start the next job before waiting for
- * the next finished job.  */
+/* We wait for at least one job to finish, and then process all jobs
+ * that have finished in the meantime, so that all their job slots
+ * are available when the next jobs are started.  While jobs are held
+ * back because of pressure (-L), we return after a timeout even when no
+ * job has finished.  */
 {
 	Debug::print(nullptr, "wait...");
 
 	assert(File_Execution::executions_by_pid_size); 
 
-	int status;
-	const pid_t pid= Job::wait(&status); 
-
-	Debug::print(nullptr, frmt("pid = %ld", (long) pid)); 
+	vector <pid_t> pids(executions_by_pid_size);
+	vector <int> statuses(executions_by_pid_size); 
+	const size_t count= Job::wait(pids.data(), statuses.data(), executions_by_pid_size,
+				      Pressure::enabled() ? Pressure::get_timeout() : -1); 
+	assert(count <= executions_by_pid_size); 
+	if (count == 0) {
+		/* Timeout while jobs are held back */ 
+		return; 
+	}
 
 	timestamp_last= Timestamp::now(); 
 
-	size_t mi= 0, ma= executions_by_pid_size - 1;
-	/* Both are inclusive */
-	assert(mi <= ma); 
-	while (mi < ma) {
-		size_t ne= mi + (ma - mi + 1) / 2;
-		assert(ne <= ma); 
-		if (executions_by_pid_key[ne] == pid) {
-			mi= ma= ne; 
-			break;
-		}
-		if (executions_by_pid_key[ne] < pid) {
-			mi= ne + 1;
-		} else {
-			ma= ne - 1;
+	for (size_t i= 0;  i < count;  ++i) {
+		const pid_t pid= pids[i];
+
+		Debug::print(nullptr, frmt("pid = %ld", (long) pid)); 
+
+		const size_t index= find_pid(pid); 
+		if (index == executions_by_pid_capacity) {
+			/* No File_Execution is registered for the PID
+			 * that just finished.  Should not happen, but
+			 * since the PID value came from outside this
+			 * process, we better handle this case
+			 * gracefully, i.e., do nothing.  */
+			print_warning(Place(), 
+				      frmt("The function waitpid(2) returned the invalid process ID %jd", 
+					   (intmax_t)pid)); 
+			continue; 
+		}
+		assert(executions_by_pid_key[index] == pid); 
+	
+		File_Execution *const execution= executions_by_pid_value[index]; 
+		try {
+			execution->waited(pid, index, statuses[i]); 
+		} catch (int) {
+			/* The remaining processes have already been
+			 * waited for, and thus their PIDs may be
+			 * reused.  Make sure they are not killed by
+			 * job_terminate_all().  */ 
+			Job::Signal_Blocker sb;
+			for (size_t j= i + 1;  j < count;  ++j) {
+				const size_t index_j= find_pid(pids[j]);
+				if (index_j != executions_by_pid_capacity)
+					erase_pid(index_j); 
+			}
+			throw; 
 		}
+		execution->wake_up(); 
+		++jobs; 
+		if (execution->rule->pool != nullptr)
+			++execution->rule->pool->free; 
+		if (Jobserver::enabled())
+			Jobserver::release(); 
 	}
-	if (mi > ma || mi == SIZE_MAX) {
-		/* No File_Execution is registered for the PID that
-		 * just finished.  Should not happen, but since the PID
-		 * value came from outside this process, we better
-		 * handle this case gracefully, i.e., do nothing.  */
-		print_warning(Place(), 
-			      frmt("The function waitpid(2) returned the invalid process ID %jd", 
-				   (intmax_t)pid)); 
-		return; 
+}
+
+size_t File_Execution::find_pid(pid_t pid)
+{
+	assert(pid > 0); 
+	if (executions_by_pid_capacity == 0)
+		return 0; 
+	const size_t mask= executions_by_pid_capacity - 1;
+	for (size_t i= (size_t) pid & mask;  ;  i= (i + 1) & mask) {
+		if (executions_by_pid_key[i] == pid)
+			return i;
+		if (executions_by_pid_key[i] == 0)
+			return executions_by_pid_capacity; 
 	}
-	assert(mi == ma); 
-	const size_t index= mi; 
-	assert(index < executions_by_pid_size); 
-	assert(executions_by_pid_key[index] == pid); 
-	
-	File_Execution *const execution= executions_by_pid_value[index]; 
-	execution->waited(pid, index, status); 
-	++jobs; 
+}
+
+size_t File_Execution::insert_pid(pid_t pid, File_Execution *execution)
+{
+	assert(pid > 0); 
+	assert(executions_by_pid_size < executions_by_pid_capacity); 
+	const size_t mask= executions_by_pid_capacity - 1;
+	size_t i= (size_t) pid & mask; 
+	while (executions_by_pid_key[i] != 0) {
+		assert(executions_by_pid_key[i] != pid); 
+		i= (i + 1) & mask;
+	}
+	executions_by_pid_key[i]= pid;
+	executions_by_pid_value[i]= execution;
+	++ executions_by_pid_size; 
+	return i; 
+}
+
+void File_Execution::erase_pid(size_t index)
+/* Backward shift deletion:  move following entries into the hole, as
+ * long as this does not move them before their hash position.  */
+{
+	assert(index < executions_by_pid_capacity); 
+	assert(executions_by_pid_key[index] != 0); 
+	assert(executions_by_pid_size > 0); 
+	const size_t mask= executions_by_pid_capacity - 1;
+	size_t hole= index;
+	for (size_t i= (index + 1) & mask;  executions_by_pid_key[i] != 0;  i= (i + 1) & mask) {
+		const size_t home= (size_t) executions_by_pid_key[i] & mask; 
+		if (((i - home) & mask) >= ((i - hole) & mask)) {
+			executions_by_pid_key[hole]= executions_by_pid_key[i];
+			executions_by_pid_value[hole]= executions_by_pid_value[i];
+			hole= i; 
+		}
+	}
+	executions_by_pid_key[hole]= 0;
+	executions_by_pid_value[hole]= nullptr; 
+	-- executions_by_pid_size; 
+}
+
+uint64_t File_Execution::get_time()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		print_error_system("clock_gettime(CLOCK_MONOTONIC, ...)");
+		exit(ERROR_FATAL); 
+	}
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000; 
+}
+
+void File_Execution::restored()
+{
+	bits |=  B_EXISTING; 
+	bits &= ~B_MISSING;
+
+	for (const Target &target:  targets) {
+		struct stat buf;
+		if (0 > stat(target.get_name_c_str_nondynamic(), &buf)) {
+			/* The targets were just created; if a file is
+			 * missing now, it will be noticed by the
+			 * dependents */
+			continue; 
+		}
+		Timestamp timestamp_file(&buf);
+		if (! timestamp.defined() || timestamp < timestamp_file)
+			timestamp= timestamp_file; 
+	}
+
+	if (use_state())
+		State::record(targets, inputs); 
+	if (State::enabled())
+		State::record_signature(targets.front().get_name_nondynamic(), signature); 
 }
 
 void File_Execution::waited(pid_t pid, size_t index, int status) 
@@ -2053,15 +2646,8 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 	{
 		Job::Signal_Blocker sb;
 		/* Remove entry from EXECUTIONS_BY_PID_* */
-		assert(executions_by_pid_size > 0); 
-		assert(executions_by_pid_size >= index + 1); 
-		memmove(executions_by_pid_key + index,
-			executions_by_pid_key + index + 1,
-			sizeof(*executions_by_pid_key) * (executions_by_pid_size - index - 1)); 
-		memmove(executions_by_pid_value + index,
-			executions_by_pid_value + index + 1,
-			sizeof(*executions_by_pid_value) * (executions_by_pid_size - index - 1)); 
-		-- executions_by_pid_size; 
+		assert(executions_by_pid_value[index] == this); 
+		erase_pid(index); 
 	}
 
 	/* The file(s) may have been built, so forget that it was known
@@ -2074,6 +2660,7 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 		bits |=  B_EXISTING; 
 		bits &= ~B_MISSING;
 		/* Subsequently set to B_MISSING if at least one target file is missing */
+		const int error_old= error; 
 
 		/* For file targets, check that the file was built */ 
 		for (size_t i= 0;  i < targets.size();  ++i) {
@@ -2136,6 +2723,18 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 				raise(ERROR_BUILD);
 			}
 		}
+
+		if (use_state() && ! (bits & B_MISSING))
+			State::record(targets, inputs); 
+		if (use_signature() && State::enabled() && ! (bits & B_MISSING))
+			State::record_signature(targets.front().get_name_nondynamic(), signature); 
+		if (use_cache() && ! cache_key.empty() && ! (bits & B_MISSING) && error == error_old) 
+			Cache::store(cache_key, targets); 
+
+		duration= get_time() - time_started; 
+		if (State::enabled())
+			State::record_duration(targets.front().get_text(), duration, critical + duration); 
+
 		/* In parallel mode, print "done" message */
 		if (option_parallel && !option_silent) {
 			string text= targets[0].format_src();
@@ -2184,7 +2783,7 @@ void File_Execution::waited(pid_t pid, size_t index, int status)
 	}
 }
 
-File_Execution::File_Execution(shared_ptr <const Dep> dep,
+File_Execution::File_Execution(Ref <const Dep> dep,
 			       Execution *parent, 
 			       shared_ptr <const Rule> rule_,
 			       shared_ptr <const Rule> param_rule_,
@@ -2194,7 +2793,10 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 	   timestamps_old(nullptr),
 	   filenames(nullptr),
 	   rule(rule_),
-	   flags_finished(0)
+	   flags_finished(0),
+	   signature(0),
+	   duration(0),
+	   time_started(0)
 {
 	assert((param_rule_ == nullptr) == (rule_ == nullptr)); 
 
@@ -2205,7 +2807,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 	Target target_no_flags= target_;
 	target_no_flags.get_front_word_nondynamic() &= F_TARGET_TRANSIENT; 
 	targets.push_back(target_no_flags); 
-	executions_by_target[target_no_flags]= this; 
+	get_execution_by_target(Target_Table::intern(target_no_flags))= this; 
 
 	parents[parent]= dep; 
 	if (error_additional) {
@@ -2229,7 +2831,13 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 	/* Fill EXECUTIONS_BY_TARGET with all targets from the rule, not
 	 * just the one given in the dependency.  */
 	for (const Target &target:  targets) {
-		executions_by_target[target]= this; 
+		get_execution_by_target(Target_Table::intern(target))= this; 
+	}
+
+	if (rule != nullptr) {
+		duration= State::get_duration(targets.front().get_text()); 
+		if (order == Order::CRITICAL)
+			priority= State::get_critical(targets.front().get_text()); 
 	}
 
 	if (rule != nullptr) {
@@ -2291,7 +2899,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 
 		Place place_target;
 		for (auto &i:  rule->place_param_targets) {
-			if (i->place_name.unparametrized() == target_.get_name_nondynamic()) {
+			if (i->place_name.unparametrized() == target_.get_name_c_str_nondynamic()) {
 				place_target= i->place;
 				break;
 			}
@@ -2309,6 +2917,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 		parent->get_parents().begin()->first->print_traces();
 		parent->raise(ERROR_LOGICAL);
 		error_additional |= ERROR_LOGICAL;
+		link_node(parent); 
 		return;
 	}
 
@@ -2318,7 +2927,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 
 		Place place_target;
 		for (auto &i:  rule->place_param_targets) {
-			if (i->place_name.unparametrized() == target_.get_name_nondynamic()) {
+			if (i->place_name.unparametrized() == target_.get_name_c_str_nondynamic()) {
 				place_target= i->place;
 				break;
 			}
@@ -2338,6 +2947,7 @@ File_Execution::File_Execution(shared_ptr <const Dep> dep,
 		print_traces();
 		parent->raise(ERROR_LOGICAL);
 		error_additional |= ERROR_LOGICAL;
+		link_node(parent); 
 		return;
 	}
 
@@ -2373,16 +2983,20 @@ void job_terminate_all()
 	 * into a single loop.  */
 
 	for (size_t i= 0;
-	     i < File_Execution::executions_by_pid_size;
+	     i < File_Execution::executions_by_pid_capacity;
 	     ++i) {
 		const pid_t pid= File_Execution::executions_by_pid_key[i];
+		if (pid == 0)
+			continue; 
 
 		Job::kill(pid); 
 	}
 
 	size_t count_terminated= 0;
 
-	for (size_t i= 0;  i < File_Execution::executions_by_pid_size;  ++i) {
+	for (size_t i= 0;  i < File_Execution::executions_by_pid_capacity;  ++i) {
+		if (File_Execution::executions_by_pid_key[i] == 0)
+			continue; 
 		if (File_Execution::executions_by_pid_value[i]->remove_if_existing(false))
 			++count_terminated;
 	}
@@ -2421,15 +3035,19 @@ void job_terminate_all()
 		assert_async(ret > 0); 
 	}
 
+	/* Give back the jobserver tokens of the terminated jobs */
+	Jobserver::close(); 
+
 	errno= errno_save; 
 }
 
 void job_print_jobs()
 {
 	for (size_t i= 0;  
-	     i < File_Execution::executions_by_pid_size;
+	     i < File_Execution::executions_by_pid_capacity;
 	     ++i) {
-		File_Execution::executions_by_pid_value[i]->print_as_job(); 
+		if (File_Execution::executions_by_pid_key[i] != 0)
+			File_Execution::executions_by_pid_value[i]->print_as_job(); 
 	}
 }
 
@@ -2465,7 +3083,8 @@ bool File_Execution::remove_if_existing(bool output)
 
 		if (output) {
 			string text_filename= name_format_src(filename); 
-			Debug::print(this, fmt("remove %s", text_filename)); 
+			if (option_debug)
+				Debug::print(this, fmt("remove %s", text_filename)); 
 			print_error_reminder(fmt("Removing file %s because command failed",
 						 name_format_word(filename))); 
 		}
@@ -2598,7 +3217,74 @@ void File_Execution::print_command() const
 	}
 }
 
-Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
+bool File_Execution::use_signature() const
+{
+	if (rule == nullptr)
+		return false;
+	if (rule->command == nullptr && ! rule->is_copy)
+		return false; 
+	for (const Target &target:  targets) {
+		if (! target.is_file())
+			return false;
+	}
+	return true; 
+}
+
+bool File_Execution::use_state() const
+{
+	return State::enabled() && use_signature() && ! rule->is_hardcode 
+		&& ! (bits & (B_MISSING | B_UNHASHED)); 
+}
+
+bool File_Execution::use_cache() const
+{
+	return Cache::enabled() && use_signature() 
+		&& ! rule->is_hardcode && ! rule->is_copy
+		&& ! (bits & B_UNHASHED); 
+}
+
+string File_Execution::get_signature_text() const
+{
+	assert(use_signature()); 
+
+	/* Each field is terminated by a null character */ 
+	string text;
+	auto add= [&text](const string &field) {
+		text += field;
+		text += '\0';
+	};
+
+	if (rule->is_copy) {
+		add("copy");
+		add(rule->filename.unparametrized());
+		add(Job::get_cp()); 
+	} else if (rule->is_hardcode) {
+		add("content");
+		add(rule->command->command); 
+	} else {
+		add("command");
+		add(rule->command->command); 
+		add(frmt("%u", (unsigned) mapping_parameter.size())); 
+		for (const auto &i:  mapping_parameter) {
+			add(i.first);
+			add(i.second); 
+		}
+		add(frmt("%u", (unsigned) mapping_variable.size())); 
+		for (const auto &i:  mapping_variable) {
+			add(i.first);
+			add(i.second); 
+		}
+		add(rule->redirect_index < 0 ? "" :
+		    rule->place_param_targets[rule->redirect_index]
+		    ->place_name.unparametrized());
+		add(rule->filename.unparametrized()); 
+		add(Job::get_shell()); 
+	}
+
+	return text; 
+}
+
+Proceed File_Execution::execute(Ref <const Dep> dep_this)
 {
 	assert(! job.started() || children.empty()); 
 
@@ -2786,6 +3472,48 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 				timestamp= timestamps_old[i]; 
 			}
 		}
+
+		/* With the state file, a record of the targets overrides
+		 * the decision based on timestamps */
+		if (use_state()) {
+			bool changed;
+			if (State::check(targets, inputs, changed)) {
+				if (changed) {
+					bits |= B_NEED_BUILD; 
+				} else {
+					if (bits & B_NEED_BUILD) 
+						++ State::count_avoided; 
+					bits &= ~B_NEED_BUILD; 
+					/* Parents should not be rebuilt
+					 * because of our dependencies,
+					 * so use only our own
+					 * timestamp */
+					timestamp= Timestamp::UNDEFINED;
+					for (size_t i= 0;  i < targets.size();  ++i) {
+						if (! timestamp.defined() || timestamp < timestamps_old[i]) 
+							timestamp= timestamps_old[i]; 
+					}
+				}
+			} else if (! (bits & B_NEED_BUILD)) {
+				/* Up to date according to timestamps */
+				State::record(targets, inputs); 
+			}
+		}
+
+		if (use_signature() && State::enabled())
+			signature= get_signature(); 
+
+		/* A changed command always causes a rebuild */
+		if (use_signature() && State::enabled()) {
+			string name= targets.front().get_name_nondynamic(); 
+			if (State::signature_changed(name, signature)) {
+				if (! (bits & B_NEED_BUILD))
+					++ State::count_changed; 
+				bits |= B_NEED_BUILD;
+			} else if (! (bits & B_NEED_BUILD)) {
+				State::record_signature(name, signature); 
+			}
+		}
 	}
 
 	if (! (bits & B_NEED_BUILD)) {
@@ -2799,7 +3527,7 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 		for (const Target &target:  targets) {
 			if (! target.is_transient()) 
 				continue; 
-			if (transients.count(target.get_name_nondynamic()) == 0) {
+			if (transients.count(Target_Table::intern(target)) == 0) {
 				/* Transient was not yet executed */ 
 				if (! no_execution && ! has_file) {
 					bits |= B_NEED_BUILD; 
@@ -2854,17 +3582,53 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 
 		print_command();
 		write_content(targets.front().get_name_c_str_nondynamic(), *(rule->command)); 
+		if (use_signature() && State::enabled() && ! error)
+			State::record_signature(targets.front().get_name_nondynamic(), signature); 
 		flags_finished= ~0;
 		assert(proceed == 0); 
 		return proceed |= P_FINISHED; 
 	}
 
+	/* Restore the targets from the cache instead of running the
+	 * command.  This does not need a job slot.  */
+	if (use_cache() && cache_key.empty()) {
+		cache_key= Cache::get_key(get_signature_text(), targets, inputs); 
+		if (cache_key.empty()) {
+			/* An input cannot be hashed */
+			bits |= B_UNHASHED; 
+		} else if (Cache::restore(cache_key, targets)) {
+			if (! option_silent) {
+				string text= targets.front().format_src();
+				printf("Restoring %s from cache\n", text.c_str()); 
+			}
+			restored(); 
+			flags_finished= ~0; 
+			assert(proceed == 0); 
+			return proceed |= P_FINISHED; 
+		}
+	}
+
 	/* We know that a job has to be started now */
 
 	if (jobs == 0) {
-		return proceed |= P_WAIT;
+		return proceed |= P_WAIT | P_SLOT;
+	}
+
+	/* The pool of the rule must have a free slot */
+	if (rule->pool != nullptr && rule->pool->free == 0) {
+		return proceed |= P_WAIT | P_SLOT;
+	}
+
+	/* Hold back the job while the system is under pressure */
+	if (Pressure::enabled() && ! Pressure::admit(executions_by_pid_size)) {
+		return proceed |= P_WAIT | P_SLOT;
 	}
        
+	/* With a jobserver, we also need a token */ 
+	if (Jobserver::enabled() && ! Jobserver::acquire(executions_by_pid_size)) {
+		return proceed |= P_WAIT | P_SLOT;
+	}
+
 	/* We have to start a job now */ 
 
 	print_command();
@@ -2874,8 +3638,9 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 			continue; 
 		Timestamp timestamp_now= Timestamp::now(); 
 		assert(timestamp_now.defined()); 
-		assert(transients.count(target.get_name_nondynamic()) == 0); 
-		transients[target.get_name_nondynamic()]= timestamp_now; 
+		const Target_Id id= Target_Table::intern(target); 
+		assert(transients.count(id) == 0); 
+		transients[id]= timestamp_now; 
 	}
 
 	if (rule->redirect_index >= 0)
@@ -2912,7 +3677,7 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 			 * exists in the cache */
 			if (rule->deps.at(0)->flags & F_OPTIONAL) {
 				Execution *execution_source_base=
-					executions_by_target.at(Target(0, source));
+					get_execution_by_target(Target_Table::intern(0, source));
 				assert(execution_source_base); 
 				File_Execution *execution_source
 					= dynamic_cast <File_Execution *> (execution_source_base); 
@@ -2952,9 +3717,12 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 		assert(pid != 0 && pid != 1); 
 
 		Debug::print(this, frmt("execute: pid = %ld", (long) pid)); 
+		time_started= get_time(); 
 
 		if (pid < 0) {
 			/* Starting the job failed */ 
+			if (Jobserver::enabled())
+				Jobserver::release(); 
 			print_traces(fmt("error executing command for %s", 
 					 targets.front().format_word())); 
 			raise(ERROR_BUILD);
@@ -2972,55 +3740,36 @@ Proceed File_Execution::execute(shared_ptr <const Dep> dep_this)
 			 * value passed via -j (or its default value 1),
 			 * and thus we can allocate arrays of that size
 			 * once and for all.  */
-			if (SIZE_MAX / sizeof(*executions_by_pid_key) < (size_t)jobs ||
-			    SIZE_MAX / sizeof(*executions_by_pid_value) < (size_t)jobs) {
-				errno= ENOMEM;
-				perror("malloc"); 
-				exit(ERROR_FATAL); 
+			size_t capacity= 2; 
+			while (capacity < 2 * (size_t) jobs) {
+				if (capacity > SIZE_MAX / 2 / sizeof(*executions_by_pid_value)) {
+					errno= ENOMEM;
+					perror("malloc"); 
+					exit(ERROR_FATAL); 
+				}
+				capacity *= 2; 
 			}
-			executions_by_pid_key  = (pid_t *)          malloc(jobs * sizeof(*executions_by_pid_key));
-			executions_by_pid_value= (File_Execution **)malloc(jobs * sizeof(*executions_by_pid_value)); 
+			executions_by_pid_key  = (pid_t *)          calloc(capacity, sizeof(*executions_by_pid_key));
+			executions_by_pid_value= (File_Execution **)calloc(capacity, sizeof(*executions_by_pid_value)); 
 			if (!executions_by_pid_key || !executions_by_pid_value) {
-				perror("malloc"); 
+				perror("calloc"); 
 				exit(ERROR_FATAL); 
 			}
+			executions_by_pid_capacity= capacity; 
 		}
 
-		size_t mi= 0, ma= executions_by_pid_size;
-		/* Both are exclusive */
-		assert(mi <= ma); 
-		while (mi < ma) {
-			size_t ne= mi + (ma - mi) / 2;
-			assert(ne < ma); 
-			assert(ne < executions_by_pid_size); 
-			assert(executions_by_pid_key[ne] != pid); 
-			if (executions_by_pid_key[ne] < pid) {
-				mi= ne + 1;
-			} else {
-				ma= ne;
-			}
-		}
-		assert(mi == ma); 
-		assert(mi <= executions_by_pid_size); 
-		assert(mi == 0 || executions_by_pid_key[mi - 1] < pid); 
-		assert(mi == executions_by_pid_size || executions_by_pid_key[mi] > pid); 
-		index= mi; 
-
-		memmove(executions_by_pid_key + index + 1,
-			executions_by_pid_key + index,
-			sizeof(*executions_by_pid_key) * (executions_by_pid_size - index));
-		memmove(executions_by_pid_value + index + 1,
-			executions_by_pid_value + index,
-			sizeof(*executions_by_pid_value) * (executions_by_pid_size - index)); 
-		++ executions_by_pid_size; 
-		executions_by_pid_key[index]= pid;
-		executions_by_pid_value[index]= this;
+		index= insert_pid(pid, this); 
 	}
 
 	assert(executions_by_pid_value[index]->job.started()); 
 	assert(pid == executions_by_pid_value[index]->job.get_pid()); 
+	(void) index; 
 	--jobs;
 	assert(jobs >= 0);
+	if (rule->pool != nullptr) {
+		--rule->pool->free;
+		assert(rule->pool->free >= 0); 
+	}
 
 	proceed |= P_WAIT; 
 	if (order == Order::RANDOM && jobs > 0)
@@ -3067,7 +3816,7 @@ void File_Execution::write_content(const char *filename,
 	if (0 != fclose(file)) {
 		rule->place <<
 			system_format(name_format_word(filename)); 
-		command.get_place() << 
+		command.place << 
 			fmt("error creating %s", 
 			    name_format_word(filename)); 
 		raise(ERROR_BUILD); 
@@ -3077,9 +3826,10 @@ void File_Execution::write_content(const char *filename,
 	bits &= ~B_MISSING; 
 }
 
-void File_Execution::read_variable(shared_ptr <const Dep> dep)
+void File_Execution::read_variable(Ref <const Dep> dep)
 {
-	Debug::print(this, fmt("read_variable %s", dep->format_src())); 
+	if (option_debug)
+		Debug::print(this, fmt("read_variable %s", dep->format_src())); 
 	
 	assert(to <Plain_Dep> (dep)); 
 
@@ -3160,16 +3910,19 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 		to <Plain_Dep> (dep)->place_param_target
 		.unparametrized(); 
 
-	if (rule == nullptr) {
+	if (param_rule == nullptr) {
 		dep->get_place() <<
 			fmt("file %s was up to date but cannot be found now", 
 			    target_variable.format_word());
 	} else {
-		for (auto const &place_param_target: rule->place_param_targets) {
-			if (place_param_target->unparametrized() == target_variable) {
-				place_param_target->place <<
+		/* RULE may have been released by compact(); TARGETS
+		 * are in the same order as the targets of the rule, and
+		 * the places are the same in PARAM_RULE */ 
+		for (size_t i= 0;  i < targets.size();  ++i) {
+			if (targets[i] == target_variable) {
+				param_rule->place_param_targets[i]->place <<
 					fmt("generated file %s was built but cannot be found now", 
-					    place_param_target->format_word());
+					    target_variable.format_word());
 				break;
 			}
 		}
@@ -3179,7 +3932,7 @@ void File_Execution::read_variable(shared_ptr <const Dep> dep)
 	raise(ERROR_BUILD); 
 }
 
-bool File_Execution::optional_finished(shared_ptr <const Dep> dep_link)
+bool File_Execution::optional_finished(Ref <const Dep> dep_link)
 {
 	if ((dep_link->flags & F_OPTIONAL) 
 	    && to <Plain_Dep> (dep_link)
@@ -3232,7 +3985,7 @@ bool Root_Execution::finished(Flags flags) const
 	return is_finished; 
 }
 
-Root_Execution::Root_Execution(const vector <shared_ptr <const Dep> > &deps)
+Root_Execution::Root_Execution(const vector <Ref <const Dep> > &deps)
 	:  is_finished(false)
 {
 	for (auto &d:  deps) {
@@ -3240,7 +3993,7 @@ Root_Execution::Root_Execution(const vector <shared_ptr <const Dep> > &deps)
 	}
 }
 
-Proceed Root_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed Root_Execution::execute(Ref <const Dep> dep_this)
 {
 	/* This is an example of a "plain" execute() function,
 	 * containing the minimal wrapper around execute_base_?()  */ 
@@ -3268,7 +4021,7 @@ Proceed Root_Execution::execute(shared_ptr <const Dep> dep_this)
 	return proceed; 
 }
 
-Concat_Execution::Concat_Execution(shared_ptr <const Concat_Dep> dep_,
+Concat_Execution::Concat_Execution(Ref <const Concat_Dep> dep_,
 				   Execution *parent,
 				   int &error_additional)
 	:  dep(dep_),
@@ -3301,7 +4054,7 @@ Concat_Execution::Concat_Execution(shared_ptr <const Concat_Dep> dep_,
 	size_t k= dep_->deps.size(); 
 	collected.resize(k);
 	for (size_t i= 0;  i < k;  ++i) {
-		collected.at(i)= make_shared <Compound_Dep> (Place::place_empty); 
+		collected.at(i)= make_dep <Compound_Dep> (Place::place_empty); 
 	}
 
 	/* Push initial dependencies */ 
@@ -3310,7 +4063,7 @@ Concat_Execution::Concat_Execution(shared_ptr <const Concat_Dep> dep_,
 		if (auto plain_d= to <const Plain_Dep> (d)) {
 			collected.at(i)->deps.push_back(d); 
 		} else if (auto dynamic_d= to <const Dynamic_Dep> (d)) {
-			shared_ptr <Dep> dep_child= Dep::clone(dynamic_d->dep); 
+			Ref <Dep> dep_child= Dep::clone(dynamic_d->dep); 
 			dep_child->flags |= F_RESULT_NOTIFY;
 			dep_child->index= i; 
 			push(dep_child); 
@@ -3323,7 +4076,7 @@ Concat_Execution::Concat_Execution(shared_ptr <const Concat_Dep> dep_,
 	}
 }
 
-Proceed Concat_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed Concat_Execution::execute(Ref <const Dep> dep_this)
 {
  again:
 	assert(stage <= 2); 
@@ -3378,12 +4131,12 @@ Concat_Execution::~Concat_Execution()
 
 void Concat_Execution::launch_stage_1()
 {
-	shared_ptr <Concat_Dep> c= make_shared <Concat_Dep> ();
+	Ref <Concat_Dep> c= make_dep <Concat_Dep> ();
 	c->deps.resize(collected.size());
 	for (size_t i= 0;  i < collected.size();  ++i) {
 		c->deps.at(i)= move(collected.at(i)); 
 	}
-	vector <shared_ptr <const Dep> > deps;
+	vector <Ref <const Dep> > deps;
 	int e= 0; 
 	Dep::normalize(c, deps, e); 
 	if (e) {
@@ -3392,7 +4145,7 @@ void Concat_Execution::launch_stage_1()
 	}
 			
 	for (auto f:  deps) {
-		shared_ptr <Dep> f2= Dep::clone(f); 
+		Ref <Dep> f2= Dep::clone(f); 
 		/* Add -% flag */
 		f2->flags |= F_RESULT_COPY;
 		/* Add flags from self */  
@@ -3405,10 +4158,10 @@ void Concat_Execution::launch_stage_1()
 	}
 }
 
-void Concat_Execution::notify_result(shared_ptr <const Dep> d, 
+void Concat_Execution::notify_result(Ref <const Dep> d, 
 				     Execution *source, 
 				     Flags flags,
-				     shared_ptr <const Dep> dep_source)
+				     Ref <const Dep> dep_source)
 {
 	(void) source; 
 
@@ -3416,12 +4169,13 @@ void Concat_Execution::notify_result(shared_ptr <const Dep> d,
 	assert((flags & ~(F_RESULT_NOTIFY | F_RESULT_COPY)) != (F_RESULT_NOTIFY | F_RESULT_COPY)); 
 	assert(dep_source); 
 
-	Debug::print(this, fmt("notify_result(flags = %s, d = %s)",
-			       flags_format(flags),
-			       d->format_src())); 
+	if (option_debug)
+		Debug::print(this, fmt("notify_result(flags = %s, d = %s)",
+				       flags_format(flags),
+				       d->format_src())); 
 
 	if (flags & F_RESULT_NOTIFY) {
-		vector <shared_ptr <const Dep> > deps; 
+		vector <Ref <const Dep> > deps; 
 		source->read_dynamic(to <const Plain_Dep> (d), deps, dep, this); 
 		for (auto &j:  deps) {
 			size_t i= dep_source->index;
@@ -3433,7 +4187,7 @@ void Concat_Execution::notify_result(shared_ptr <const Dep> d,
 	}
 }
 
-Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
+Dynamic_Execution::Dynamic_Execution(Ref <const Dynamic_Dep> dep_,
 				     Execution *parent,
 				     int &error_additional)
 	:  dep(dep_),
@@ -3458,7 +4212,7 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 	}
 
 	/* Find the rule of the inner dependency */
-	shared_ptr <const Dep> inner_dep= Dep::strip_dynamic(dep);
+	Ref <const Dep> inner_dep= Dep::strip_dynamic(dep);
 	if (auto inner_plain_dep= to <const Plain_Dep> (inner_dep)) {
 		Target target_base(inner_plain_dep->place_param_target.flags,
 				   inner_plain_dep->place_param_target.place_name.unparametrized());
@@ -3475,7 +4229,7 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 			raise(e); 
 			return; 
 		}
-		executions_by_target[target]= this; 
+		get_execution_by_target(Target_Table::intern(target))= this; 
 	}
 
 	parents.erase(parent); 
@@ -3487,12 +4241,12 @@ Dynamic_Execution::Dynamic_Execution(shared_ptr <const Dynamic_Dep> dep_,
 	parents[parent]= dep; 
 
 	/* Push single initial dependency */ 
-	shared_ptr <Dep> dep_child= Dep::clone(dep->dep);
+	Ref <Dep> dep_child= Dep::clone(dep->dep);
 	dep_child->flags |= F_RESULT_NOTIFY; 
 	push(dep_child); 
 }
 
-Proceed Dynamic_Execution::execute(shared_ptr <const Dep> dep_this)
+Proceed Dynamic_Execution::execute(Ref <const Dep> dep_this)
 {
 	Proceed proceed= execute_base_A(dep_this); 
 	assert(proceed); 
@@ -3537,20 +4291,20 @@ string Dynamic_Execution::format_src() const
 	return dep->format_src();
 }
 
-void Dynamic_Execution::notify_result(shared_ptr <const Dep> d, 
+void Dynamic_Execution::notify_result(Ref <const Dep> d, 
 				      Execution *source, 
 				      Flags flags,
-				      shared_ptr <const Dep> dep_source)
+				      Ref <const Dep> dep_source)
 {
 	assert(!(flags & ~(F_RESULT_NOTIFY | F_RESULT_COPY))); 
 	assert((flags & ~(F_RESULT_NOTIFY | F_RESULT_COPY)) != (F_RESULT_NOTIFY | F_RESULT_COPY)); 
 	assert(dep_source);
 
 	if (flags & F_RESULT_NOTIFY) {
-		vector <shared_ptr <const Dep> > deps; 
+		vector <Ref <const Dep> > deps; 
 		source->read_dynamic(to <const Plain_Dep> (d), deps, dep, this); 
 		for (auto &j:  deps) {
-			shared_ptr <Dep> j_new= Dep::clone(j); 
+			Ref <Dep> j_new= Dep::clone(j); 
 			/* Add -% flag */
 			j_new->flags |= F_RESULT_COPY;
 			/* Add flags from self */  
@@ -3575,7 +4329,22 @@ Transient_Execution::~Transient_Execution()
 	assert(false);
 }
 
-Proceed Transient_Execution::execute(shared_ptr <const Dep> dep_this)
+void Transient_Execution::compact()
+{
+	if (rule != param_rule) {
+		if (rule.use_count() == 1)
+			size_compacted += sizeof(Rule); 
+		rule.reset(); 
+	}
+
+	size_compacted += get_size(mapping_parameter) + get_size(mapping_variable); 
+	mapping_parameter.clear();
+	mapping_variable.clear();
+
+	Execution::compact(); 
+}
+
+Proceed Transient_Execution::execute(Ref <const Dep> dep_this)
 {
 	Proceed proceed= execute_base_A(dep_this); 
 	assert(proceed); 
@@ -3599,7 +4368,7 @@ bool Transient_Execution::finished(Flags) const
 	return is_finished; 
 }
 
-Transient_Execution::Transient_Execution(shared_ptr <const Dep> dep_link,
+Transient_Execution::Transient_Execution(Ref <const Dep> dep_link,
 					 Execution *parent,
 					 shared_ptr <const Rule> rule_,
 					 shared_ptr <const Rule> param_rule_,
@@ -3612,7 +4381,7 @@ Transient_Execution::Transient_Execution(shared_ptr <const Dep> dep_link,
 	swap(mapping_parameter, mapping_parameter_); 
 
 	assert(to <Plain_Dep> (dep_link)); 
-	shared_ptr <const Plain_Dep> plain_dep= 
+	Ref <const Plain_Dep> plain_dep= 
 		to <Plain_Dep> (dep_link);
 
 	Target target= plain_dep->place_param_target.unparametrized();
@@ -3654,13 +4423,13 @@ Transient_Execution::Transient_Execution(shared_ptr <const Dep> dep_link,
 	for (Target t:  targets) {
 		t.get_front_word_nondynamic() |= (word_t)
 			(dep_link->flags & (F_TARGET_BYTE & ~F_TARGET_DYNAMIC)); 
-		executions_by_target[t]= this; 
+		get_execution_by_target(Target_Table::intern(t))= this; 
 	}
 
 	for (auto &dependency:  rule->deps) {
-		shared_ptr <const Dep> depp= dependency;
+		Ref <const Dep> depp= dependency;
 		if (dep_link->flags) {
-			shared_ptr <Dep> depp_new= Dep::clone(depp); 
+			Ref <Dep> depp_new= Dep::clone(depp); 
 			depp_new->flags |= dep_link->flags & (F_PLACED | F_ATTRIBUTE);
 			depp_new->flags |= F_RESULT_COPY; 
 			for (unsigned i= 0;  i < C_PLACED;  ++i) {
@@ -3688,10 +4457,10 @@ string Transient_Execution::format_src() const {
 	return targets.front().format_src(); 
 }
 
-void Transient_Execution::notify_result(shared_ptr <const Dep> dep,
+void Transient_Execution::notify_result(Ref <const Dep> dep,
 					Execution *,
 					Flags flags,
-					shared_ptr <const Dep> dep_source)
+					Ref <const Dep> dep_source)
 {
 	assert(flags == F_RESULT_COPY); 
 	assert(dep_source);
@@ -3701,6 +4470,10 @@ void Transient_Execution::notify_result(shared_ptr <const Dep> dep,
 
 void Debug::print(const Execution *e, string text) 
 {
+	/* Don't format E when not needed */ 
+	if (! option_debug)
+		return; 
+
 	if (e == nullptr) {
 		print("", text);
 	} else {
@@ -10,6 +10,55 @@
 #include <sys/resource.h>
 #include <sys/wait.h>
 
+#ifdef __linux__
+#   include <sys/syscall.h>
+#endif
+
+#include "pressure.hh"
+
+/*
+ * Waiting for jobs.  There are two variants:
+ *   - default:  waitpid() and sigwait() on SIGCHLD, as prescribed by
+ *     POSIX. 
+ *   - pidfd:    each job is watched by a pidfd in an epoll set,
+ *     together with a signalfd for SIGUSR1.  Works only on Linux
+ *     (since version 5.3).  When pidfds turn out not to be available
+ *     at runtime, the default variant is used. 
+ */
+#ifndef USE_PIDFD
+#   if defined(__linux__) && defined(SYS_pidfd_open)
+#      define USE_PIDFD 1
+#   else
+#      define USE_PIDFD 0
+#   endif
+#endif
+
+#if USE_PIDFD
+#   include <sys/epoll.h>
+#   include <sys/signalfd.h>
+#endif
+
+/*
+ * Starting jobs.  There are two variants:
+ *   - posix_spawn:  the default.  Does not copy the page tables of the
+ *     Stu process, which is expensive when the dependency graph is
+ *     large.  
+ *   - fork:  fork() and exec() in the child.  Also used in the
+ *     posix_spawn variant to report errors:  when a redirection
+ *     cannot be set up or posix_spawn() fails, the job is started
+ *     again using fork(), which then outputs the same error messages
+ *     from the child process.  
+ * In both cases, the argument and environment vectors are prepared
+ * in the parent. 
+ */
+#ifndef USE_POSIX_SPAWN
+#   define USE_POSIX_SPAWN 1
+#endif
+
+#if USE_POSIX_SPAWN
+#   include <spawn.h>
+#endif
+
 void job_terminate_all(); 
 /* Called to terminate all running processes, and remove their target
  * files if present.  Implemented in execution.hh, and called from
@@ -56,7 +105,11 @@ class Job
 {
 public:
 
-	Job():  pid(-2) { }
+	Job():  pid(-2)
+#if USE_PIDFD
+	      , pidfd(-1)
+#endif
+	{ }
 
 	bool waited(int status, pid_t pid_check);
 	/* Called after having returned this process from wait_do().
@@ -95,9 +148,14 @@ public:
 	/* Start a copy job.  The return value has the same semantics as
 	 * in start().  */  
 
-	static pid_t wait(int *status);
-	/* Wait for the next process to terminate; provide the STATUS as
-	 * used in wait(2).  Return the PID of the waited-for process (>=0). */  
+	static size_t wait(pid_t *pids, int *statuses, size_t size, int timeout= -1);
+	/* Wait for at least one process to terminate, and then collect
+	 * all processes that have terminated, up to SIZE of them.
+	 * Write their PIDs into PIDS and their status as used in
+	 * wait(2) into STATUSES, which both have length SIZE.  Return
+	 * the number of collected processes (>= 1).  When TIMEOUT is
+	 * not negative, return zero when no process has terminated
+	 * after that many milliseconds.  */  
 
 	static void print_statistics(bool allow_unterminated_jobs= false); 
 	/* Print the statistics about jobs, regardless of OPTION_STATISTICS.  If
@@ -109,6 +167,12 @@ public:
 	static void init_tty(); 
 
 	static pid_t get_tty()  {  return tty;  }
+
+	static const char *get_shell();
+	/* The shell used to run commands:  $STU_SHELL, or "/bin/sh" */
+
+	static const char *get_cp();
+	/* The program used for copy rules:  $STU_CP, or "/bin/cp" */
 	
 	class Signal_Blocker
 	/* 
@@ -139,11 +203,79 @@ private:
 	 * -1:    process has been waited for. 
 	 */
 
+#if USE_PIDFD
+	int pidfd;
+	/* The pidfd of the process while it is started, registered in
+	 * FD_EPOLL; -1 when not used.  */ 
+
+	static int fd_epoll;
+	/* The epoll instance watching the pidfds of all running jobs
+	 * and FD_SIGNAL.  -1 when not initialized.  */
+
+	static int fd_signal;
+	/* Signalfd for SIGUSR1; -1 when not initialized */
+
+	static bool pidfd_failed;
+	/* Set once pidfds were found not to work.  From then on, the
+	 * default variant is used for all jobs, including those that
+	 * are already watched by a pidfd.  */
+
+	void open_pidfd(); 
+	/* Called in the parent process after the job was started.  Try
+	 * to register the new process in FD_EPOLL.  */
+
+	static size_t wait_pidfd(pid_t *pids, int *statuses, size_t size, int timeout);
+	/* Implementation of wait() using FD_EPOLL */
+#endif /* USE_PIDFD */
+
 	static void handler_termination(int sig);
 	static void handler_productive(int sig, siginfo_t *, void *);
 	
 	static void init_signals(); 
 
+	pid_t start_process(const char *path, 
+			    const char *const *argv,
+			    const char *const *envp,
+			    const string &filename_output,
+			    const string &filename_input,
+			    bool redirect_input);
+	/* Start the process, executing PATH with the given argument
+	 * and environment vectors.  FILENAME_OUTPUT and FILENAME_INPUT
+	 * are as in start().  When REDIRECT_INPUT is set and
+	 * FILENAME_INPUT is empty, the input is /dev/null, except in
+	 * interactive mode.  Return the PID, or -1 after having output
+	 * an error message.  Sets PID.  */
+
+	pid_t start_fork(const char *path, 
+			 const char *const *argv,
+			 const char *const *envp,
+			 const string &filename_output,
+			 const string &filename_input,
+			 bool redirect_input); 
+
+#if USE_POSIX_SPAWN
+	pid_t start_spawn(const char *path, 
+			  const char *const *argv,
+			  const char *const *envp,
+			  const string &filename_output,
+			  const string &filename_input,
+			  bool redirect_input); 
+	/* Return -1 without outputting anything on error; the caller
+	 * then uses start_fork() */ 
+
+	static const posix_spawnattr_t *get_spawnattr(); 
+#endif
+
+	static void make_envp(const map <string, string> &mapping,
+			      const vector <Target> &targets,
+			      vector <string> &strings,
+			      vector <const char *> &envp); 
+	/* Prepare the environment of a job, consisting of ENVP_GLOBAL
+	 * with the variables in MAPPING added or replaced, and
+	 * $STU_STATUS and $STU_TARGETS.  STRINGS is used as storage for
+	 * the variables that are not in ENVP_GLOBAL.  The result is
+	 * written to ENVP, which is null-terminated.  */
+
 	static unsigned count_jobs_exec, count_jobs_success, count_jobs_fail;
 	/* 
 	 * The number of jobs run.  Each job is/was of exactly one
@@ -187,6 +319,12 @@ bool Job::signals_initialized;
 bool Job::Signal_Blocker::blocked= false; 
 #endif
 
+#if USE_PIDFD
+int Job::fd_epoll= -1;
+int Job::fd_signal= -1;
+bool Job::pidfd_failed= false; 
+#endif
+
 pid_t Job::start(string command,
 		 const map <string, string> &mapping,
 		 string filename_output,
@@ -196,8 +334,126 @@ pid_t Job::start(string command,
 {
 	assert(pid == -2); 
 
+	init_signals();
+
+	const char *shell= get_shell();
+
+	/* Set variables */ 
+	vector <string> envp_strings;
+	vector <const char *> envp;
+	make_envp(mapping, targets, envp_strings, envp); 
+
+	/* As $0 of the process, we pass the filename of the
+	 * command followed by a colon, the line number, a colon
+	 * and the column number.  This makes the shell if it
+	 * reports an error make the most useful output.  */
+	string argv0= place_command.as_argv0();
+	if (argv0 == "")
+		argv0= shell; 
+
+	/* The one-character options to the shell */
+	/* We use the -e option ('error'), which makes the shell abort
+	 * on a command that fails.  This is also what POSIX prescribes
+	 * for Make.  It is particularly important for Stu, as Stu
+	 * invokes the whole (possibly multiline) command in one step. */
+	const char *shell_options= option_individual ? "-ex" : "-e"; 
+
+	/* 
+	 * Special handling of the case when the command
+	 * starts with '-' or '+'.  In that case, we prepend
+	 * a space to the command.  We cannot use '--' as
+	 * prescribed by POSIX because Linux and FreeBSD handle
+	 * '--' differently: 
+	 *
+	 *      /bin/sh -c -- '+x' 
+	 *      on Linux: Execute the command '+x'
+	 *      on FreeBSD: Execute the command '--' and set
+	 *                  the +x option
+	 *
+	 *      /bin/sh -c +x
+	 *      on Linux: Set the +x option, and missing
+	 *                argument to -c
+	 *      on FreeBSD: Execute the command '+x'
+	 *
+	 * See:
+	 * http://stackoverflow.com/questions/37886661/handling-of-in-arguments-of-bin-sh-posix-vs-implementations-by-bash-dash 
+	 *
+	 * It seems that FreeBSD violates POSIX in this regard. 
+	 */
+	if (command[0] == '-' || command[0] == '+') {
+		command= ' ' + command;
+	}
+
+	const char *arg= command.c_str(); 
+	/* c_str() never returns nullptr, as by the standard */ 
+	assert(arg != nullptr);
+
+	const char *argv[]= {argv0.c_str(), 
+			     shell_options, "-c", arg, nullptr}; 
+
+	if (start_process(shell, argv, envp.data(), 
+			  filename_output, filename_input, true) < 0)
+		return -1; 
+
+	/* Here, we are the parent process */
+
+	assert(pid >= 1); 
+
+	if (option_interactive && tty >= 0) {
+		assert(foreground_pid < 0); 
+		if (tcsetpgrp(tty, pid) < 0)
+			print_error_system("tcsetpgrp");
+		foreground_pid= pid; 
+	}
+		
+	++ count_jobs_exec;
+
+#if USE_PIDFD
+	open_pidfd(); 
+#endif
+
+	return pid; 
+}
+
+pid_t Job::start_copy(string target,
+		      string source)
+{
+	assert(target != "");
+	assert(source != ""); 
+	assert(pid == -2); 
+
 	init_signals(); 
 
+	/* We don't set $STU_STATUS for copy jobs */ 
+
+	const char *cp_command= get_cp(); 
+
+	/* Using '--' as an argument guarantees that the two
+	 * filenames will be interpreted as filenames and not as
+	 * options, in particular when they begin with a dash.  */
+	const char *argv[]= {cp_command,
+			     "--",
+			     source.c_str(),
+			     target.c_str(),
+			     nullptr};
+
+	if (start_process(cp_command, argv, envp_global, "", "", false) < 0) 
+		return -1; 
+
+	/* Parent execution */
+	++ count_jobs_exec;
+
+	assert(pid >= 1); 
+
+#if USE_PIDFD
+	open_pidfd(); 
+#endif
+
+	return pid; 
+}
+
+const char *Job::get_shell()
+{
 	/* Like Make, we don't use the variable $SHELL, but use
 	 * "/bin/sh" as a shell instead.  The reason is that the
 	 * variable $SHELL is intended to denote the user's chosen
@@ -216,11 +472,41 @@ pid_t Job::start(string command,
 		if (shell == nullptr || shell[0] == '\0') 
 			shell= "/bin/sh"; 
 	}
-	
-	const char *arg= command.c_str(); 
-	/* c_str() never returns nullptr, as by the standard */ 
-	assert(arg != nullptr);
+	return shell; 
+}
+
+const char *Job::get_cp()
+{
+	static const char *cp_command= nullptr;
+	if (cp_command == nullptr) {
+		cp_command= getenv("STU_CP");
+		if (cp_command == nullptr || cp_command[0] == '\0') 
+			cp_command= "/bin/cp"; 
+	}
+	return cp_command; 
+}
 
+pid_t Job::start_process(const char *path, 
+			 const char *const *argv,
+			 const char *const *envp,
+			 const string &filename_output,
+			 const string &filename_input,
+			 bool redirect_input)
+{
+#if USE_POSIX_SPAWN
+	if (start_spawn(path, argv, envp, filename_output, filename_input, redirect_input) >= 0)
+		return pid; 
+#endif
+	return start_fork(path, argv, envp, filename_output, filename_input, redirect_input); 
+}
+
+pid_t Job::start_fork(const char *path, 
+		      const char *const *argv,
+		      const char *const *envp,
+		      const string &filename_output,
+		      const string &filename_input,
+		      bool redirect_input)
+{
 	pid= fork();
 
 	if (pid < 0) {
@@ -264,119 +550,6 @@ pid_t Job::start(string command,
 		::signal(SIGTTIN, SIG_DFL);
 		::signal(SIGTTOU, SIG_DFL); 
 		
-		/* Set variables */ 
-		size_t v_old= 0;
-
-		map <string, size_t> old;
-		/* Index of old variables */ 
-
-		while (envp_global[v_old]) {
-			const char *p= envp_global[v_old];
-			const char *q= p;
-			while (*q && *q != '=')  ++q;
-			string key_old(p, q-p);
-			old[key_old]= v_old;
-			++v_old;
-		}
-
-		const size_t v_new= mapping.size() + 2;
-		/* Maximal size of added variables.  The "+1" is for $STU_STATUS */ 
-
-		const char** envp= (const char **)
-			alloca(sizeof(char **) * (v_old + v_new + 1));
-		if (!envp) {
-			/* alloca() never returns null */ 
-			assert(false);
-			perror("alloca");
-			_Exit(127); 
-		}
-		memcpy(envp, envp_global, v_old * sizeof(char **)); 
-		size_t i= v_old;
-		for (auto j= mapping.begin();  j != mapping.end();  ++j) {
-			string key= j->first;
-			string value= j->second;
-			assert(key.find('=') == string::npos); 
-			char *combined;
-			if (0 > asprintf(&combined, "%s=%s", key.c_str(), value.c_str())) {
-				perror("asprintf");
-				_Exit(127); 
-			}
-			if (old.count(key)) {
-				size_t v_index= old.at(key);
-				envp[v_index]= combined;
-			} else {
-				assert(i < v_old + v_new); 
-				envp[i++]= combined;
-			}
-		}
-
-		envp[i++]= "STU_STATUS=1";
-
-		// Add a STU_TARGETS variable to the environment, one for each target, separated by newline
-		string stu_targets;
-		stu_targets.append("STU_TARGETS");
-		for(auto & one_target : targets) {
-			stu_targets.append("\n");
-			stu_targets.append(one_target.format_src());
-		}
-		// The first element of stu_targets will now have a '\n', due
-		// to the above loop. We change it to an '=' and then add it
-		// to envp
-		assert(stu_targets.at(11)=='\n');
-		stu_targets.at(11)='=';
-		envp[i++]= stu_targets.c_str();
-
-		// envp is now complete. Close it off with a null
-		assert(i <= v_old + v_new);
-		envp[i]= nullptr;
-
-		/* As $0 of the process, we pass the filename of the
-		 * command followed by a colon, the line number, a colon
-		 * and the column number.  This makes the shell if it
-		 * reports an error make the most useful output.  */
-		string argv0= place_command.as_argv0();
-		if (argv0 == "")
-			argv0= shell; 
-
-		/* The one-character options to the shell */
-		/* We use the -e option ('error'), which makes the shell abort
-		 * on a command that fails.  This is also what POSIX prescribes
-		 * for Make.  It is particularly important for Stu, as Stu
-		 * invokes the whole (possibly multiline) command in one step. */
-		const char *shell_options= option_individual ? "-ex" : "-e"; 
-
-		const char *argv[]= {argv0.c_str(), 
-				     shell_options, "-c", arg, nullptr}; 
-
-		/* 
-		 * Special handling of the case when the command
-		 * starts with '-' or '+'.  In that case, we prepend
-		 * a space to the command.  We cannot use '--' as
-		 * prescribed by POSIX because Linux and FreeBSD handle
-		 * '--' differently: 
-		 *
-		 *      /bin/sh -c -- '+x' 
-		 *      on Linux: Execute the command '+x'
-		 *      on FreeBSD: Execute the command '--' and set
-		 *                  the +x option
-		 *
-		 *      /bin/sh -c +x
-		 *      on Linux: Set the +x option, and missing
-		 *                argument to -c
-		 *      on FreeBSD: Execute the command '+x'
-		 *
-		 * See:
-		 * http://stackoverflow.com/questions/37886661/handling-of-in-arguments-of-bin-sh-posix-vs-implementations-by-bash-dash 
-		 *
-		 * It seems that FreeBSD violates POSIX in this regard. 
-		 */
-
-		if (arg[0] == '-' || arg[0] == '+') {
-			command= ' ' + command;
-			arg= command.c_str();
-			argv[3]= arg;
-		}
-
 		/* Output redirection */
 		if (filename_output != "") {
 			int fd_output= creat
@@ -399,7 +572,7 @@ pid_t Job::start(string command,
 
 		/* Input redirection:  from the given file, or from
 		 * /dev/null (in non-interactive mode)  */
-		if (filename_input != "" || ! option_interactive) {
+		if (redirect_input && (filename_input != "" || ! option_interactive)) {
 			const char *name= filename_input == ""
 				? "/dev/null"
 				: filename_input.c_str(); 
@@ -421,7 +594,7 @@ pid_t Job::start(string command,
 			}
 		}
 
-		int r= execve(shell, (char *const *) argv, (char *const *) envp); 
+		int r= execve(path, (char *const *) argv, (char *const *) envp); 
 
 		/* If execve() returns, there is an error, and its return value is -1 */
 		assert(r == -1); 
@@ -429,114 +602,217 @@ pid_t Job::start(string command,
 		_Exit(127); 
 	} 
 
-	/* Here, we are the parent process */
-
 	assert(pid >= 1); 
+	return pid; 
+}
 
-	if (option_interactive && tty >= 0) {
-		assert(foreground_pid < 0); 
-		if (tcsetpgrp(tty, pid) < 0)
-			print_error_system("tcsetpgrp");
-		foreground_pid= pid; 
+#if USE_POSIX_SPAWN
+
+pid_t Job::start_spawn(const char *path, 
+		       const char *const *argv,
+		       const char *const *envp,
+		       const string &filename_output,
+		       const string &filename_input,
+		       bool redirect_input)
+{
+	/* The files are opened here in the parent.  They are
+	 * close-on-exec, and therefore only the copies made by dup2()
+	 * in the child remain open after exec().  A file descriptor
+	 * below 3 would be one of the standard file descriptors, which
+	 * we leave to start_fork().  */
+	int fd_output= -1, fd_input= -1; 
+	if (filename_output != "") {
+		fd_output= open(filename_output.c_str(), 
+				O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				/* All +rw, i.e. 0666 */
+				S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH); 
+		if (fd_output < 3) {
+			if (fd_output >= 0) 
+				close(fd_output);
+			return -1; 
+		}
 	}
-		
-	++ count_jobs_exec;
+	if (redirect_input && (filename_input != "" || ! option_interactive)) {
+		const char *name= filename_input == ""
+			? "/dev/null"
+			: filename_input.c_str(); 
+		fd_input= open(name, O_RDONLY | O_CLOEXEC); 
+		if (fd_input < 3) {
+			if (fd_input >= 0) 
+				close(fd_input);
+			if (fd_output >= 0) 
+				close(fd_output); 
+			return -1; 
+		}
+	}
+
+	posix_spawn_file_actions_t file_actions;
+	int r= posix_spawn_file_actions_init(&file_actions); 
+	if (r == 0 && fd_output >= 0)
+		r= posix_spawn_file_actions_adddup2(&file_actions, fd_output, 1); 
+	if (r == 0 && fd_input >= 0)
+		r= posix_spawn_file_actions_adddup2(&file_actions, fd_input, 0); 
+
+	pid_t pid_spawn= -1; 
+	if (r == 0)
+		r= posix_spawn(&pid_spawn, path, &file_actions, get_spawnattr(), 
+			       (char *const *) argv, (char *const *) envp); 
+	posix_spawn_file_actions_destroy(&file_actions); 
+
+	if (fd_output >= 0) 
+		close(fd_output);
+	if (fd_input >= 0) 
+		close(fd_input); 
+
+	if (r != 0) 
+		return -1; 
 
+	assert(pid_spawn >= 1); 
+	pid= pid_spawn; 
 	return pid; 
 }
 
-/* This function works analogously to start() with respect to invocation
- * of fork() and other system-related functions.  */
-pid_t Job::start_copy(string target,
-		      string source)
+const posix_spawnattr_t *Job::get_spawnattr()
+/* The attributes are the same for all jobs:  each job is put into its
+ * own process group, and the signals are set up as in start_fork(). 
+ * The signal mask is that of the Stu process, without the termination
+ * and productive signals.  Signals that are caught by Stu are reset to
+ * their default action by exec() anyway.  */
 {
-	assert(target != "");
-	assert(source != ""); 
-	assert(pid == -2); 
-
-	init_signals(); 
+	static posix_spawnattr_t attr;
+	static bool initialized= false;
+	if (initialized)
+		return &attr;
 
-	pid= fork();
-
-	if (pid < 0) {
-		print_error_system("fork"); 
-		assert(pid == -1); 
-		return -1; 
+	sigset_t set_mask, set_default;
+	if (0 != sigprocmask(SIG_BLOCK, nullptr, &set_mask)) {
+		perror("sigprocmask");
+		exit(ERROR_FATAL); 
+	}
+	for (int sig= 1;  sig < NSIG;  ++sig) {
+		if (sigismember(&set_termination, sig) == 1 ||
+		    sigismember(&set_productive, sig) == 1)
+			sigdelset(&set_mask, sig); 
+	}
+	if (0 != sigemptyset(&set_default) ||
+	    0 != sigaddset(&set_default, SIGTTIN) ||
+	    0 != sigaddset(&set_default, SIGTTOU)) {
+		perror("sigaddset");
+		exit(ERROR_FATAL); 
 	}
 
-	int pid_child= pid;
-	if (pid_child == 0)
-		pid_child= getpid();
-	if (0 > setpgid(pid_child, pid_child)) {
-		/* no-op */ 
+	if (0 != posix_spawnattr_init(&attr) ||
+	    0 != posix_spawnattr_setflags
+	    (&attr, POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF) ||
+	    0 != posix_spawnattr_setpgroup(&attr, 0) ||
+	    0 != posix_spawnattr_setsigmask(&attr, &set_mask) ||
+	    0 != posix_spawnattr_setsigdefault(&attr, &set_default)) {
+		perror("posix_spawnattr");
+		exit(ERROR_FATAL); 
 	}
 
-	if (pid == 0) {
-		/* We are the child process */ 
+	initialized= true; 
+	return &attr; 
+}
 
-		/* We don't set $STU_STATUS for copy jobs */ 
+#endif /* USE_POSIX_SPAWN */
 
-		static const char *cp_command= nullptr;
-		if (cp_command == nullptr) {
-			cp_command= getenv("STU_CP");
-			if (cp_command == nullptr || cp_command[0] == '\0') 
-				cp_command= "/bin/cp"; 
+void Job::make_envp(const map <string, string> &mapping,
+		    const vector <Target> &targets,
+		    vector <string> &strings,
+		    vector <const char *> &envp)
+{
+	/* Index of the variables in ENVP_GLOBAL by name, which does not
+	 * change during the runtime of Stu */ 
+	static map <string, size_t> index_global;
+	static size_t size_global= 0; 
+	static bool initialized= false;
+	if (! initialized) {
+		initialized= true; 
+		while (envp_global[size_global]) {
+			const char *p= envp_global[size_global];
+			const char *q= p;
+			while (*q && *q != '=')  ++q;
+			index_global[string(p, q-p)]= size_global; 
+			++size_global; 
 		}
+	}
 
-		/* Using '--' as an argument guarantees that the two
-		 * filenames will be interpreted as filenames and not as
-		 * options, in particular when they begin with a dash.  */
-		const char *argv[]= {cp_command,
-				     "--",
-				     source.c_str(),
-				     target.c_str(),
-				     nullptr};
+	/* The strings must not be reallocated after their pointers are
+	 * taken.  The "+1" is for $STU_TARGETS */ 
+	strings.reserve(mapping.size() + 1); 
+	envp.reserve(size_global + mapping.size() + 3); 
+	envp.assign(envp_global, envp_global + size_global); 
+
+	for (const auto &j:  mapping) {
+		assert(j.first.find('=') == string::npos); 
+		strings.push_back(j.first + '=' + j.second); 
+		auto k= index_global.find(j.first); 
+		if (k != index_global.end()) 
+			envp[k->second]= strings.back().c_str();
+		else 
+			envp.push_back(strings.back().c_str()); 
+	}
 
-		int r= execv(cp_command, (char *const *) argv); 
+	envp.push_back("STU_STATUS=1");
 
-		assert(r == -1); 
-		perror("execv");
-		_Exit(127); 
+	/* $STU_TARGETS contains all targets, separated by newlines */ 
+	string stu_targets= "STU_TARGETS=";
+	for (size_t i= 0;  i < targets.size();  ++i) {
+		if (i)
+			stu_targets += '\n';
+		stu_targets += targets[i].format_src(); 
 	}
+	strings.push_back(stu_targets); 
+	envp.push_back(strings.back().c_str()); 
 
-	/* Parent execution */
-	++ count_jobs_exec;
-
-	assert(pid >= 1); 
-	return pid; 
+	envp.push_back(nullptr); 
 }
 
-
-pid_t Job::wait(int *status)
+size_t Job::wait(pid_t *pids, int *statuses, size_t size, int timeout)
 /* 
  * The main loop of Stu.  We wait for the two productive signals SIGCHLD
- * and SIGUSR1. 
+ * and SIGUSR1, or on the pidfds of the jobs. 
  * 	
  * When this function is called, there is always at least one child
  * process running. 
  */
 {
+	assert(size > 0); 
+
+#if USE_PIDFD
+	if (fd_epoll >= 0 && ! pidfd_failed) 
+		return wait_pidfd(pids, statuses, size, timeout); 
+#endif
+
  begin: 	
-	/* First, try wait() without blocking.  WUNTRACED is used to
-	 * also get notified when a job is suspended (e.g. with
-	 * Ctrl-Z).  */ 
-	pid_t pid= waitpid(-1, status, WNOHANG | 
-			   (option_interactive
-			    ? WUNTRACED
-			    : 0
-			    )
-			   );
-	if (pid < 0) {
-		/* Should not happen as there is always something
-		 * running when this function is called.  However, this
-		 * may be common enough that we may want Stu to act
-		 * correctly.  */ 
-		assert(false); 
-		perror("waitpid"); 
-		abort(); 
-	}
+	/* First, collect all terminated processes without blocking.
+	 * WUNTRACED is used to also get notified when a job is
+	 * suspended (e.g. with Ctrl-Z).  */ 
+	size_t count= 0;
+	while (count < size) {
+		int *status= statuses + count; 
+		pid_t pid= waitpid(-1, status, WNOHANG | 
+				   (option_interactive
+				    ? WUNTRACED
+				    : 0
+				    )
+				   );
+		if (pid < 0) {
+			/* Should not happen as there is always something
+			 * running when this function is called.  However,
+			 * this may be common enough that we may want Stu
+			 * to act correctly.  */ 
+			if (count > 0)
+				break;
+			assert(false); 
+			perror("waitpid"); 
+			abort(); 
+		}
+
+		if (pid == 0)
+			break;
 
-	if (pid > 0) {
 		if (WIFSTOPPED(*status)) {
 			/* The process was suspended. This can have
 			 * several reasons, include someone just using
@@ -568,12 +844,15 @@ pid_t Job::wait(int *status)
 				print_error_system("tcsetpgrp");
 			/* Continue job */
 			::kill(-pid, SIGCONT); 
-			goto begin;
+			continue;
 		}
 
-		return pid;
+		pids[count++]= pid; 
 	}
 
+	if (count > 0)
+		return count; 
+
 	/* Any SIGCHLD sent after the last call to sigwait() will be
 	 * ready for receiving, even those SIGCHLD signals received
 	 * between the last call to waitpid() and the following call to
@@ -584,7 +863,17 @@ pid_t Job::wait(int *status)
 	int r;
  retry:
 	errno= 0;
-	r= sigwait(&set_productive, &sig);
+	if (timeout >= 0) {
+		struct timespec ts;
+		ts.tv_sec= timeout / 1000;
+		ts.tv_nsec= (long) (timeout % 1000) * 1000000;
+		sig= sigtimedwait(&set_productive, nullptr, &ts);
+		if (sig < 0 && errno == EAGAIN)
+			return 0; 
+		r= sig < 0 ? -1 : 0; 
+	} else {
+		r= sigwait(&set_productive, &sig);
+	}
 
 	if (r != 0) {
 		if (errno == EINTR) {
@@ -619,6 +908,130 @@ pid_t Job::wait(int *status)
 	}
 }
 
+#if USE_PIDFD
+
+void Job::open_pidfd()
+{
+	assert(pid >= 1); 
+	assert(pidfd == -1); 
+
+	/* In interactive mode, we must be notified of stopped jobs,
+	 * which pidfds don't do */
+	if (pidfd_failed || option_interactive)
+		return;
+
+	if (fd_epoll < 0) {
+		fd_epoll= epoll_create1(EPOLL_CLOEXEC);
+		if (fd_epoll < 0) {
+			pidfd_failed= true;
+			return; 
+		}
+		sigset_t set_usr1;
+		if (0 != sigemptyset(&set_usr1) ||
+		    0 != sigaddset(&set_usr1, SIGUSR1)) {
+			perror("sigaddset");
+			exit(ERROR_FATAL); 
+		}
+		fd_signal= signalfd(-1, &set_usr1, SFD_CLOEXEC); 
+		struct epoll_event event;
+		event.events= EPOLLIN;
+		event.data.u64= 0;
+		/* Zero denotes FD_SIGNAL; all other values contain the
+		 * pidfd in the upper and the PID in the lower 32 bits */ 
+		if (fd_signal < 0 || 
+		    0 > epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_signal, &event)) {
+			pidfd_failed= true;
+			return; 
+		}
+	}
+
+	/* Pidfds are always close-on-exec */ 
+	pidfd= syscall(SYS_pidfd_open, pid, 0); 
+	if (pidfd < 0) {
+		/* E.g. ENOSYS on Linux before 5.3 */ 
+		pidfd= -1; 
+		pidfd_failed= true;
+		return; 
+	}
+
+	struct epoll_event event;
+	event.events= EPOLLIN;
+	event.data.u64= (uint64_t) pidfd << 32 | (uint32_t) pid; 
+	if (0 > epoll_ctl(fd_epoll, EPOLL_CTL_ADD, pidfd, &event)) {
+		close(pidfd);
+		pidfd= -1; 
+		pidfd_failed= true; 
+	}
+}
+
+size_t Job::wait_pidfd(pid_t *pids, int *statuses, size_t size, int timeout)
+{
+	struct epoll_event events[64]; 
+	const int max= sizeof(events) / sizeof(events[0]); 
+	size_t count= 0;
+
+	/* Block until at least one event is available, and then
+	 * continue to collect events without blocking, until there are
+	 * no more.  */
+	while (count < size) {
+		int n= epoll_wait(fd_epoll, events, max, count ? 0 : timeout); 
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			abort(); 
+		}
+		if (n == 0) {
+			assert(count > 0 || timeout >= 0); 
+			break;
+		}
+
+		for (int i= 0;  i < n && count < size;  ++i) {
+
+			if (events[i].data.u64 == 0) {
+				struct signalfd_siginfo info;
+				if (read(fd_signal, &info, sizeof(info)) != sizeof(info)) 
+					continue;
+				assert(info.ssi_signo == SIGUSR1); 
+				print_statistics(true); 
+				job_print_jobs(); 
+				continue; 
+			}
+
+			const pid_t pid= (pid_t) (events[i].data.u64 & 0xFFFFFFFF); 
+			const int fd= (int) (events[i].data.u64 >> 32); 
+			pid_t r= waitpid(pid, statuses + count, WNOHANG);
+			if (r < 0) {
+				assert(false);
+				perror("waitpid");
+				abort(); 
+			}
+			if (r == 0)
+				continue;
+			assert(r == pid); 
+			pids[count++]= pid; 
+
+			/* The pidfd is only closed in waited(), and until
+			 * then it stays readable.  Also, closing it
+			 * does not remove it from FD_EPOLL as long as a
+			 * child process forked in the meantime still has
+			 * a copy of it.  Therefore, remove it explicitly,
+			 * so that the process is not reported again.  */
+			if (0 > epoll_ctl(fd_epoll, EPOLL_CTL_DEL, fd, nullptr)) {
+				perror("epoll_ctl");
+				abort(); 
+			}
+		}
+
+		if (n < max && count > 0)
+			break; 
+	}
+
+	return count; 
+}
+
+#endif /* USE_PIDFD */
+
 bool Job::waited(int status, pid_t pid_check) 
 {
 	assert(pid_check >= 0);
@@ -638,6 +1051,13 @@ bool Job::waited(int status, pid_t pid_check)
 		if (tcsetpgrp(tty, getpid()) < 0)
 			print_error_system("tcsetpgrp");
 	}
+
+#if USE_PIDFD
+	if (pidfd >= 0) {
+		close(pidfd);
+		pidfd= -1; 
+	}
+#endif
 	
 	pid= -1;
 
@@ -678,6 +1098,12 @@ void Job::print_statistics(bool allow_unterminated_jobs)
 	       (intmax_t) usage.ru_stime.tv_sec,
 	       (long)     usage.ru_stime.tv_usec); 
 	printf("STATISTICS  Note: children execution times exclude running jobs\n"); 
+	if (Pressure::enabled()) {
+		const int64_t time_throttled= Pressure::get_time_throttled(); 
+		printf("STATISTICS  time during which jobs were held back = %jd.%06ld s\n", 
+		       (intmax_t) (time_throttled / 1000000),
+		       (long)     (time_throttled % 1000000)); 
+	}
 }
 
 void Job::handler_termination(int sig)
@@ -0,0 +1,245 @@
+#ifndef JOBSERVER_HH
+#define JOBSERVER_HH
+
+/*
+ * Support for the jobserver protocol of GNU Make, used when Stu runs
+ * jobs in parallel (-j).  A jobserver is a pipe (or named pipe)
+ * containing one byte ("token") for each job that may be run in
+ * addition to the one job that each process may always run.  All
+ * processes in a tree of Make and Stu invocations share the same
+ * jobserver, so that the total number of jobs is bounded by the value
+ * passed to the topmost one.
+ *
+ *   - Client:  when $MAKEFLAGS contains the option --jobserver-auth
+ *     (or --jobserver-fds, as used by older versions of Make), Stu uses
+ *     the given jobserver.  It has the form R,W (file descriptors of a
+ *     pipe inherited from the parent process), or fifo:PATH (a named
+ *     pipe).
+ *   - Server:  otherwise, Stu creates a pipe containing K-1 tokens,
+ *     where K is the value passed to -j, and exports it to its jobs in
+ *     $MAKEFLAGS.
+ *
+ * In both cases, Stu reads a token before starting each job except
+ * when no job is running, and writes it back when the job has
+ * finished.  The number of jobs is additionally bounded by the value
+ * of -j.  When no token is available, Stu waits for one of its own
+ * jobs to finish.  Tokens are read without blocking, using a file
+ * description of its own for the read end of the pipe, so that the
+ * pipe remains in blocking mode for the other processes.  A named pipe
+ * is simply opened a second time; an inherited pipe is reopened via
+ * /proc/self/fd where that exists (Linux).  Otherwise, Stu checks with
+ * poll() that a token is available before reading it from the blocking
+ * pipe; another process may then still take the token first, in which
+ * case Stu blocks until one is written back.  Tokens still held are written back on all exit paths:  on a normal
+ * exit, on exit(), and when Stu is terminated by a signal.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+
+extern char **environ;
+
+class Jobserver
+{
+public:
+
+	static void init(long jobs);
+	/* Called once when the -j option is used with a value >1, with
+	 * that value, before any job is started */
+
+	static bool enabled() {  return fd_read >= 0;  }
+
+	static bool acquire(size_t count_running);
+	/* Get a token for starting a job, given the number of jobs
+	 * that are currently running.  Return false when no token is
+	 * available; in that case, no job must be started.  */
+
+	static void release();
+	/* Called after a job has finished, or could not be started
+	 * after acquire() returned true */
+
+	static void close();
+	/* Return all tokens still held.  Registered with atexit(), and
+	 * called from job_terminate_all().  [ASYNC-SIGNAL-SAFE] */
+
+private:
+
+	static int fd_read;
+	/* Opened in non-blocking mode, unless BLOCKING is set; -1 when
+	 * not used */
+
+	static int fd_write;
+
+	static bool blocking;
+	/* FD_READ could not be opened in non-blocking mode */
+
+	static char *tokens;
+	/* The tokens currently held, to be written back as they were
+	 * read.  Excludes the implicit token of the first job.  Has
+	 * room for the -j value; allocated in init(), so that close()
+	 * does not need to allocate.  */
+
+	static volatile size_t count_tokens;
+
+	static bool parse(const char *makeflags, string &auth);
+	/* Find the value of the last jobserver option in $MAKEFLAGS */
+
+	static void set_read(int fd, const string &path);
+	/* Set FD_READ to a non-blocking file description of the read
+	 * end FD, opened from PATH, or to FD itself when PATH cannot be
+	 * opened  */
+};
+
+int Jobserver::fd_read= -1;
+int Jobserver::fd_write= -1;
+bool Jobserver::blocking= false;
+char *Jobserver::tokens= nullptr;
+volatile size_t Jobserver::count_tokens= 0;
+
+void Jobserver::init(long jobs)
+{
+	assert(jobs > 1);
+	assert(fd_read < 0);
+
+	tokens= new char [jobs];
+	if (atexit(close) != 0) {
+		print_error_system("atexit");
+		exit(ERROR_FATAL);
+	}
+
+	const char *makeflags= getenv("MAKEFLAGS");
+	string auth;
+	if (makeflags != nullptr && parse(makeflags, auth)) {
+		/* Client */
+		if (auth.substr(0, 5) == "fifo:") {
+			string path= auth.substr(5);
+			int fd= ::open(path.c_str(), O_RDWR | O_CLOEXEC);
+			if (fd < 0) {
+				print_error_system(path);
+				exit(ERROR_FATAL);
+			}
+			fd_write= fd;
+			set_read(fd, path);
+			return;
+		}
+		int r, w;
+		char c;
+		if (sscanf(auth.c_str(), "%d,%d%c", &r, &w, &c) == 2 &&
+		    r >= 0 && w >= 0 &&
+		    fcntl(r, F_GETFD) >= 0 && fcntl(w, F_GETFD) >= 0) {
+			fd_write= w;
+			set_read(r, frmt("/proc/self/fd/%d", r));
+			return;
+		}
+		/* The file descriptors were not passed to us, e.g.,
+		 * because Make did not recognize the command as a
+		 * recursive invocation.  Use our own jobserver.  */
+	}
+
+	/* Server */
+	int fds[2];
+	if (pipe(fds) < 0) {
+		print_error_system("pipe");
+		exit(ERROR_FATAL);
+	}
+	string content(jobs - 1, '+');
+	if (write(fds[1], content.data(), content.size()) != (ssize_t) content.size()) {
+		print_error_system("write");
+		exit(ERROR_FATAL);
+	}
+	fd_write= fds[1];
+	set_read(fds[0], frmt("/proc/self/fd/%d", fds[0]));
+
+	string makeflags_new= makeflags ? makeflags : "";
+	makeflags_new += frmt(" -j%ld --jobserver-auth=%d,%d", jobs, fds[0], fds[1]);
+	if (setenv("MAKEFLAGS", makeflags_new.c_str(), 1) < 0) {
+		print_error_system("setenv");
+		exit(ERROR_FATAL);
+	}
+	envp_global= (const char **) environ;
+}
+
+bool Jobserver::acquire(size_t count_running)
+{
+	assert(enabled());
+	if (count_running == 0) {
+		assert(count_tokens == 0);
+		return true;
+	}
+
+	/* With a blocking file description, we must check first whether
+	 * a token is available */
+	if (blocking) {
+		struct pollfd pfd;
+		pfd.fd= fd_read;
+		pfd.events= POLLIN;
+		if (poll(&pfd, 1, 0) <= 0)
+			return false;
+	}
+
+	char c;
+	ssize_t r= read(fd_read, &c, 1);
+	if (r < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
+		print_error_system("read");
+		return false;
+	}
+	if (r != 1)
+		return false;
+	tokens[count_tokens]= c;
+	++count_tokens;
+	return true;
+}
+
+void Jobserver::release()
+{
+	if (count_tokens == 0)
+		return;
+	/* Decrement first, so that close() called from a signal
+	 * handler does not write back the same token twice */
+	char c= tokens[--count_tokens];
+	if (write(fd_write, &c, 1) != 1)
+		print_error_system("write");
+}
+
+void Jobserver::close()
+{
+	while (count_tokens != 0) {
+		char c= tokens[--count_tokens];
+		if (write(fd_write, &c, 1) != 1) {
+			write_async(2, "*** Error: write\n");
+			return;
+		}
+	}
+}
+
+void Jobserver::set_read(int fd, const string &path)
+{
+	fd_read= ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd_read < 0) {
+		fd_read= fd;
+		blocking= true;
+	}
+}
+
+bool Jobserver::parse(const char *makeflags, string &auth)
+{
+	bool ret= false;
+	const char *p= makeflags;
+	while (*p) {
+		while (*p == ' ')  ++p;
+		const char *q= p;
+		while (*q && *q != ' ')  ++q;
+		string word(p, q - p);
+		for (const char *option:  {"--jobserver-auth=", "--jobserver-fds="}) {
+			size_t length= strlen(option);
+			if (word.substr(0, length) == option) {
+				auth= word.substr(length);
+				ret= true;
+			}
+		}
+		p= q;
+	}
+	return ret;
+}
+
+#endif /* ! JOBSERVER_HH */
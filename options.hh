@@ -31,6 +31,12 @@ static bool option_keep_going= false;
 static bool option_no_delete= false;
 /* The -K option (don't delete partially built files) */
 
+static bool option_lazy= false;
+/* The -l option (parse the dependencies of rules only when needed) */
+
+static bool option_pressure= false;
+/* The -L option (hold back jobs under memory or CPU pressure) */
+
 static bool option_print= false;
 /* The -P option (print rules) */
 
@@ -47,8 +53,11 @@ static bool option_statistics= false;
 /* The -z option (output statistics) */
 
 enum class Order {
-	DFS   = 0,
-	RANDOM= 1,
+	DFS     = 0,
+	RANDOM  = 1,
+	CRITICAL= 2,
+	/* Critical path first; uses durations recorded in the state
+	 * file */
 	
 	/* -M mode is coded as Order::RANDOM */ 
 };
@@ -0,0 +1,345 @@
+#ifndef ORDER_HH
+#define ORDER_HH
+
+/*
+ * Incremental topological order of a directed graph to which edges are
+ * only added, after Marchetti-Spaccamela, Nanni and Rohnert.  All nodes
+ * are kept in a total order such that for each edge A->B, A comes
+ * before B.  Inserting an edge that is already in order takes constant
+ * time.  When an edge is inserted that violates the order, the nodes
+ * reachable from its target that lie before its source are searched,
+ * and moved directly after its source.  If the search reaches the
+ * source of the new edge, the edge would close a cycle.  The cost is
+ * thus proportional to the part of the graph between the two nodes.
+ *
+ * A new node is placed directly after a given node, normally the node
+ * from which its first edge will come.  As the graph of executions
+ * is built depth-first, most edges are then in order from the start.
+ * The order is a linked list of the nodes, which have integer labels
+ * that are renumbered as necessary when a node is inserted between two
+ * others, after Dietz and Sleator.
+ *
+ * This is used by Execution::find_cycle() to decide quickly that an
+ * edge between two executions cannot create a cycle.  Nodes there
+ * stand for rules rather than for individual executions, and
+ * therefore the graph may contain cycles that are not cycles of
+ * executions.  Such a cycle is kept by merging its nodes into a single
+ * node, which is ordered like any other node.  Edges between nodes
+ * that have been merged are not checked anymore.
+ */
+
+class Topological_Order
+{
+public:
+
+	typedef unsigned Node;
+
+	static const Node NODE_NONE= ~0U;
+
+	static Node add_node(Node after);
+	/* A new node without edges, placed directly after AFTER, or at
+	 * the beginning when AFTER is NODE_NONE */
+
+	static bool insert(Node from, Node to);
+	/* Insert the edge FROM->TO, unless it may close a cycle.
+	 * Return whether it may close a cycle, in which case the edge
+	 * is not inserted.  This is the case when FROM is reachable
+	 * from TO, or when both have been merged into the same node.  */
+
+	static void insert_cyclic(Node from, Node to);
+	/* Insert the edge FROM->TO after insert() returned true for
+	 * it.  The nodes of the cycle that is closed are merged into
+	 * one node.  */
+
+private:
+
+	struct Entry {
+		uint64_t label;
+
+		Node prev, next;
+		/* The neighboring nodes in the order, or NODE_NONE at
+		 * either end.  For a node that has been merged, PREV is
+		 * NODE_MERGED and NEXT is the node into which it was
+		 * merged.  */
+
+		unsigned successors;
+		/* Index of the first edge in EDGES, or EDGE_END */
+
+		bool mark;
+		/* Only set during insert() and insert_cyclic() */
+	};
+
+	struct Edge {
+		Node node;
+		unsigned next;
+		/* Index of the next edge from the same node, or EDGE_END */
+	};
+
+	static const Node NODE_MERGED= ~0U - 1;
+
+	static const unsigned EDGE_END= ~0U;
+
+	static const uint64_t LABEL_END= (uint64_t) 1 << 63;
+	/* Larger than all labels */
+
+	static const uint64_t LABEL_STEP= (uint64_t) 1 << 32;
+	/* Maximal distance of a new label from the previous one, such
+	 * that appending nodes does not use up the labels */
+
+	static const uint64_t LABEL_SPREAD= (uint64_t) 1 << 16;
+	/* Minimal distance between labels after relabeling, such that
+	 * many nodes can be inserted before the next relabeling */
+
+	static vector <Entry> entries;
+	/* Indexed by the node */
+
+	static vector <Edge> edges;
+	/* The successors of all nodes, linked by node.  Edges are
+	 * not removed when nodes are merged; they then lead to a node
+	 * that has been merged.  */
+
+	static Node first;
+	/* The first node in the order, or NODE_NONE */
+
+	static Node find(Node node);
+	/* The node into which NODE was merged, or NODE itself */
+
+	static void link(Node node, Node after);
+	/* Put NODE into the order directly after AFTER, or at the
+	 * beginning when AFTER is NODE_NONE, and give it a label */
+
+	static void unlink(Node node);
+	/* Remove NODE from the order */
+
+	static bool search(Node node, Node stop, bool complete,
+			   vector <Node> &found);
+	/* Depth-first search from NODE along the edges, visiting only
+	 * nodes whose labels are smaller than that of STOP.  Append
+	 * the visited nodes to FOUND, and mark them.  Return whether
+	 * STOP was reached; unless COMPLETE, return as soon as it
+	 * is.  */
+
+	static void move(vector <Node> &nodes, Node after);
+	/* Move NODES directly after AFTER, keeping their order */
+};
+
+const Topological_Order::Node Topological_Order::NODE_NONE;
+const Topological_Order::Node Topological_Order::NODE_MERGED;
+vector <Topological_Order::Entry> Topological_Order::entries;
+vector <Topological_Order::Edge> Topological_Order::edges;
+Topological_Order::Node Topological_Order::first= NODE_NONE;
+
+Topological_Order::Node Topological_Order::add_node(Node after)
+{
+	assert(after == NODE_NONE || after < entries.size());
+	if (entries.size() >= NODE_MERGED) {
+		print_error("Too many nodes in the dependency graph");
+		exit(ERROR_FATAL);
+	}
+
+	Node ret= entries.size();
+	entries.push_back({0, NODE_NONE, NODE_NONE, EDGE_END, false});
+	link(ret, after == NODE_NONE ? NODE_NONE : find(after));
+	return ret;
+}
+
+bool Topological_Order::insert(Node from, Node to)
+{
+	assert(from < entries.size() && to < entries.size());
+	from= find(from);
+	to= find(to);
+	if (from == to)
+		return true;
+
+	/* Avoid the most common duplicate edges, i.e., those that
+	 * are inserted repeatedly in a row.  Other duplicates are
+	 * harmless.  */
+	unsigned &successors= entries[from].successors;
+	if (successors != EDGE_END && edges[successors].node == to)
+		return false;
+
+	if (entries[to].label < entries[from].label) {
+		/* Nodes reachable from TO and before FROM */
+		vector <Node> nodes;
+		bool reached= search(to, from, false, nodes);
+		for (Node node:  nodes)
+			entries[node].mark= false;
+		if (reached)
+			return true;
+		move(nodes, from);
+	}
+
+	edges.push_back({to, successors});
+	successors= edges.size() - 1;
+	return false;
+}
+
+void Topological_Order::insert_cyclic(Node from, Node to)
+{
+	assert(from < entries.size() && to < entries.size());
+	from= find(from);
+	to= find(to);
+	if (from == to)
+		return;
+
+	/* The nodes of the cycle are those reachable from TO and
+	 * before FROM from which FROM is reachable.  Find them by
+	 * going through all nodes reachable from TO in reverse order,
+	 * which is a topological order of them.  */
+	vector <Node> nodes;
+	bool reached= search(to, from, true, nodes);
+	assert(reached);
+	(void) reached;
+	std::sort(nodes.begin(), nodes.end(), [](Node a, Node b) {
+			return entries[a].label > entries[b].label;
+		});
+	for (Node node:  nodes)
+		entries[node].mark= false;
+	entries[from].mark= true;
+	vector <Node> nodes_cycle, nodes_rest;
+	for (Node node:  nodes) {
+		for (unsigned e= entries[node].successors;  e != EDGE_END;  e= edges[e].next) {
+			if (entries[find(edges[e].node)].mark) {
+				entries[node].mark= true;
+				break;
+			}
+		}
+		if (entries[node].mark)
+			nodes_cycle.push_back(node);
+		else
+			nodes_rest.push_back(node);
+	}
+	entries[from].mark= false;
+
+	/* Merge the cycle into FROM, appending the edges */
+	unsigned *tail= &entries[from].successors;
+	while (*tail != EDGE_END)
+		tail= &edges[*tail].next;
+	for (Node node:  nodes_cycle) {
+		entries[node].mark= false;
+		*tail= entries[node].successors;
+		while (*tail != EDGE_END)
+			tail= &edges[*tail].next;
+		unlink(node);
+		entries[node].prev= NODE_MERGED;
+		entries[node].next= from;
+	}
+
+	move(nodes_rest, from);
+}
+
+Topological_Order::Node Topological_Order::find(Node node)
+{
+	while (entries[node].prev == NODE_MERGED) {
+		Node next= entries[node].next;
+		if (entries[next].prev == NODE_MERGED)
+			entries[node].next= entries[next].next;
+		node= next;
+	}
+	return node;
+}
+
+void Topological_Order::link(Node node, Node after)
+{
+	/* Find the smallest J such that the J-th node after AFTER
+	 * has a label larger than that of AFTER by more than J^2 times
+	 * LABEL_SPREAD, and spread the labels of the nodes in between
+	 * evenly.  This keeps the number of relabeled nodes small on
+	 * average.  */
+	const uint64_t label= after == NODE_NONE ? 0 : entries[after].label;
+	const Node next= after == NODE_NONE ? first : entries[after].next;
+	Node end= next;
+	uint64_t j= 1;
+	while (end != NODE_NONE
+	       && entries[end].label - label <= j * j * LABEL_SPREAD) {
+		end= entries[end].next;
+		++j;
+	}
+	if (end == NODE_NONE && LABEL_END - label <= j * j * LABEL_SPREAD) {
+		print_error("Too many nodes in the dependency graph");
+		exit(ERROR_FATAL);
+	}
+	const uint64_t gap= ((end == NODE_NONE ? LABEL_END : entries[end].label)
+			     - label) / j;
+	Node n= next;
+	for (uint64_t k= 1;  k < j;  ++k) {
+		entries[n].label= label + k * gap;
+		n= entries[n].next;
+	}
+
+	const uint64_t label_next= next == NODE_NONE
+		? LABEL_END : entries[next].label;
+	assert(label_next - label >= 2);
+	uint64_t step= (label_next - label) / 2;
+	if (step > LABEL_STEP)
+		step= LABEL_STEP;
+
+	Entry &entry= entries[node];
+	entry.label= label + step;
+	entry.prev= after;
+	entry.next= next;
+	if (after == NODE_NONE)
+		first= node;
+	else
+		entries[after].next= node;
+	if (next != NODE_NONE)
+		entries[next].prev= node;
+}
+
+void Topological_Order::unlink(Node node)
+{
+	const Node prev= entries[node].prev;
+	const Node next= entries[node].next;
+	if (prev == NODE_NONE)
+		first= next;
+	else
+		entries[prev].next= next;
+	if (next != NODE_NONE)
+		entries[next].prev= prev;
+}
+
+bool Topological_Order::search(Node node, Node stop, bool complete,
+			       vector <Node> &found)
+{
+	const uint64_t bound= entries[stop].label;
+	bool reached= false;
+	vector <Node> stack;
+	stack.push_back(node);
+	entries[node].mark= true;
+	found.push_back(node);
+	while (! stack.empty()) {
+		Node n= stack.back();
+		stack.pop_back();
+		for (unsigned e= entries[n].successors;  e != EDGE_END;  e= edges[e].next) {
+			Node m= find(edges[e].node);
+			if (m == stop) {
+				if (! complete)
+					return true;
+				reached= true;
+				continue;
+			}
+			Entry &entry= entries[m];
+			if (entry.mark || entry.label > bound)
+				continue;
+			entry.mark= true;
+			found.push_back(m);
+			stack.push_back(m);
+		}
+	}
+	return reached;
+}
+
+void Topological_Order::move(vector <Node> &nodes, Node after)
+{
+	std::sort(nodes.begin(), nodes.end(), [](Node a, Node b) {
+			return entries[a].label < entries[b].label;
+		});
+	for (Node node:  nodes)
+		unlink(node);
+	for (Node node:  nodes) {
+		link(node, after);
+		after= node;
+	}
+}
+
+#endif /* ! ORDER_HH */
@@ -2,7 +2,7 @@
 #define PARSER_HH
 
 /* 
- * Code for generating rules from a vector of tokens, i.e, for
+ * Code for generating rules from a list of tokens, i.e, for
  * performing the parsing of Stu syntax beyond tokenization.  This is a
  * recursive descent parser written by hand.
  */ 
@@ -70,11 +70,19 @@ public:
 	 * operator.  */ 
 
 	static void get_rule_list(vector <shared_ptr <const Rule> > &rules,
-				  vector <shared_ptr <Token> > &tokens,
-				  const Place &place_end);
-
-	static void get_expression_list(vector <shared_ptr <const Dep> > &deps,
-					vector <shared_ptr <Token> > &tokens,
+				  Token_List &tokens,
+				  const Place &place_end,
+				  Rule_Bodies *bodies= nullptr);
+	/* In lazy mode (-l), BODIES is not null, and the dependencies
+	 * of the rules are not parsed, but put into BODIES.  */
+
+	static shared_ptr <const Rule> get_rule_deps(const Rule &rule,
+						     Rule_Body &body);
+	/* Return RULE with the dependencies from BODY, as kept in lazy
+	 * mode */
+
+	static void get_expression_list(vector <Ref <const Dep> > &deps,
+					Token_List &tokens,
 					const Place &place_end,
 					Place_Name &input,
 					Place &place_input);
@@ -82,29 +90,34 @@ public:
 	 * TARGET is used for error messages.  Empty when in a dynamic
 	 * dependency.  */
 
-	static shared_ptr <const Dep> get_target_dep(string text, const Place &place); 
+	static Ref <const Dep> get_target_dep(string text, const Place &place); 
 	/* Parse a dependency as given on the command line outside of
 	 * options.  This supports only the characters '@' and '[]', as
 	 * well as names.  TEXT must not be "".  */
 
 private:
 
-	vector <shared_ptr <Token> > &tokens;
-	vector <shared_ptr <Token> > ::iterator &iter;
+	Token_List &tokens;
+	Token_List::iterator &iter;
 	const Place place_end; 
 
-	Parser(vector <shared_ptr <Token> > &tokens_,
-	       vector <shared_ptr <Token> > ::iterator &iter_,
+	Rule_Bodies *bodies;
+	/* Non-null in lazy mode, when the dependencies of rules are not
+	 * parsed */ 
+
+	Parser(Token_List &tokens_,
+	       Token_List::iterator &iter_,
 	       const Place &place_end_)
 		:  tokens(tokens_),
 		   iter(iter_),
-		   place_end(place_end_)
+		   place_end(place_end_),
+		   bodies(nullptr)
 	{ }
 	
 	void parse_rule_list(vector <shared_ptr <const Rule> > &ret);
 	/* The returned rules may not be unique -- this is checked later */ 
 
-	bool parse_expression_list(vector <shared_ptr <const Dep> > &ret, 
+	bool parse_expression_list(vector <Ref <const Dep> > &ret, 
 				   Place_Name &place_name_input,
 				   Place &place_input,
 				   const vector <shared_ptr <const Place_Param_Target> > &targets);
@@ -113,7 +126,15 @@ private:
 	shared_ptr <const Rule> parse_rule(); 
 	/* Return null when nothing was parsed */ 
 
-	bool parse_expression(shared_ptr <const Dep> &ret,
+	unique_ptr <Rule_Body> skip_expression_list(); 
+	/* Skip the tokens that may be part of an expression list, and
+	 * return a copy of them, followed by the token that ends
+	 * them.  Return null and skip nothing when there are no
+	 * such tokens, or when they are not followed by a command, 
+	 * ';' or '%', i.e., when the rule contains a syntax error that
+	 * must be reported now.  Used in lazy mode.  */
+
+	bool parse_expression(Ref <const Dep> &ret,
 			      Place_Name &place_name_input,
 			      Place &place_input,
 			      const vector <shared_ptr <const Place_Param_Target> > &targets);
@@ -122,13 +143,13 @@ private:
 	 * was parsed.  TARGETS is passed to construct error
 	 * messages.  */
 
-	shared_ptr <const Dep> parse_variable_dep
+	Ref <const Dep> parse_variable_dep
 	(Place_Name &place_name_input,
 	 Place &place_input,
 	 const vector <shared_ptr <const Place_Param_Target> > &targets);
 	/* A variable dependency */ 
 
-	shared_ptr <const Dep> parse_redirect_dep
+	Ref <const Dep> parse_redirect_dep
 	(Place_Name &place_name_input,
 	 Place &place_input,
 	 const vector <shared_ptr <const Place_Param_Target> > &targets);
@@ -136,11 +157,10 @@ private:
 	/* If the next token is of type T, return it, otherwise return
 	 * null.  Also return null when at the end of the token list.  */
 	template <typename T>
-	shared_ptr <T> is() const {
-		if (iter == tokens.end())
+	T *is() const {
+		if (iter == tokens.end() || (*iter)->kind != T::KIND)
 			return nullptr;
-		else 
-			return dynamic_pointer_cast <T> (*iter); 
+		return static_cast <T *> (*iter); 
 	}
 
 	/* Whether the next token is the given operator */ 
@@ -158,7 +178,7 @@ private:
 	 * current token.  The current token is assumed to be a
 	 * candidate for concatenation.  */
 	
-	static void print_separation_message(shared_ptr <const Token> token); 
+	static void print_separation_message(const Token *token); 
 
 	static void append_copy(      Name &to,
 				const Name &from);
@@ -273,7 +293,7 @@ shared_ptr <const Rule> Parser::parse_rule()
 		}
 
 		/* Target */ 
-		shared_ptr <Name_Token> target_name= is <Name_Token> ();
+		Name_Token *target_name= is <Name_Token> ();
 		++iter;
 
 		if (! place_output_new.empty()) {
@@ -318,7 +338,7 @@ shared_ptr <const Rule> Parser::parse_rule()
 		}
 
 		shared_ptr <const Place_Param_Target> place_param_target= make_shared <Place_Param_Target>
-			(flags_type, *target_name, place_target);
+			(flags_type, move(*target_name), place_target);
 
 		place_param_targets.push_back(place_param_target); 
 	}
@@ -361,7 +381,10 @@ shared_ptr <const Rule> Parser::parse_rule()
 		throw ERROR_LOGICAL;
 	}
 
-	vector <shared_ptr <const Dep> > deps;
+	vector <Ref <const Dep> > deps;
+
+	unique_ptr <Rule_Body> body;
+	/* Instead of DEPS in lazy mode */ 
 
 	bool had_colon= false;
 
@@ -372,12 +395,45 @@ shared_ptr <const Rule> Parser::parse_rule()
 	if (is_operator(':')) {
 		had_colon= true; 
 		++iter; 
-		parse_expression_list(deps, 
-				      filename_input, 
-				      place_input, 
-				      place_param_targets); 
+		if (bodies != nullptr) 
+			body= skip_expression_list(); 
+		if (body == nullptr)
+			parse_expression_list(deps, 
+					      filename_input, 
+					      place_input, 
+					      place_param_targets); 
 	} 
 
+	/* Pool */ 
+	Pool *pool= nullptr;
+	if (is_operator('%')) {
+		Place place_percent= (*iter)->get_place(); 
+		++iter;
+		assert(iter != tokens.end()); 
+		const Name_Token *name_pool= is <Name_Token> ();
+		assert(name_pool != nullptr); 
+		++iter;
+		pool= Pool::get(name_pool->unparametrized()); 
+		if (pool == nullptr) {
+			name_pool->get_place() <<
+				fmt("pool %s is not declared",
+				    name_pool->format_word());
+			place_percent << frmt("after %s%%pool%s",
+					      Color::word, Color::end); 
+			throw ERROR_LOGICAL;
+		}
+		if (iter == tokens.end() || ! is <Command_Token> ()) {
+			(iter == tokens.end() ? place_end : (*iter)->get_place())
+				<< (iter == tokens.end()
+				    ? fmt("expected a command")
+				    : fmt("expected a command, not %s",
+					  (*iter)->format_start_word()));
+			place_percent << frmt("after %s%%pool%s",
+					      Color::word, Color::end); 
+			throw ERROR_LOGICAL;
+		}
+	}
+
 	/* Command */ 
 	if (iter == tokens.end()) {
 		if (had_colon)
@@ -393,7 +449,7 @@ shared_ptr <const Rule> Parser::parse_rule()
 		throw ERROR_LOGICAL;
 	}
 
-	shared_ptr <Command> command;
+	shared_ptr <const Command> command;
 	/* Remains null when there is no command */ 
 
 	bool is_hardcode;
@@ -406,10 +462,11 @@ shared_ptr <const Rule> Parser::parse_rule()
 	Place place_equal;
 	/* Place of '=' */
 
-	shared_ptr <Name_Token> name_copy;
+	Name_Token *name_copy= nullptr;
 	/* Name of the copy-from file */ 
 
-	if ((command= is <Command> ())) {
+	if (is <Command_Token> ()) {
+		command= is <Command_Token> ()->command; 
 		++iter; 
 		is_hardcode= false;
 	} else if (! had_colon && is_operator('=')) {
@@ -424,8 +481,9 @@ shared_ptr <const Rule> Parser::parse_rule()
 			throw ERROR_LOGICAL;
 		}
 
-		if ((command= is <Command> ())) {
+		if (is <Command_Token> ()) {
 			/* Hardcoded content */ 
+			command= is <Command_Token> ()->command; 
 			++iter; 
 			assert(place_param_targets.size() != 0); 
 			if (place_param_targets.size() != 1) {
@@ -454,7 +512,7 @@ shared_ptr <const Rule> Parser::parse_rule()
 			Place place_flag_optional; 
 
 			while (is <Flag_Token> ()) {
-				shared_ptr <Flag_Token> flag= is <Flag_Token> ();
+				const Flag_Token *flag= is <Flag_Token> ();
 				if (flag->flag == 'p') {
 					place_flag_persistent= flag->get_place();
 					++iter;
@@ -574,7 +632,7 @@ shared_ptr <const Rule> Parser::parse_rule()
 			 * in slash */
 			append_copy(*name_copy, place_param_targets[0]->place_name); 
 
-			return make_shared <const Rule> (place_param_targets[0], name_copy,
+			return make_shared <const Rule> (place_param_targets[0], *name_copy,
 							 place_flag_persistent,
 							 place_flag_optional);
 		}
@@ -641,15 +699,45 @@ shared_ptr <const Rule> Parser::parse_rule()
 		}
 	}
 
-	return make_shared <const Rule> 
+	auto ret= make_shared <const Rule> 
 		(move(place_param_targets), 
 		 deps, 
 		 command, is_hardcode, 
 		 redirect_index,
-		 filename_input);
+		 filename_input,
+		 pool);
+
+	/* In lazy mode, the input redirection is checked when the
+	 * dependencies are parsed */ 
+	if (body != nullptr) {
+		body->place_nocommand= place_nocommand; 
+		(*bodies)[ret.get()]= move(body); 
+	}
+
+	return ret; 
+}
+
+unique_ptr <Rule_Body> Parser::skip_expression_list()
+{
+	/* Dependencies consist of names, flags and the operators
+	 * '()[]@<$='.  Any other token ends the list.  */
+	const auto iter_begin= iter;
+	while (iter != tokens.end() &&
+	       (is <Name_Token> () || is <Flag_Token> () ||
+		(is <Operator> () && strchr("()[]@<$=", is <Operator> ()->op))))
+		++iter;
+
+	if (iter == iter_begin ||
+	    ! (is <Command_Token> () || is_operator(';') || is_operator('%'))) {
+		iter= iter_begin;
+		return nullptr;
+	}
+
+	return unique_ptr <Rule_Body> 
+		(new Rule_Body(iter_begin, iter + 1, place_end)); 
 }
 
-bool Parser::parse_expression_list(vector <shared_ptr <const Dep> > &ret, 
+bool Parser::parse_expression_list(vector <Ref <const Dep> > &ret, 
 				   Place_Name &place_name_input,
 				   Place &place_input,
 				   const vector <shared_ptr <const Place_Param_Target> > &targets)
@@ -657,7 +745,7 @@ bool Parser::parse_expression_list(vector <shared_ptr <const Dep> > &ret,
 	assert(ret.size() == 0);
 
 	while (iter != tokens.end()) {
-		shared_ptr <const Dep> ret_new; 
+		Ref <const Dep> ret_new; 
 		bool r= parse_expression(ret_new, 
 					 place_name_input, 
 					 place_input, targets);
@@ -672,7 +760,7 @@ bool Parser::parse_expression_list(vector <shared_ptr <const Dep> > &ret,
 	return ! ret.empty(); 
 }
 
-bool Parser::parse_expression(shared_ptr <const Dep> &ret,
+bool Parser::parse_expression(Ref <const Dep> &ret,
 			      Place_Name &place_name_input,
 			      Place &place_input,
 			      const vector <shared_ptr <const Place_Param_Target> > &targets)
@@ -683,11 +771,11 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 	if (is_operator('(')) {
 		Place place_paren= (*iter)->get_place();
 		++iter;
-		vector <shared_ptr <const Dep> > r;
+		vector <Ref <const Dep> > r;
 		if (parse_expression_list(r, place_name_input, place_input, targets)) {
 			assert(r.size() >= 1); 
 			if (r.size() > 1) {
-				ret= make_shared <Compound_Dep> (move(r), place_paren); 
+				ret= make_dep <Compound_Dep> (move(r), place_paren); 
 			} else {
 				ret= move(r.at(0)); 
 			}
@@ -713,16 +801,16 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 		/* If RET is null, it means we had empty parentheses.
 		 * Return an empty Compound_Dependency in that case  */ 
 		if (ret == nullptr) {
-			ret= make_shared <Compound_Dep> (place_paren); 
+			ret= make_dep <Compound_Dep> (place_paren); 
 		}
 
 		if (next_concatenates()) {
-			shared_ptr <const Dep> next;
+			Ref <const Dep> next;
 			bool rr= parse_expression(next, place_name_input, place_input, targets);
 			/* It can be that an empty list was parsed, in
 			 * which case RR is true but the list is empty */
 			if (rr && next != nullptr) {
-				shared_ptr <Concat_Dep> ret_new= make_shared <Concat_Dep> ();
+				Ref <Concat_Dep> ret_new= make_dep <Concat_Dep> ();
 				ret_new->push_back(ret);
 				ret_new->push_back(next);
 				ret.reset();
@@ -737,7 +825,7 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 	if (is_operator('[')) {
 		Place place_bracket= (*iter)->get_place(); 
 		++iter;	
-		vector <shared_ptr <const Dep> > r2;
+		vector <Ref <const Dep> > r2;
 		parse_expression_list(r2, place_name_input, place_input, targets);
 
 		if (iter == tokens.end()) {
@@ -756,8 +844,8 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 			throw ERROR_LOGICAL;
 		}
 		++ iter; 
-		shared_ptr <Compound_Dep> ret_nondynamic= 
-			make_shared <Compound_Dep> (place_bracket); 
+		Ref <Compound_Dep> ret_nondynamic= 
+			make_dep <Compound_Dep> (place_bracket); 
 		for (auto &j:  r2) {
 			
 			/* Variable dependency cannot appear within
@@ -774,16 +862,16 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 
 			ret_nondynamic->push_back(j);
 		}
-		ret= make_shared <Dynamic_Dep> (0, ret_nondynamic); 
+		ret= make_dep <Dynamic_Dep> (0, ret_nondynamic); 
 
 		if (next_concatenates()) {
-			shared_ptr <const Dep> next;
+			Ref <const Dep> next;
 			bool rr= parse_expression(next, place_name_input, place_input, targets);
 			/* It can be that an empty list was parsed, in
 			 * which case RR is true but the list is empty */
 			if (rr && next != nullptr) {
-				shared_ptr <Concat_Dep> ret_new=
-					make_shared <Concat_Dep> ();
+				Ref <Concat_Dep> ret_new=
+					make_dep <Concat_Dep> ();
 				ret_new->push_back(ret);
 				ret_new->push_back(next);
 				ret.reset();
@@ -794,7 +882,7 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 		/* If RET is null, it means we had empty parentheses.
 		 * Return an empty Compound_Dependency in that case  */ 
 		if (ret == nullptr) {
-			ret= make_shared <Compound_Dep> (place_bracket); 
+			ret= make_dep <Compound_Dep> (place_bracket); 
 		}
 
 		return true; 
@@ -837,7 +925,7 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 		/* Add the flag */ 
 		if (! ((i_flag == I_OPTIONAL && option_nonoptional) ||
 		       (i_flag == I_TRIVIAL  && option_nontrivial))) {
-			shared_ptr <Dep> ret_new= Dep::clone(ret);
+			Ref <Dep> ret_new= Dep::clone(ret);
 			ret_new->flags |= (1 << i_flag); 
 			assert(i_flag < C_WORD); 
 			if (i_flag < C_PLACED)
@@ -849,7 +937,7 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 	}
 
 	/* '$' ; variable dependency */ 
-	shared_ptr <const Dep> dep= 
+	Ref <const Dep> dep= 
 		parse_variable_dep(place_name_input, place_input, targets);
 	if (dep != nullptr) {
 		ret= dep; 
@@ -866,14 +954,14 @@ bool Parser::parse_expression(shared_ptr <const Dep> &ret,
 	return false;
 }
 
-shared_ptr <const Dep> Parser
+Ref <const Dep> Parser
 ::parse_variable_dep(Place_Name &place_name_input, 
 		     Place &place_input,
 		     const vector <shared_ptr <const Place_Param_Target> > &targets)
 {
 	bool has_input= false;
 
-	shared_ptr <const Dep> ret;
+	Ref <const Dep> ret;
 
 	if (! is_operator('$')) 
 		return nullptr;
@@ -956,7 +1044,7 @@ shared_ptr <const Dep> Parser
 
 		throw ERROR_LOGICAL;
 	}
-	shared_ptr <Place_Name> place_name= is <Name_Token> ();
+	Place_Name *place_name= is <Name_Token> ();
 	++iter;
 
 	if (has_input && ! place_name_input.empty()) {
@@ -1051,15 +1139,14 @@ shared_ptr <const Dep> Parser
 	/* The place of the variable dependency as a whole is set on the
 	 * name contained in it.  It would be conceivable to also set it
 	 * on the dollar sign.  */
-	return make_shared <Plain_Dep> 
+	return make_dep <Plain_Dep> 
 		(flags, 
 		 places_flags,
-		 Place_Param_Target(0, *place_name, 
-				    place_name->place), 
+		 Place_Param_Target(0, move(*place_name)), 
 		 variable_name);
 }
 
-shared_ptr <const Dep> Parser::parse_redirect_dep
+Ref <const Dep> Parser::parse_redirect_dep
 (Place_Name &place_name_input,
  Place &place_input,
  const vector <shared_ptr <const Place_Param_Target> > &targets)
@@ -1126,7 +1213,7 @@ shared_ptr <const Dep> Parser::parse_redirect_dep
 		}
 	}
 
-	shared_ptr <Name_Token> name_token= is <Name_Token> ();
+	Name_Token *name_token= is <Name_Token> ();
 	++iter; 
 
 	if (has_input && ! place_name_input.empty()) {
@@ -1158,20 +1245,21 @@ shared_ptr <const Dep> Parser::parse_redirect_dep
 	}
 
 	Flags transient_bit= has_transient ? F_TARGET_TRANSIENT : 0;
-	shared_ptr <const Dep> ret= make_shared <Plain_Dep>
+	const Place place_target= has_transient ? place_at : name_token->place; 
+	Ref <const Dep> ret= make_dep <Plain_Dep>
 		(flags | transient_bit,
 		 Place_Param_Target(transient_bit,
-				    *name_token,
-				    has_transient ? place_at : name_token->place)); 
+				    move(*name_token),
+				    place_target)); 
 
 	if (next_concatenates()) {
-		shared_ptr <const Dep> next;
+		Ref <const Dep> next;
 		bool rr= parse_expression(next, place_name_input, place_input, targets);
 		/* It can be that an empty list was parsed, in
 		 * which case RR is true but the list is empty */
 		if (rr && next != nullptr) {
-			shared_ptr <Concat_Dep> ret_new=
-				make_shared <Concat_Dep> ();
+			Ref <Concat_Dep> ret_new=
+				make_dep <Concat_Dep> ();
 			ret_new->push_back(ret);
 			ret_new->push_back(next);
 			ret.reset();
@@ -1215,12 +1303,14 @@ void Parser::append_copy(      Name &to,
 }
 
 void Parser::get_rule_list(vector <shared_ptr <const Rule> > &rules,
-			  vector <shared_ptr <Token> > &tokens,
-			  const Place &place_end)
+			  Token_List &tokens,
+			  const Place &place_end,
+			  Rule_Bodies *bodies)
 {
 	auto iter= tokens.begin(); 
 
 	Parser parser(tokens, iter, place_end);
+	parser.bodies= bodies; 
 
 	parser.parse_rule_list(rules); 
 
@@ -1232,8 +1322,56 @@ void Parser::get_rule_list(vector <shared_ptr <const Rule> > &rules,
 	}
 }
 
-void Parser::get_expression_list(vector <shared_ptr <const Dep> > &deps,
-				vector <shared_ptr <Token> > &tokens,
+shared_ptr <const Rule> Parser::get_rule_deps(const Rule &rule,
+					      Rule_Body &body)
+{
+	vector <Ref <const Dep> > deps;
+	Place_Name filename_input;
+	Place place_input;
+	auto iter= body.tokens.begin(); 
+	Parser parser(body.tokens, iter, body.place_end); 
+	parser.parse_expression_list(deps, filename_input, place_input,
+				     rule.place_param_targets); 
+
+	/* The same error as in parse_rule() */
+	assert(iter != body.tokens.end()); 
+	if (iter + 1 != body.tokens.end()) {
+		(*iter)->get_place() <<
+			fmt("expected a dependency, a command, or %s, not %s", 
+			    char_format_word(';'),
+			    (*iter)->format_start_word());
+		rule.place_param_targets[0]->place <<
+			fmt("for target %s", 
+			    rule.place_param_targets[0]->format_word());
+		throw ERROR_LOGICAL;
+	}
+
+	/* Cases where input redirection is not possible */ 
+	if (! filename_input.empty()) {
+		if (rule.command == nullptr) {
+			place_input <<
+				fmt("input redirection using %s must not be used",
+				     char_format_word('<'));
+			body.place_nocommand <<
+				fmt("in rule for %s without a command",
+				    rule.place_param_targets[0]->format_word()); 
+			throw ERROR_LOGICAL;
+		} else {
+			assert(! rule.is_hardcode); 
+		}
+	}
+
+	return make_shared <const Rule> 
+		(vector <shared_ptr <const Place_Param_Target> > (rule.place_param_targets), 
+		 deps, 
+		 rule.command, rule.is_hardcode, 
+		 rule.redirect_index,
+		 filename_input,
+		 rule.pool);
+}
+
+void Parser::get_expression_list(vector <Ref <const Dep> > &deps,
+				Token_List &tokens,
 				const Place &place_end,
 				Place_Name &input,
 				Place &place_input)
@@ -1250,7 +1388,7 @@ void Parser::get_expression_list(vector <shared_ptr <const Dep> > &deps,
 	}
 }
 
-shared_ptr <const Dep> Parser::get_target_dep(string text, const Place &place)
+Ref <const Dep> Parser::get_target_dep(string text, const Place &place)
 /*
  * This syntax supports only the characters '@' and '[]', and a single
  * name, without whitespace.  Thus, the syntax is:
@@ -1304,7 +1442,7 @@ shared_ptr <const Dep> Parser::get_target_dep(string text, const Place &place)
 		throw ERROR_LOGICAL; 
 	}
 
-	shared_ptr <const Dep> ret= make_shared <Plain_Dep> 
+	Ref <const Dep> ret= make_dep <Plain_Dep> 
 		(flags_type, Place_Param_Target
 		 (flags_type, 
 		  Place_Name
@@ -1313,7 +1451,7 @@ shared_ptr <const Dep> Parser::get_target_dep(string text, const Place &place)
 
 	while (q != begin) {
 		if (q[-1] == '[') {
-			ret= make_shared <Dynamic_Dep> (0, ret);
+			ret= make_dep <Dynamic_Dep> (0, ret);
 			-- closing;
 		} else {
 			assert(false); 
@@ -1334,15 +1472,15 @@ shared_ptr <const Dep> Parser::get_target_dep(string text, const Place &place)
 	return ret; 
 }
 
-void Parser::print_separation_message(shared_ptr <const Token> token)
+void Parser::print_separation_message(const Token *token)
 {
 	string text;
 
-	if (dynamic_pointer_cast <const Name_Token> (token)) {
+	if (token->kind == Token::K_NAME) {
 		text= fmt("token %s",
-			  dynamic_pointer_cast <const Name_Token> (token)->format_word()); 
-	} else if (dynamic_pointer_cast <const Operator> (token)) {
-		text= dynamic_pointer_cast <const Operator> (token)->format_long_word(); 
+			  static_cast <const Name_Token *> (token)->format_word()); 
+	} else if (token->kind == Token::K_OPERATOR) {
+		text= static_cast <const Operator *> (token)->format_long_word(); 
 	} else {
 		assert(false);
 	}
@@ -1370,4 +1508,29 @@ bool Parser::next_concatenates() const
 	return op == '(' || op == '['; 
 }
 
+shared_ptr <const Rule> Rule_Set::parse(const shared_ptr <const Rule> &rule)
+{
+	if (bodies.empty() && rules_parsed.empty())
+		return rule; 
+
+	auto i= rules_parsed.find(rule.get());
+	if (i != rules_parsed.end()) {
+		if (i->second == nullptr)
+			throw ERROR_LOGICAL; 
+		return i->second; 
+	}
+
+	auto j= bodies.find(rule.get());
+	if (j == bodies.end())
+		return rule; 
+
+	/* The body is dropped even when it is invalid, in which case
+	 * the rule remains null */ 
+	unique_ptr <Rule_Body> body= move(j->second);
+	bodies.erase(j); 
+	shared_ptr <const Rule> &ret= rules_parsed[rule.get()]; 
+	ret= Parser::get_rule_deps(*rule, *body); 
+	return ret; 
+}
+
 #endif /* ! PARSER_HH */
@@ -0,0 +1,77 @@
+#ifndef POOL_HH
+#define POOL_HH
+
+/*
+ * Pools of job slots.  A pool is declared with the %pool directive,
+ * giving its name and its number of slots, and a rule is put into a
+ * pool by using the directive with only the name of the pool before
+ * its command.  At most that number of jobs of rules in the pool are
+ * run at the same time, in addition to the limit given by -j.  Pools
+ * exist for the whole runtime of Stu.
+ */
+
+#include <memory>
+#include <unordered_map>
+
+class Pool
+{
+public:
+
+	const string name;
+
+	const long size;
+	/* The number of slots; positive */
+
+	const Place place;
+	/* Where the pool was declared */
+
+	long free;
+	/* Number of free slots; changed by File_Execution */
+
+	Pool(const string &name_, long size_, const Place &place_)
+		:  name(name_),
+		   size(size_),
+		   place(place_),
+		   free(size_)
+	{  }
+
+	static Pool *get(const string &name);
+	/* The pool with the given name, or null when it was not
+	 * declared */
+
+	static void declare(const string &name, long size, const Place &place);
+	/* Declare a pool.  A pool may be declared multiple times, but
+	 * only with the same size.  */
+
+private:
+
+	static unordered_map <string, unique_ptr <Pool> > pools;
+};
+
+unordered_map <string, unique_ptr <Pool> > Pool::pools;
+
+Pool *Pool::get(const string &name)
+{
+	auto i= pools.find(name);
+	return i == pools.end() ? nullptr : i->second.get();
+}
+
+void Pool::declare(const string &name, long size, const Place &place)
+{
+	assert(size > 0);
+	Pool *pool= get(name);
+	if (pool == nullptr) {
+		pools[name]= unique_ptr <Pool> (new Pool(name, size, place));
+		return;
+	}
+	if (pool->size != size) {
+		place << fmt("pool %s must not be declared with %s slots",
+			     name_format_word(name),
+			     name_format_word(frmt("%ld", size)));
+		pool->place << fmt("because it was already declared with %s slots",
+				   name_format_word(frmt("%ld", pool->size)));
+		throw ERROR_LOGICAL;
+	}
+}
+
+#endif /* ! POOL_HH */
@@ -0,0 +1,213 @@
+#ifndef PRELOAD_HH
+#define PRELOAD_HH
+
+/*
+ * Reading of input files in advance.  When a Stu script includes many
+ * other files, opening and reading them one after the other dominates
+ * the startup time on slow storage, e.g. over the network.  Therefore,
+ * before a script is tokenized, the files it includes directly or
+ * indirectly are opened, mapped and faulted into memory by a small
+ * number of threads (see Tokenizer::preload()).  The threads only call
+ * system functions, and are finished before Stu continues.
+ *
+ * The files are then tokenized one after the other on the main thread
+ * as usual, taking the preloaded content instead of reading each
+ * file.  Files that could not be preloaded are simply read again, such
+ * that all errors are reported exactly as without preloading.  Only
+ * non-empty regular files are preloaded.
+ */
+
+#include <signal.h>
+#include <sys/mman.h>
+
+#include <atomic>
+#include <system_error>
+#include <thread>
+
+const char *const FILENAME_INPUT_DEFAULT= "main.stu";
+/* The default filename read  */
+
+class Preload
+{
+public:
+
+	struct File
+	{
+		string filename;
+		/* As given, or with "/main.stu" appended when the given
+		 * name is a directory */
+
+		struct stat buf;
+
+		const char *in;
+		size_t in_size;
+		/* The content, mapped with mmap() */
+	};
+
+	static void load(const string &filename, int fd);
+	/* Preload the file FILENAME on the current thread.  If FD is
+	 * not -1, it is that file already opened; it is not closed.  */
+
+	static void load(const vector <string> &filenames);
+	/* Preload the given files using multiple threads */
+
+	static const File *get(const string &filename);
+	/* The file FILENAME if it was preloaded, or null */
+
+	static bool take(const string &filename, File &file);
+	/* If the file FILENAME was preloaded, move it into FILE and
+	 * return true.  The caller must then munmap() the content.  */
+
+	static void clear();
+	/* Release all files that were not taken */
+
+private:
+
+	static const size_t THREADS= 8;
+	/* Maximal number of threads used to preload files */
+
+	static unordered_map <string, File> files;
+
+	static bool load_file(const string &filename, int fd, File &file);
+	/* Open, map and read the file into FILE.  Return false if the
+	 * file cannot be preloaded, leaving nothing to release.  Called
+	 * concurrently, and therefore only calls system functions.  */
+};
+
+unordered_map <string, Preload::File> Preload::files;
+
+void Preload::load(const string &filename, int fd)
+{
+	if (files.count(filename))
+		return;
+	File file;
+	if (load_file(filename, fd, file))
+		files[filename]= file;
+}
+
+void Preload::load(const vector <string> &filenames)
+{
+	vector <File> loaded(filenames.size());
+	vector <char> success(filenames.size(), 0);
+	std::atomic <size_t> index(0);
+
+	auto work= [&]() {
+		size_t i;
+		while ((i= index++) < filenames.size())
+			success[i]= load_file(filenames[i], -1, loaded[i]);
+	};
+
+	/* The threads must not receive signals that are meant for
+	 * the main thread, and inherit the signal mask */
+	sigset_t set_all, set_old;
+	sigfillset(&set_all);
+	if (0 != pthread_sigmask(SIG_SETMASK, &set_all, &set_old)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+	vector <std::thread> threads;
+	while (threads.size() + 1 < THREADS && threads.size() + 1 < filenames.size()) {
+		try {
+			threads.emplace_back(work);
+		} catch (std::system_error &) {
+			/* Continue with the threads that could be
+			 * created */
+			break;
+		}
+	}
+	if (0 != pthread_sigmask(SIG_SETMASK, &set_old, nullptr)) {
+		perror("pthread_sigmask");
+		exit(ERROR_FATAL);
+	}
+
+	work();
+	for (std::thread &thread:  threads)
+		thread.join();
+
+	for (size_t i= 0;  i < filenames.size();  ++i) {
+		if (! success[i])
+			continue;
+		if (files.count(filenames[i]))
+			munmap((void *) loaded[i].in, loaded[i].in_size);
+		else
+			files[filenames[i]]= loaded[i];
+	}
+}
+
+const Preload::File *Preload::get(const string &filename)
+{
+	auto i= files.find(filename);
+	return i == files.end() ? nullptr : &i->second;
+}
+
+bool Preload::take(const string &filename, File &file)
+{
+	auto i= files.find(filename);
+	if (i == files.end())
+		return false;
+	file= i->second;
+	files.erase(i);
+	return true;
+}
+
+void Preload::clear()
+{
+	for (auto &i:  files)
+		munmap((void *) i.second.in, i.second.in_size);
+	files.clear();
+}
+
+bool Preload::load_file(const string &filename, int fd, File &file)
+{
+	int fd_file= fd >= 0 ? fd : open(filename.c_str(), O_RDONLY);
+	if (fd_file < 0)
+		return false;
+	file.filename= filename;
+	file.in= nullptr;
+
+	if (fstat(fd_file, &file.buf) < 0)
+		goto end;
+
+	/* A directory stands for the file "main.stu" in it, as in
+	 * Tokenizer::parse_tokens_file() */
+	if (S_ISDIR(file.buf.st_mode)) {
+		if (file.filename[file.filename.size() - 1] != '/')
+			file.filename += '/';
+		file.filename += FILENAME_INPUT_DEFAULT;
+		int fd2= openat(fd_file, FILENAME_INPUT_DEFAULT, O_RDONLY);
+		if (fd2 < 0)
+			goto end;
+		if (fd_file != fd)
+			close(fd_file);
+		fd_file= fd2;
+		if (fstat(fd_file, &file.buf) < 0)
+			goto end;
+	}
+
+	/* Other files, e.g. pipes, cannot be read twice */
+	if (! S_ISREG(file.buf.st_mode) || file.buf.st_size == 0)
+		goto end;
+
+	file.in_size= file.buf.st_size;
+	file.in= (const char *) mmap(nullptr, file.in_size,
+				     PROT_READ, MAP_SHARED, fd_file, 0);
+	if (file.in == MAP_FAILED) {
+		file.in= nullptr;
+		goto end;
+	}
+
+	/* Touch each page, such that it is read now by this thread,
+	 * rather than later when the file is tokenized */
+	{
+		const size_t size_page= sysconf(_SC_PAGESIZE);
+		for (size_t i= 0;  i < file.in_size;  i += size_page)
+			(void) ((const volatile char *) file.in)[i];
+	}
+
+ end:
+	if (fd_file != fd)
+		close(fd_file);
+	return file.in != nullptr;
+}
+
+#endif /* ! PRELOAD_HH */
@@ -0,0 +1,260 @@
+#ifndef PRESSURE_HH
+#define PRESSURE_HH
+
+/*
+ * Admission control based on the load of the system, used with the -L
+ * option.  Before starting a job, Stu checks whether the system is
+ * under memory or CPU pressure, as given by the pressure stall
+ * information (PSI) of Linux in /proc/pressure/, or whether little
+ * memory is available, as given in /proc/meminfo.  If so, the job is
+ * held back until the pressure drops.  At least one job is always
+ * running.  Sources of information that are not available are
+ * ignored.  The directory /proc can be replaced by setting $STU_PROC,
+ * which is used for testing.
+ *
+ * The pressure is measured as the fraction of time during which at
+ * least one task was stalled (the "some" line), computed from the
+ * cumulative stall times since the previous measurement.  This reacts
+ * faster than the averages over ten seconds given by the kernel.
+ */
+
+#include <fcntl.h>
+#include <time.h>
+
+class Pressure
+{
+public:
+
+	static void init();
+	/* Called once when the -L option is used, before any job is
+	 * started */
+
+	static bool enabled() {  return is_enabled;  }
+
+	static bool admit(size_t count_running);
+	/* Whether a job may be started now, given the number of jobs
+	 * that are currently running */
+
+	static int get_timeout() {
+		return time_throttled_begin != 0 ? INTERVAL / 1000 : -1;
+	}
+	/* The timeout in milliseconds to use when waiting for jobs:
+	 * while jobs are held back, the pressure must be measured again
+	 * even when no job terminates.  -1 for no timeout.  */
+
+	static int64_t get_time_throttled();
+	/* Total time in microseconds during which jobs were held back */
+
+private:
+
+	static const int64_t INTERVAL= 200000;
+	/* Minimal time between two measurements, in microseconds */
+
+	static constexpr double LIMIT_MEMORY= 0.10;
+	static constexpr double LIMIT_CPU= 0.80;
+	/* Maximal fraction of stalled time */
+
+	static constexpr double LIMIT_AVAILABLE= 0.05;
+	/* Minimal fraction of available memory */
+
+	static bool is_enabled;
+
+	static string filename_memory, filename_cpu, filename_meminfo;
+	/* The files that are read, by default in /proc */
+
+	static bool high;
+	/* Result of the last measurement */
+
+	static int64_t time_measured;
+	/* Time of the last measurement; zero before the first one */
+
+	static int64_t stall_memory, stall_cpu;
+	/* Cumulative stall times at the last measurement, in
+	 * microseconds; -1 when not available */
+
+	static int64_t time_throttled_begin;
+	/* Since when jobs are held back; zero when they are not */
+
+	static int64_t time_throttled;
+	/* Time during which jobs were held back, excluding the current
+	 * period */
+
+	static void measure();
+	/* Update HIGH, unless the last measurement is more recent than
+	 * INTERVAL */
+
+	static void end_throttle();
+
+	static int64_t get_time();
+	/* Monotonic time in microseconds */
+
+	static bool read_file(const string &filename, string &content);
+	/* Read a small file from /proc.  Return false when it cannot be
+	 * read.  */
+
+	static int64_t read_stall(const string &filename);
+	/* The cumulative time in microseconds of the "some" line of
+	 * the given PSI file, or -1 when not available */
+
+	static bool read_memory(int64_t &total, int64_t &available);
+	/* The total and available memory in kilobytes */
+};
+
+bool Pressure::is_enabled= false;
+string Pressure::filename_memory, Pressure::filename_cpu, Pressure::filename_meminfo;
+bool Pressure::high= false;
+int64_t Pressure::time_measured= 0;
+int64_t Pressure::stall_memory= -1;
+int64_t Pressure::stall_cpu= -1;
+int64_t Pressure::time_throttled_begin= 0;
+int64_t Pressure::time_throttled= 0;
+
+void Pressure::init()
+{
+	assert(! is_enabled);
+
+	const char *dir= getenv("STU_PROC");
+	if (dir == nullptr)
+		dir= "/proc";
+	filename_memory= string(dir) + "/pressure/memory";
+	filename_cpu= string(dir) + "/pressure/cpu";
+	filename_meminfo= string(dir) + "/meminfo";
+
+	/* The stall times can only be compared starting with the
+	 * next measurement, but the available memory is used right
+	 * away */ 
+	int64_t total, available;
+	const bool has_memory= read_memory(total, available);
+	stall_memory= read_stall(filename_memory);
+	stall_cpu= read_stall(filename_cpu);
+	if (stall_memory < 0 && stall_cpu < 0 && ! has_memory) {
+		print_warning(Place(Place::Type::OPTION, 'L'),
+			      "Load information is not available; jobs are not held back");
+		return;
+	}
+	high= has_memory && available < LIMIT_AVAILABLE * total;
+	time_measured= get_time();
+	is_enabled= true;
+}
+
+bool Pressure::admit(size_t count_running)
+{
+	assert(is_enabled);
+
+	if (count_running != 0) {
+		measure();
+		if (high) {
+			if (time_throttled_begin == 0)
+				time_throttled_begin= get_time();
+			return false;
+		}
+	}
+
+	end_throttle();
+	return true;
+}
+
+int64_t Pressure::get_time_throttled()
+{
+	return time_throttled +
+		(time_throttled_begin != 0 ? get_time() - time_throttled_begin : 0);
+}
+
+void Pressure::measure()
+{
+	const int64_t now= get_time();
+	const int64_t elapsed= now - time_measured;
+	if (elapsed < INTERVAL)
+		return;
+
+	high= false;
+
+	int64_t stall;
+	if (stall_memory >= 0 && (stall= read_stall(filename_memory)) >= 0) {
+		if ((stall - stall_memory) > LIMIT_MEMORY * elapsed)
+			high= true;
+		stall_memory= stall;
+	}
+	if (stall_cpu >= 0 && (stall= read_stall(filename_cpu)) >= 0) {
+		if ((stall - stall_cpu) > LIMIT_CPU * elapsed)
+			high= true;
+		stall_cpu= stall;
+	}
+
+	int64_t total, available;
+	if (read_memory(total, available) && available < LIMIT_AVAILABLE * total)
+		high= true;
+
+	time_measured= now;
+}
+
+void Pressure::end_throttle()
+{
+	if (time_throttled_begin == 0)
+		return;
+	time_throttled += get_time() - time_throttled_begin;
+	time_throttled_begin= 0;
+}
+
+int64_t Pressure::get_time()
+{
+	struct timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0) {
+		print_error_system("clock_gettime");
+		exit(ERROR_FATAL);
+	}
+	int64_t ret= (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	/* Zero is used to denote "no time" */
+	return ret != 0 ? ret : 1;
+}
+
+bool Pressure::read_file(const string &filename, string &content)
+{
+	int fd= ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	char buf[4096];
+	ssize_t r= read(fd, buf, sizeof(buf) - 1);
+	::close(fd);
+	if (r <= 0)
+		return false;
+	content.assign(buf, r);
+	return true;
+}
+
+int64_t Pressure::read_stall(const string &filename)
+{
+	/* The first line has the form
+	 *     some avg10=0.00 avg60=0.00 avg300=0.00 total=12345  */
+	string content;
+	if (! read_file(filename, content) || content.compare(0, 5, "some ") != 0)
+		return -1;
+	size_t i= content.find("total=");
+	size_t j= content.find('\n');
+	if (i == string::npos || (j != string::npos && i > j))
+		return -1;
+	long long ret;
+	if (sscanf(content.c_str() + i, "total=%lld", &ret) != 1 || ret < 0)
+		return -1;
+	return ret;
+}
+
+bool Pressure::read_memory(int64_t &total, int64_t &available)
+{
+	string content;
+	if (! read_file(filename_meminfo, content))
+		return false;
+	size_t i= content.find("MemTotal:");
+	size_t j= content.find("MemAvailable:");
+	long long t, a;
+	if (i == string::npos || j == string::npos ||
+	    sscanf(content.c_str() + i, "MemTotal: %lld", &t) != 1 ||
+	    sscanf(content.c_str() + j, "MemAvailable: %lld", &a) != 1 ||
+	    t <= 0)
+		return false;
+	total= t;
+	available= a;
+	return true;
+}
+
+#endif /* ! PRESSURE_HH */
@@ -5,10 +5,48 @@
  * Data structures for representing rules. 
  */
 
+#include <algorithm>
 #include <unordered_map>
 
 #include "token.hh"
 #include "explain.hh"
+#include "pool.hh"
+
+class Rule;
+
+/*
+ * The dependencies of a rule as kept before they are parsed, in lazy
+ * mode (-l). 
+ */
+struct Rule_Body
+{
+	Token_List tokens;
+	/* The tokens following the colon, followed by the command,
+	 * ';' or '%' that ends them.  Copied from the token list of the
+	 * script, so that the latter can be freed.  */
+
+	const Place place_end;
+	/* The end of the script, as used by the parser */
+
+	Place place_nocommand;
+	/* Place of ';' when the rule has no command, or EMPTY */
+
+	Rule_Body(Token_List::iterator begin,
+		  Token_List::iterator end,
+		  const Place &place_end_)
+		:  tokens(begin, end),
+		   place_end(place_end_)
+	{  }
+	explicit Rule_Body(const Place &place_end_)
+		:  place_end(place_end_)
+	{  }
+	/* With an empty list of tokens */ 
+};
+
+typedef unordered_map <const Rule *, unique_ptr <Rule_Body> > Rule_Bodies;
+/* Rules whose dependencies are not yet parsed, with the unparsed
+ * dependencies.  Such rules have no dependencies and no input
+ * redirection.  */
 
 /* 
  * A rule.  The class Rule allows parameters; there is no
@@ -26,7 +64,7 @@ public:
 	 * The place in each target is used when referring to a target
 	 * specifically.  */ 
 
-	vector <shared_ptr <const Dep> > deps;
+	vector <Ref <const Dep> > deps;
 	/* The dependencies in order of declaration.  Dependencies are
 	 * included multiple times if they appear multiple times in the
 	 * source.  Any parameter occuring any dependency also
@@ -60,26 +98,38 @@ public:
 	/* Whether the rule is a copy rule, i.e., declared with '='
 	 * followed by a filename. */ 
 
+	Pool *const pool;
+	/* The pool in which the command is executed, or null when the
+	 * rule is not in a pool.  Null for copy rules.  */
+
+	mutable unsigned nodes[2];
+	/* The nodes of the rule in the graph used by Execution to find
+	 * cycles, for executions of dynamic depth zero and one, or ~0U
+	 * when not yet created.  Nodes for larger depths are kept in
+	 * Execution::nodes_by_rule.  */
+
 	Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets,
-	     vector <shared_ptr <const Dep> > &&deps_,
+	     vector <Ref <const Dep> > &&deps_,
 	     const Place &place_,
 	     const shared_ptr <const Command> &command_,
 	     Name &&filename_,
 	     bool is_hardcode_,
 	     int redirect_index_,
-	     bool is_copy_); 
+	     bool is_copy_,
+	     Pool *pool_); 
 	/* Direct constructor that specifies everything */
 
 	Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets_,
-	     const vector <shared_ptr <const Dep> > &deps_,
+	     const vector <Ref <const Dep> > &deps_,
 	     shared_ptr <const Command> command_,
 	     bool is_hardcode_,
 	     int redirect_index_,
-	     const Name &filename_input_);
+	     const Name &filename_input_,
+	     Pool *pool_);
 	/* Regular rule:  all cases execpt copy rules */
 
 	Rule(shared_ptr <const Place_Param_Target> place_param_target_,
-	     shared_ptr <const Place_Name> place_name_source_,
+	     const Place_Name &place_name_source_,
 	     const Place &place_persistent,
 	     const Place &place_optional); 
 	/* A copy rule.  When the places are EMPTY, the corresponding
@@ -93,7 +143,7 @@ public:
 	string format_out() const; 
 	/* Format the rule, as for the -P or -d options */ 
 
-	void check_unparametrized(shared_ptr <const Dep> dep,
+	void check_unparametrized(Ref <const Dep> dep,
 				  const set <string> &parameters);
 	/* Print error message and throw a logical error when DEP
 	 * contains parameters  */
@@ -112,6 +162,45 @@ public:
 	 * itself when it is unparametrized.  */ 
 };
 
+/*
+ * A trie of strings, in which each node contains a list of values.  Used
+ * for indexing the fixed prefixes and suffixes of parametrized names.
+ */
+class Trie
+{
+public:
+
+	Trie()
+		:  nodes(1)
+	{  }
+
+	template <class Iterator>
+	void insert(Iterator begin, Iterator end, size_t value);
+	/* Insert VALUE under the string given by the characters from
+	 * BEGIN to END */
+
+	template <class Iterator>
+	size_t find(Iterator begin, Iterator end, 
+		    vector <const vector <size_t> *> &values) const;
+	/* Append to VALUES the lists of values of all strings that are
+	 * prefixes of the string from BEGIN to END, including the empty
+	 * string, and return the total number of values in them.  The
+	 * lists are not copied.  */
+
+private:
+
+	struct Node
+	{
+		unordered_map <char, size_t> children;
+		/* Indexes into NODES */
+
+		vector <size_t> values;
+	};
+
+	vector <Node> nodes;
+	/* The root is at index zero */
+};
+
 /* 
  * A set of parametrized rules. 
  */
@@ -119,8 +208,8 @@ class Rule_Set
 {
 private:
 
-	unordered_map <Target, shared_ptr <const Rule> > rules_unparametrized;
-	/* All unparametrized rules by their target.  Rules
+	unordered_map <Target_Id, shared_ptr <const Rule> > rules_unparametrized;
+	/* All unparametrized rules by the ID of their target.  Rules
 	 * with multiple targets are included multiple times, for each
 	 * of their targets.  None of the targets has flags set (except
 	 * F_TARGET_TARNSIENT of course.)  */ 
@@ -128,14 +217,54 @@ private:
 	vector <shared_ptr <const Rule> > rules_parametrized;
 	/* All parametrized rules. */ 
 
+	vector <pair <shared_ptr <const Rule>,
+		      shared_ptr <const Place_Param_Target> > > targets_parametrized; 
+	/* All targets of parametrized rules, with their rule, in the order
+	 * of RULES_PARAMETRIZED.  Indexed by the two tries.  */ 
+
+	Trie trie_prefix, trie_suffix;
+	/* The fixed prefixes and the reversed fixed suffixes of the
+	 * targets in TARGETS_PARAMETRIZED that have both.  Each value
+	 * is an index into TARGETS_PARAMETRIZED.  */ 
+
+	Trie trie_prefix_only, trie_suffix_only;
+	/* The same for the targets that have only a fixed prefix, or
+	 * only a fixed suffix */
+
+	vector <size_t> targets_unanchored;
+	/* The targets that have neither a fixed prefix nor a fixed
+	 * suffix */ 
+
+	Rule_Bodies bodies;
+	/* In lazy mode (-l), the rules that have not been used yet */
+
+	unordered_map <const Rule *, shared_ptr <const Rule> > rules_parsed;
+	/* In lazy mode, the rules that have been used, by the rule
+	 * without dependencies, with their dependencies parsed.  Null
+	 * when the dependencies are invalid.  */
+
+	void find_candidates(const char *name, size_t length,
+			     vector <size_t> &candidates);
+	/* Write into CANDIDATES the indexes of all targets in
+	 * TARGETS_PARAMETRIZED whose fixed prefix and fixed suffix match
+	 * NAME of the given LENGTH, in increasing order */
+
+	shared_ptr <const Rule> parse(const shared_ptr <const Rule> &rule);
+	/* Return RULE with its dependencies.  In lazy mode, they are
+	 * parsed when RULE is used for the first time.  Print and throw
+	 * a logical error when they are invalid; the error is printed
+	 * only the first time.  Implemented in parser.hh.  */
+
 public:
 
-	void add(vector <shared_ptr <const Rule> > &rules_);
+	void add(vector <shared_ptr <const Rule> > &rules_,
+		 Rule_Bodies &&bodies_= Rule_Bodies());
 	/* Add rules to this rule set.  
 	 * While adding rules, check for duplicates, and print and throw
 	 * a logical error if there is. 
 	 * If the given rule has duplicate targets, print and throw a
-	 * logical error.  */ 
+	 * logical error.  BODIES_ contains the unparsed dependencies
+	 * of rules in lazy mode.  */ 
 
 	shared_ptr <const Rule> get(Target target, 
 				    shared_ptr <const Rule> &param_rule,
@@ -150,21 +279,24 @@ public:
 	 * matched parameters into MAPPING_PARAMETER.  Throws errors, in
 	 * which case PARAM_RULE is never set.  PLACE  
 	 * is the place of the dependency; used in error messages.  
+	 * In lazy mode, the dependencies of the matched rule are parsed
+	 * here.  
 	 */ 
 
-	void print() const;
+	void print();
 	/* Print the rule set to standard output, as used by the -P and
 	 * -d options */   
 };
 
 Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets_,
-	   vector <shared_ptr <const Dep> > &&deps_,
+	   vector <Ref <const Dep> > &&deps_,
 	   const Place &place_,
 	   const shared_ptr <const Command> &command_,
 	   Name &&filename_,
 	   bool is_hardcode_,
 	   int redirect_index_,
-	   bool is_copy_)
+	   bool is_copy_,
+	   Pool *pool_)
 	:  place_param_targets(place_param_targets_),
 	   deps(deps_),
 	   place(place_),
@@ -172,15 +304,18 @@ Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets
 	   filename(filename_),
 	   redirect_index(redirect_index_),
 	   is_hardcode(is_hardcode_),
-	   is_copy(is_copy_)
+	   is_copy(is_copy_),
+	   pool(pool_),
+	   nodes{~0U, ~0U}
 {  }
 
 Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets_,
-	   const vector <shared_ptr <const Dep> > &deps_,
+	   const vector <Ref <const Dep> > &deps_,
 	   shared_ptr <const Command> command_,
 	   bool is_hardcode_,
 	   int redirect_index_,
-	   const Name &filename_)
+	   const Name &filename_,
+	   Pool *pool_)
 	:  place_param_targets(place_param_targets_), 
 	   deps(deps_),
   	   place(place_param_targets_[0]->place),
@@ -188,7 +323,9 @@ Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets
 	   filename(filename_),
 	   redirect_index(redirect_index_),
 	   is_hardcode(is_hardcode_),
-	   is_copy(false)
+	   is_copy(false),
+	   pool(pool_),
+	   nodes{~0U, ~0U}
 { 
 	assert(place_param_targets.size() != 0); 
 	assert(redirect_index>= -1);
@@ -212,18 +349,20 @@ Rule::Rule(vector <shared_ptr <const Place_Param_Target> > &&place_param_targets
 }
 
 Rule::Rule(shared_ptr <const Place_Param_Target> place_param_target_,
-	   shared_ptr <const Place_Name> place_name_source_,
+	   const Place_Name &place_name_source_,
 	   const Place &place_persistent,
 	   const Place &place_optional)
 	:  place_param_targets{place_param_target_},
 	   place(place_param_target_->place),
-	   filename(*place_name_source_),
+	   filename(place_name_source_),
 	   redirect_index(-1),
 	   is_hardcode(false),
-	   is_copy(true)
+	   is_copy(true),
+	   pool(nullptr),
+	   nodes{~0U, ~0U}
 {
 	auto dep= 
-		make_shared <Plain_Dep> (Place_Param_Target(0, *place_name_source_));
+		make_dep <Plain_Dep> (Place_Param_Target(0, place_name_source_));
 
 	if (! place_persistent.empty()) {
 		dep->flags |= F_PERSISTENT;
@@ -250,7 +389,7 @@ Rule::instantiate(shared_ptr <const Rule> rule,
 	for (size_t i= 0;  i < rule->place_param_targets.size();  ++i) 
 		place_param_targets[i]= rule->place_param_targets[i]->instantiate(mapping);
 
-	vector <shared_ptr <const Dep> > deps;
+	vector <Ref <const Dep> > deps;
 	for (auto &dep:  rule->deps) {
 		deps.push_back(dep->instantiate(mapping));
 	}
@@ -263,7 +402,49 @@ Rule::instantiate(shared_ptr <const Rule> rule,
 		 move(rule->filename.instantiate(mapping)),
 		 rule->is_hardcode,
 		 rule->redirect_index,
-		 rule->is_copy); 
+		 rule->is_copy,
+		 rule->pool); 
+}
+
+template <class Iterator>
+void Trie::insert(Iterator begin, Iterator end, size_t value)
+{
+	size_t node= 0;
+	for (Iterator i= begin;  i != end;  ++i) {
+		auto j= nodes[node].children.find(*i);
+		if (j != nodes[node].children.end()) {
+			node= j->second;
+		} else {
+			const size_t node_new= nodes.size(); 
+			nodes[node].children[*i]= node_new;
+			nodes.emplace_back(); 
+			node= node_new;
+		}
+	}
+	nodes[node].values.push_back(value); 
+}
+
+template <class Iterator>
+size_t Trie::find(Iterator begin, Iterator end, 
+		  vector <const vector <size_t> *> &values) const
+{
+	size_t ret= 0; 
+	size_t node= 0;
+	Iterator i= begin;
+	for (;;) {
+		if (! nodes[node].values.empty()) {
+			values.push_back(&nodes[node].values); 
+			ret += nodes[node].values.size(); 
+		}
+		if (i == end)
+			break;
+		auto j= nodes[node].children.find(*i);
+		if (j == nodes[node].children.end())
+			break;
+		node= j->second;
+		++i;
+	}
+	return ret; 
 }
 
 string Rule::format_out() const
@@ -294,7 +475,7 @@ string Rule::format_out() const
 	return ret; 
 }
 
-void Rule::check_unparametrized(shared_ptr <const Dep> dep,
+void Rule::check_unparametrized(Ref <const Dep> dep,
 				const set <string> &parameters)
 {
 	assert(dep != nullptr); 
@@ -334,8 +515,12 @@ void Rule::check_unparametrized(shared_ptr <const Dep> dep,
 	}
 }
 
-void Rule_Set::add(vector <shared_ptr <const Rule> > &rules_) 
+void Rule_Set::add(vector <shared_ptr <const Rule> > &rules_,
+		   Rule_Bodies &&bodies_) 
 {
+	for (auto &i:  bodies_)
+		bodies.insert(move(i)); 
+
 	for (auto &rule:  rules_) {
 
 		/* Check that the rule doesn't have a duplicate target */ 
@@ -357,11 +542,12 @@ void Rule_Set::add(vector <shared_ptr <const Rule> > &rules_)
 		if (! rule->is_parametrized()) {
 			for (auto place_param_target:  rule->place_param_targets) {
 				Target target= place_param_target->unparametrized(); 
-				if (rules_unparametrized.count(target)) {
+				const Target_Id id= Target_Table::intern(target); 
+				if (rules_unparametrized.count(id)) {
 					place_param_target->place <<
 						fmt("there must not be a second rule for target %s", 
 						    target.format_word());
-					auto rule_2= rules_unparametrized.at(target); 
+					auto rule_2= rules_unparametrized.at(id); 
 					for (auto place_param_target_2: rule_2->place_param_targets) {
 						assert(place_param_target_2->place_name.get_n() == 0);
 						if (place_param_target_2->unparametrized() == target) {
@@ -373,14 +559,75 @@ void Rule_Set::add(vector <shared_ptr <const Rule> > &rules_)
 					}
 					throw ERROR_LOGICAL; 
 				}
-				rules_unparametrized[target]= rule;
+				rules_unparametrized[id]= rule;
 			}
 		} else {
 			rules_parametrized.push_back(rule); 
+			for (auto &place_param_target:  rule->place_param_targets) {
+				const size_t index= targets_parametrized.size(); 
+				targets_parametrized.push_back({rule, place_param_target});
+				const vector <string> &texts= place_param_target->place_name.get_texts(); 
+				const string &prefix= texts.front(), &suffix= texts.back(); 
+				if (! prefix.empty() && ! suffix.empty()) {
+					trie_prefix.insert(prefix.begin(), prefix.end(), index);
+					trie_suffix.insert(suffix.rbegin(), suffix.rend(), index); 
+				} else if (! prefix.empty()) {
+					trie_prefix_only.insert(prefix.begin(), prefix.end(), index);
+				} else if (! suffix.empty()) {
+					trie_suffix_only.insert(suffix.rbegin(), suffix.rend(), index); 
+				} else {
+					targets_unanchored.push_back(index); 
+				}
+			}
 		}
 	}
 }
 
+void Rule_Set::find_candidates(const char *name, size_t length,
+				vector <size_t> &candidates)
+{
+	assert(candidates.empty()); 
+
+	typedef std::reverse_iterator <const char *> Reverse; 
+	const char *const name_end= name + length; 
+
+	/* Targets with only one of the two, or none */
+	vector <const vector <size_t> *> values;
+	trie_prefix_only.find(name, name_end, values);
+	trie_suffix_only.find(Reverse(name_end), Reverse(name), values);
+	values.push_back(&targets_unanchored); 
+	for (const vector <size_t> *v:  values) 
+		candidates.insert(candidates.end(), v->begin(), v->end()); 
+
+	/* Targets with both:  take the smaller of the two lists, and
+	 * check the other affix of each of its values directly */ 
+	vector <const vector <size_t> *> values_prefix, values_suffix;
+	const size_t size_prefix= trie_prefix.find(name, name_end, values_prefix);
+	const size_t size_suffix= size_prefix == 0 ? 0 : 
+		trie_suffix.find(Reverse(name_end), Reverse(name), values_suffix); 
+	const bool by_prefix= size_prefix <= size_suffix; 
+
+	for (const vector <size_t> *v:  by_prefix ? values_prefix : values_suffix) {
+		for (size_t value:  *v) {
+			const vector <string> &texts= 
+				targets_parametrized[value].second->place_name.get_texts(); 
+			const string &prefix= texts.front(), &suffix= texts.back(); 
+			/* The prefix and the suffix must not overlap */ 
+			if (prefix.size() + suffix.size() > length)
+				continue;
+			if (by_prefix 
+			    ? memcmp(name_end - suffix.size(), suffix.data(), suffix.size()) != 0
+			    : memcmp(name, prefix.data(), prefix.size()) != 0)
+				continue;
+			candidates.push_back(value); 
+		}
+	}
+
+	/* Keep the order of declaration, as it is used for the order of
+	 * rules in error messages */ 
+	sort(candidates.begin(), candidates.end()); 
+}
+
 shared_ptr <const Rule> Rule_Set::get(Target target, 
 				      shared_ptr <const Rule> &param_rule,
 				      map <string, string> &mapping_parameter,
@@ -395,7 +642,7 @@ shared_ptr <const Rule> Rule_Set::get(Target target,
 	 * begin with.  (I.e., if multiple unparametrized rules for the same
 	 * filename exist, then that error is caught earlier when the
 	 * Rule_Set is built.)  */ 
-	auto i= rules_unparametrized.find(target);
+	auto i= rules_unparametrized.find(Target_Table::intern(target));
 	if (i != rules_unparametrized.end()) {
 		shared_ptr <const Rule> rule= i->second;
 		assert(rule != nullptr); 
@@ -411,74 +658,77 @@ shared_ptr <const Rule> Rule_Set::get(Target target,
 		assert(found); 
 #endif 
 
+		rule= parse(rule); 
 		param_rule= rule; 
 		return rule;
 	}
 
-	/* Search the best parametrized rule.  Since this implementation
-	 * does not have an index for parametrized rules, we simply
-	 * check all rules, and choose the best-fitting one.  This can
-	 * be optimized, but the optimization is not trivial.  */ 
+	/* Search the best parametrized rule.  The index gives us the
+	 * targets whose fixed prefix and suffix match; of these, we
+	 * check all, and choose the best-fitting one.  */ 
 
-	/* Element [0] corresponds to the best rule. */ 
+	/* Element [0] corresponds to the best rule.  The values of the
+	 * parameters are only extracted for the best rule in the end.  */ 
 	vector <shared_ptr <const Rule> > rules_best;
-	vector <map <string, string> > mappings_best; 
 	vector <vector <size_t> > anchorings_best; 
 	vector <shared_ptr <const Place_Param_Target> > place_param_targets_best; 
 
-	for (auto &rule:  rules_parametrized) {
+	const char *const name= target.get_name_c_str_nondynamic(); 
+	const size_t length= target.get_text().size() - sizeof(word_t); 
+	vector <size_t> candidates;
+	find_candidates(name, length, candidates); 
 
-		for (auto &place_param_target:  rule->place_param_targets) {
+	vector <size_t> anchoring;
+	/* Reused for all candidates */ 
 
-			assert(place_param_target->place_name.get_n() > 0);
-		
-			map <string, string> mapping;
-			vector <size_t> anchoring;
+	for (size_t candidate:  candidates) {
+		const shared_ptr <const Rule> &rule= 
+			targets_parametrized[candidate].first;
+		const shared_ptr <const Place_Param_Target> &place_param_target= 
+			targets_parametrized[candidate].second; 
 
-			/* The parametrized rule is of another type */ 
-			if (target.get_front_word() != (place_param_target->flags & F_TARGET_TRANSIENT))
-				continue;
+		assert(place_param_target->place_name.get_n() > 0);
 
-			/* The parametrized rule does not match */ 
-			if (! place_param_target->place_name.match(target.get_name_nondynamic(), mapping, anchoring))
-				continue; 
+		/* The parametrized rule is of another type */ 
+		if (target.get_front_word() != (place_param_target->flags & F_TARGET_TRANSIENT))
+			continue;
 
-			assert(anchoring.size() == 
-			       (2 * place_param_target->place_name.get_n())); 
+		/* The parametrized rule does not match */ 
+		if (! place_param_target->place_name.match(name, length, anchoring))
+			continue; 
 
-			size_t k= rules_best.size(); 
-			assert(k == anchorings_best.size()); 
-			assert(k == mappings_best.size()); 
+		assert(anchoring.size() == 
+		       (2 * place_param_target->place_name.get_n())); 
 
-			/* Check whether the rule is dominated by at least one other rule */
-			for (size_t j= 0;  j < k;  ++j) {
-				if (Name::anchoring_dominates
-				    (anchorings_best[j], anchoring)) {
-					goto dont_add;
-				}
-			}
+		size_t k= rules_best.size(); 
+		assert(k == anchorings_best.size()); 
 
-			/* Check whether the rule dominates all other rules */ 
-			{
-				bool is_best= true;
-				for (ssize_t j= 0;  is_best && j < (ssize_t) k;  ++j) {
-					if (! Name::anchoring_dominates(anchoring, anchorings_best[j]))
-						is_best= false;
-				}
-				if (is_best) {
-					k= 0;
-				}
-			} 
-			rules_best.resize(k+1); 
-			mappings_best.resize(k+1);
-			anchorings_best.resize(k+1); 
-			place_param_targets_best.resize(k+1); 
-			rules_best[k]= rule;
-			swap(mapping, mappings_best[k]);
-			swap(anchoring, anchorings_best[k]); 
-			place_param_targets_best[k]= place_param_target;
-		dont_add:;
+		/* Check whether the rule is dominated by at least one other rule */
+		for (size_t j= 0;  j < k;  ++j) {
+			if (Name::anchoring_dominates
+			    (anchorings_best[j], anchoring)) {
+				goto dont_add;
+			}
 		}
+
+		/* Check whether the rule dominates all other rules */ 
+		{
+			bool is_best= true;
+			for (ssize_t j= 0;  is_best && j < (ssize_t) k;  ++j) {
+				if (! Name::anchoring_dominates(anchoring, anchorings_best[j]))
+					is_best= false;
+			}
+			if (is_best) {
+				k= 0;
+			}
+		} 
+		rules_best.resize(k+1); 
+		anchorings_best.resize(k+1); 
+		place_param_targets_best.resize(k+1); 
+		rules_best[k]= rule;
+		swap(anchoring, anchorings_best[k]); 
+		place_param_targets_best[k]= place_param_target;
+	dont_add:;
 	}
 
 	/* No rule matches */ 
@@ -502,21 +752,25 @@ shared_ptr <const Rule> Rule_Set::get(Target target,
 	assert(rules_best.size() == 1); 
 
 	/* Instantiate the rule */ 
-	shared_ptr <const Rule> rule_best= rules_best[0];
-	swap(mapping_parameter, mappings_best[0]); 
+	shared_ptr <const Rule> rule_best= parse(rules_best[0]);
+	place_param_targets_best[0]->place_name.get_mapping
+		(name, anchorings_best[0], mapping_parameter); 
 	shared_ptr <const Rule> ret(Rule::instantiate(rule_best, mapping_parameter));
 	param_rule= rule_best; 
 	return ret;
 }
 
-void Rule_Set::print() const
+void Rule_Set::print()
 {
-	for (auto i:  rules_unparametrized)  {
-		string text= i.second->format_out(); 
-		puts(text.c_str()); 
-	}
-
-	for (auto i:  rules_parametrized)  {
+	/* In lazy mode, parse all rules before any of them is output,
+	 * such that errors are reported first */ 
+	vector <shared_ptr <const Rule> > rules;
+	for (auto i:  rules_unparametrized) 
+		rules.push_back(parse(i.second));
+	for (auto i:  rules_parametrized) 
+		rules.push_back(parse(i));
+
+	for (auto i:  rules)  {
 		string text= i->format_out(); 
 		puts(text.c_str()); 
 	}
@@ -0,0 +1,1094 @@
+#ifndef RULECACHE_HH
+#define RULECACHE_HH
+
+/*
+ * The rule cache, used with the -R option.  It contains the rules read
+ * from each Stu script, so that they can be loaded without tokenizing
+ * and parsing the script when it has not changed.  Scripts are
+ * identified by their absolute name, i.e., the name as given, preceded
+ * by the current directory when it is relative, so that the same cache
+ * file can be used from different directories.  For each script, the
+ * cache contains:
+ *
+ *   - The files that were read, i.e., the script itself and all files
+ *     included from it directly or indirectly, with their absolute
+ *     name, device and inode numbers, size, modification time and the
+ *     digest of their content.  An entry is used only when all files
+ *     are still the same files and have the recorded size, and either
+ *     the recorded modification time or the recorded digest.  As in the
+ *     state file, the content of a file is always hashed again when it
+ *     was modified within the second in which it was read.
+ *   - The options that change the parsing of rules (-a, -g and -l).
+ *     An entry written with other options is not used.
+ *   - The pools declared in the files, which are declared again when
+ *     the entry is used.
+ *   - The rules, with all their places, in the order in which they
+ *     appear in the script.  The rules are added to the rule set in
+ *     that order, and thus the indexes of the rule set are built in the
+ *     same way as for parsed rules, and duplicate rules are reported in
+ *     the same way.  In lazy mode (-l), rules are stored with the
+ *     tokens of their unparsed dependencies, which are parsed when the
+ *     rule is used, as for rules read from the script.
+ *
+ * Included files are tokenized as part of the including file, and
+ * therefore a script is parsed again as a whole when one of its files
+ * has changed.  Scripts read from standard input and rules passed with
+ * -F are never cached.
+ *
+ * FORMAT
+ *
+ * The file starts with the eight bytes of RULE_CACHE_MAGIC, followed by
+ * the version of Stu that wrote it as a string, and the number of
+ * entries.  A file written by another version of Stu is ignored, and
+ * replaced when it is written.  Integers are 32-bit, except for those
+ * describing files, which are 64-bit; all are in the native byte order.
+ * Strings are written as their length followed by their content padded
+ * with null bytes to a multiple of four bytes.  Each entry consists of:
+ *
+ *   - The size of the entry in bytes, including this integer
+ *   - The absolute name of the script
+ *   - The options
+ *   - The number of files, and for each:  absolute name, device and
+ *     inode numbers, whether it is racy, size, modification time
+ *     (seconds and nanoseconds), digest
+ *   - The number of strings and the strings.  All other strings in the
+ *     entry are given by their index in this list.
+ *   - The number of pools, and for each:  name, number of slots, place
+ *   - The place of the end of the script
+ *   - The number of rules, and the rules
+ *
+ * Places are written as the filename (zero for an empty place, and one
+ * plus the index of the string otherwise), line and column.  Commands
+ * are written as strings, and not in the list of strings. 
+ * Dependencies are written recursively, starting with their kind, flags
+ * and the places of the flags that are set.  Each rule is followed by
+ * whether it has unparsed dependencies, and if it has, the place of
+ * the semicolon when there is no command, the number of tokens, and
+ * the tokens, each given by its kind and whether it is preceded by
+ * whitespace, followed by the operator or flag character and its
+ * place, or the name with its places.  The last token may be the
+ * command of the rule, which is not written again.
+ *
+ * The file is written as a whole after all scripts have been read,
+ * under a temporary name that is then renamed, and only when one of the
+ * scripts was parsed.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+
+#include <unordered_map>
+
+#include "rule.hh"
+#include "state.hh"
+#include "tokenizer.hh"
+#include "version.hh"
+
+const char RULE_CACHE_MAGIC[8]= {'S', 'T', 'U', 'R', 'U', 'L', 'E', '1'};
+
+class Rule_Cache
+{
+public:
+
+	static bool enabled() {  return filename != "";  }
+
+	static void open(const char *filename_);
+	/* Read the cache file, if it exists.  Called for the -R
+	 * option.  */
+
+	static void close();
+	/* Write the cache file when a script was parsed.  Called after
+	 * all scripts have been read.  */
+
+	static bool load(const string &name,
+			 vector <shared_ptr <const Rule> > &rules,
+			 Rule_Bodies &bodies,
+			 Place &place_end);
+	/* Read the rules of the script NAME into RULES and their
+	 * unparsed dependencies into BODIES, set PLACE_END and declare
+	 * the pools of the script.  Return false when the
+	 * script must be parsed, i.e., when the cache is not enabled,
+	 * does not contain the script, or when one of the files of the
+	 * script has changed.  NAME is "" for standard input, which is
+	 * never cached.  */
+
+	static void begin();
+	/* Start recording the files read by the tokenizer.  Called
+	 * before a script is parsed.  */
+
+	static void store(const string &name,
+			  const vector <shared_ptr <const Rule> > &rules,
+			  const Rule_Bodies &bodies,
+			  const Place &place_end);
+	/* Store the rules of the script NAME, which was parsed after
+	 * begin() was called, and stop recording.  */
+
+	static void print_statistics();
+
+private:
+
+	class Reader
+	/* Reads from a part of the cache file.  When the file is
+	 * truncated or otherwise invalid, FAILED is set, and the
+	 * returned values are meaningless.  */
+	{
+	public:
+
+		bool failed;
+
+		Reader(const char *p_, const char *end_)
+			:  failed(false), p(p_), end(end_)
+		{  }
+
+		uint32_t read_u32();
+		uint64_t read_u64();
+		uint32_t read_count();
+		/* A number of elements, each of which takes at least
+		 * four bytes */
+		string read_string();
+		bool read_entry(const char *&entry, size_t &size);
+
+		bool read_sources();
+		/* Whether all files are unchanged */
+		void read_strings();
+
+		const string &read_text();
+		Place read_place();
+		Name read_name();
+		Place_Name read_place_name();
+		Place_Param_Target read_place_param_target();
+		Ref <const Dep> read_dep();
+		shared_ptr <const Rule> read_rule();
+		/* Null when FAILED is set */
+		bool read_token(Token_List &tokens, 
+				shared_ptr <const Command> command);
+		unique_ptr <Rule_Body> read_body(const Rule &rule, 
+						 const Place &place_end);
+		/* Null when the rule has no unparsed dependencies, or
+		 * when FAILED is set */
+
+	private:
+
+		const char *p, *const end;
+
+		vector <string> strings;
+
+		vector <Place> places_file;
+		/* For each string, a place in the file of that name,
+		 * created when first needed */
+	};
+
+	class Writer
+	/* Writes the strings and rules of an entry.  When something
+	 * cannot be written, FAILED is set.  */
+	{
+	public:
+
+		string out;
+		/* Everything except the strings */
+
+		bool failed;
+
+		Writer()
+			:  failed(false), text_last(nullptr), index_last(0)
+		{  }
+
+		static void append_u32(string &s, uint32_t n);
+		static void append_u64(string &s, uint64_t n);
+		static void append_string(string &s, const string &text);
+
+		uint32_t get_index(const string &text);
+		/* The index of TEXT in the list of strings, to which it is
+		 * added if needed */
+
+		void write_u32(uint32_t n) {  append_u32(out, n);  }
+		void write_text(const string &text) {  write_u32(get_index(text));  }
+		void write_place(const Place &place);
+		void write_name(const Name &name);
+		void write_place_name(const Place_Name &place_name);
+		void write_place_param_target(const Place_Param_Target &place_param_target);
+		void write_dep(Ref <const Dep> dep);
+		void write_rule(shared_ptr <const Rule> rule);
+		void write_token(const Token *token);
+		void write_body(const Rule_Body *body);
+		/* BODY may be null */
+
+		string get_strings() const;
+
+	private:
+
+		vector <const string *> strings;
+		unordered_map <string, uint32_t> indexes;
+		/* The strings, and their indexes in STRINGS */
+
+		const string *text_last;
+		uint32_t index_last;
+		/* The filename of the last place written, which is
+		 * interned, and its index */
+	};
+
+	static string filename;
+	/* Empty when not used */
+
+	static const char *in;
+	static size_t in_size;
+	/* The mapped content of the cache file; null when it does not
+	 * exist, or was written by another version of Stu */
+
+	static string directory;
+	/* The current directory, followed by a slash.  Empty when not
+	 * yet determined.  */
+
+	static unordered_map <string, pair <const char *, size_t> > entries;
+	/* The entries in IN by the absolute name of their scripts, except those
+	 * that were replaced.  Entries are only unpacked when they are
+	 * loaded.  */
+
+	static unordered_map <string, string> entries_stored;
+	/* The entries stored in this run */
+
+	static vector <Tokenizer::Source> sources;
+	static vector <Tokenizer::Declaration> declarations;
+	/* The files read and the pools declared since begin() */
+
+	static unsigned count_loaded, count_parsed;
+
+	static uint32_t get_options();
+
+	static string get_absolute(const string &name);
+	/* The absolute name of the file NAME, or "" when the current
+	 * directory cannot be determined */
+};
+
+string Rule_Cache::filename;
+string Rule_Cache::directory;
+const char *Rule_Cache::in= nullptr;
+size_t Rule_Cache::in_size= 0;
+unordered_map <string, pair <const char *, size_t> > Rule_Cache::entries;
+unordered_map <string, string> Rule_Cache::entries_stored;
+vector <Tokenizer::Source> Rule_Cache::sources;
+vector <Tokenizer::Declaration> Rule_Cache::declarations;
+unsigned Rule_Cache::count_loaded= 0;
+unsigned Rule_Cache::count_parsed= 0;
+
+void Rule_Cache::open(const char *filename_)
+{
+	assert(! enabled());
+
+	Place place(Place::Type::OPTION, 'R');
+	if (*filename_ == '\0') {
+		place << "expected a non-empty argument";
+		exit(ERROR_FATAL);
+	}
+	filename= filename_;
+
+	int fd= ::open(filename_, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return;
+		place << system_format(name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+
+	struct stat buf;
+	if (fstat(fd, &buf) < 0) {
+		place << system_format(name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+
+	/* An empty file is an empty cache; mmap() may fail on it */
+	if (buf.st_size == 0) {
+		::close(fd);
+		return;
+	}
+
+	in= (const char *) mmap(nullptr, buf.st_size, PROT_READ,
+				MAP_PRIVATE, fd, 0);
+	if (in == MAP_FAILED) {
+		place << system_format(name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+	in_size= buf.st_size;
+	::close(fd);
+
+	if (in_size < sizeof(RULE_CACHE_MAGIC) ||
+	    memcmp(in, RULE_CACHE_MAGIC, sizeof(RULE_CACHE_MAGIC))) {
+		place << fmt("%s is not a rule cache file",
+			     name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+
+	Reader reader(in + sizeof(RULE_CACHE_MAGIC), in + in_size);
+	if (reader.read_string() != STU_VERSION || reader.failed) {
+		munmap((void *) in, in_size);
+		in= nullptr;
+		return;
+	}
+
+	/* When the file is invalid, only the valid entries before the
+	 * invalid part are used */
+	uint32_t count= reader.read_count();
+	for (uint32_t i= 0;  i < count;  ++i) {
+		const char *entry;
+		size_t size;
+		if (! reader.read_entry(entry, size))
+			break;
+		Reader reader_entry(entry + 4, entry + size);
+		string name= reader_entry.read_string();
+		if (reader_entry.failed)
+			break;
+		entries[name]= make_pair(entry, size);
+	}
+}
+
+void Rule_Cache::close()
+{
+	if (! entries_stored.empty()) {
+		string header(RULE_CACHE_MAGIC, sizeof(RULE_CACHE_MAGIC));
+		Writer::append_string(header, STU_VERSION);
+		Writer::append_u32(header, entries.size() + entries_stored.size());
+
+		/* Write all data, or set errno */
+		auto write_all= [](int fd, const char *p, size_t size) -> bool {
+			while (size) {
+				ssize_t r= ::write(fd, p, size);
+				if (r <= 0) {
+					if (r == 0)
+						errno= ENOSPC;
+					return false;
+				}
+				p += r;
+				size -= r;
+			}
+			return true;
+		};
+
+		string filename_tmp= filename + ".tmp";
+		int fd= ::open(filename_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			       S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+		bool ok= fd >= 0 && write_all(fd, header.data(), header.size());
+		for (const auto &i:  entries) {
+			if (! ok)  break;
+			ok= write_all(fd, i.second.first, i.second.second);
+		}
+		for (const auto &i:  entries_stored) {
+			if (! ok)  break;
+			ok= write_all(fd, i.second.data(), i.second.size());
+		}
+		if (fd >= 0 && ::close(fd) < 0)
+			ok= false;
+		if (! ok) {
+			print_error_system(filename_tmp);
+			unlink(filename_tmp.c_str());
+		} else if (rename(filename_tmp.c_str(), filename.c_str()) < 0) {
+			print_error_system(filename);
+			unlink(filename_tmp.c_str());
+		}
+		entries_stored.clear();
+	}
+
+	entries.clear();
+	if (in != nullptr) {
+		munmap((void *) in, in_size);
+		in= nullptr;
+	}
+}
+
+bool Rule_Cache::load(const string &name,
+		      vector <shared_ptr <const Rule> > &rules,
+		      Rule_Bodies &bodies,
+		      Place &place_end)
+{
+	if (! enabled() || name == "")
+		return false;
+	auto i= entries.find(get_absolute(name));
+	if (i == entries.end())
+		return false;
+
+	Reader reader(i->second.first + 4, i->second.first + i->second.second);
+	reader.read_string();
+	if (reader.read_u32() != get_options() || ! reader.read_sources())
+		return false;
+	reader.read_strings();
+
+	vector <Tokenizer::Declaration> declarations_loaded; 
+	for (uint32_t count= reader.read_count();  count;  --count) {
+		string name_pool= reader.read_text();
+		long size= reader.read_u64();
+		Place place= reader.read_place();
+		if (reader.failed || size < 1)
+			return false;
+		declarations_loaded.push_back({name_pool, size, place});
+	}
+	for (const auto &declaration:  declarations_loaded) 
+		Pool::declare(declaration.name, declaration.size, declaration.place);
+
+	place_end= reader.read_place();
+	vector <shared_ptr <const Rule> > rules_loaded;
+	Rule_Bodies bodies_loaded; 
+	for (uint32_t count= reader.read_count();  count;  --count) {
+		shared_ptr <const Rule> rule= reader.read_rule();
+		if (rule == nullptr)
+			return false;
+		rules_loaded.push_back(rule);
+		unique_ptr <Rule_Body> body= reader.read_body(*rule, place_end);
+		if (reader.failed)
+			return false;
+		if (body != nullptr)
+			bodies_loaded[rule.get()]= move(body); 
+	}
+	if (reader.failed)
+		return false;
+
+	rules.insert(rules.end(), rules_loaded.begin(), rules_loaded.end());
+	for (auto &j:  bodies_loaded)
+		bodies.insert(move(j)); 
+	++count_loaded;
+	return true;
+}
+
+void Rule_Cache::begin()
+{
+	if (! enabled())
+		return;
+	sources.clear();
+	declarations.clear();
+	Tokenizer::sources= &sources;
+	Tokenizer::declarations= &declarations;
+}
+
+void Rule_Cache::store(const string &name,
+		       const vector <shared_ptr <const Rule> > &rules,
+		       const Rule_Bodies &bodies,
+		       const Place &place_end)
+{
+	if (! enabled())
+		return;
+	Tokenizer::sources= nullptr;
+	Tokenizer::declarations= nullptr;
+	if (name == "")
+		return;
+	++count_parsed;
+
+	const string name_absolute= get_absolute(name);
+	if (name_absolute == "")
+		return;
+	string entry(4, '\0');
+	Writer::append_string(entry, name_absolute);
+	Writer::append_u32(entry, get_options());
+	Writer::append_u32(entry, sources.size());
+	const time_t t= time(nullptr);
+	for (const Tokenizer::Source &source:  sources) {
+		if (! source.is_regular)
+			return;
+		Writer::append_string(entry, get_absolute(source.filename));
+		Writer::append_u64(entry, source.dev);
+		Writer::append_u64(entry, source.ino);
+		Writer::append_u32(entry, (time_t) source.sec >= t);
+		Writer::append_u64(entry, source.size);
+		Writer::append_u64(entry, source.sec);
+		Writer::append_u64(entry, source.nsec);
+		Writer::append_u64(entry, source.digest);
+	}
+
+	Writer writer;
+	writer.write_u32(declarations.size());
+	for (const Tokenizer::Declaration &declaration:  declarations) {
+		writer.write_text(declaration.name);
+		Writer::append_u64(writer.out, declaration.size);
+		writer.write_place(declaration.place);
+	}
+	writer.write_place(place_end);
+	writer.write_u32(rules.size());
+	for (const auto &rule:  rules) {
+		writer.write_rule(rule);
+		auto i= bodies.find(rule.get());
+		writer.write_body(i == bodies.end() ? nullptr : i->second.get()); 
+	}
+	if (writer.failed)
+		return;
+
+	entry += writer.get_strings();
+	entry += writer.out;
+	if (entry.size() > UINT32_MAX)
+		return;
+	uint32_t size= entry.size();
+	memcpy(&entry[0], &size, 4);
+
+	entries.erase(name_absolute);
+	entries_stored[name_absolute]= move(entry);
+}
+
+void Rule_Cache::print_statistics()
+{
+	printf("STATISTICS  rule cache:  %u scripts loaded, %u scripts parsed\n",
+	       count_loaded, count_parsed);
+}
+
+uint32_t Rule_Cache::get_options()
+{
+	return (option_nonoptional ? 1 : 0) | (option_nontrivial ? 2 : 0) 
+		| (option_lazy ? 4 : 0);
+}
+
+string Rule_Cache::get_absolute(const string &name)
+{
+	if (name[0] == '/')
+		return name;
+	if (directory == "") {
+		char *d= getcwd(nullptr, 0);
+		if (d == nullptr)
+			return "";
+		directory= d;
+		free(d);
+		if (directory[directory.size() - 1] != '/')
+			directory += '/';
+	}
+	return directory + name;
+}
+
+uint32_t Rule_Cache::Reader::read_u32()
+{
+	if (end - p < 4) {
+		failed= true;
+		return 0;
+	}
+	uint32_t n;
+	memcpy(&n, p, 4);
+	p += 4;
+	return n;
+}
+
+uint64_t Rule_Cache::Reader::read_u64()
+{
+	if (end - p < 8) {
+		failed= true;
+		return 0;
+	}
+	uint64_t n;
+	memcpy(&n, p, 8);
+	p += 8;
+	return n;
+}
+
+uint32_t Rule_Cache::Reader::read_count()
+{
+	uint32_t n= read_u32();
+	if (n > (size_t)(end - p) / 4) {
+		failed= true;
+		return 0;
+	}
+	return n;
+}
+
+string Rule_Cache::Reader::read_string()
+{
+	uint32_t length= read_u32();
+	size_t length_padded= ((size_t) length + 3) & ~(size_t) 3;
+	if (failed || (size_t)(end - p) < length_padded) {
+		failed= true;
+		return "";
+	}
+	string ret(p, length);
+	p += length_padded;
+	return ret;
+}
+
+bool Rule_Cache::Reader::read_entry(const char *&entry, size_t &size)
+{
+	const char *p_entry= p;
+	size= read_u32();
+	if (failed || size < 4 || size % 4 || size - 4 > (size_t)(end - p)) {
+		failed= true;
+		return false;
+	}
+	entry= p_entry;
+	p= p_entry + size;
+	return true;
+}
+
+bool Rule_Cache::Reader::read_sources()
+{
+	for (uint32_t count= read_count();  count;  --count) {
+		string name= read_string();
+		uint64_t dev= read_u64(), ino= read_u64(); 
+		bool racy= read_u32();
+		uint64_t size= read_u64(), sec= read_u64(), nsec= read_u64(), 
+			digest= read_u64();
+		if (failed)
+			return false;
+
+		struct stat buf;
+		if (stat(name.c_str(), &buf) < 0 || ! S_ISREG(buf.st_mode) 
+		    || (uint64_t) buf.st_dev != dev || (uint64_t) buf.st_ino != ino
+		    || (uint64_t) buf.st_size != size)
+			return false;
+#if USE_MTIM
+		uint64_t nsec_file= buf.st_mtim.tv_nsec;
+#else
+		uint64_t nsec_file= 0;
+#endif
+		if (! racy && (uint64_t) buf.st_mtime == sec && nsec_file == nsec)
+			continue;
+		uint64_t d;
+		if (! State::digest(name, d) || d != digest)
+			return false;
+	}
+	return ! failed;
+}
+
+void Rule_Cache::Reader::read_strings()
+{
+	uint32_t count= read_count();
+	strings.reserve(count);
+	for (uint32_t i= 0;  i < count;  ++i)
+		strings.push_back(read_string());
+	places_file.resize(count);
+}
+
+const string &Rule_Cache::Reader::read_text()
+{
+	static const string text_empty;
+	uint32_t i= read_u32();
+	if (i >= strings.size()) {
+		failed= true;
+		return text_empty;
+	}
+	return strings[i];
+}
+
+Place Rule_Cache::Reader::read_place()
+{
+	uint32_t text= read_u32();
+	uint32_t line= read_u32();
+	uint32_t column= read_u32();
+	if (text == 0)
+		return Place();
+	if (text > strings.size() || line == 0) {
+		failed= true;
+		return Place();
+	}
+	Place &place= places_file[text - 1];
+	if (place.empty())
+		place= Place(Place::Type::INPUT_FILE, strings[text - 1], 1, 0);
+	Place ret= place;
+	ret.line= line;
+	ret.column= column;
+	return ret;
+}
+
+Name Rule_Cache::Reader::read_name()
+{
+	uint32_t count= read_count();
+	Name ret;
+	ret.append_text(read_text());
+	for (uint32_t i= 0;  i < count;  ++i) {
+		ret.append_parameter(read_text());
+		ret.append_text(read_text());
+	}
+	return ret;
+}
+
+Place_Name Rule_Cache::Reader::read_place_name()
+{
+	Place place= read_place();
+	uint32_t count= read_count();
+	Place_Name ret;
+	ret.append_text(read_text());
+	ret.place= place;
+	for (uint32_t i= 0;  i < count;  ++i) {
+		const string &parameter= read_text();
+		ret.append_parameter(parameter, read_place());
+		ret.append_text(read_text());
+	}
+	return ret;
+}
+
+Place_Param_Target Rule_Cache::Reader::read_place_param_target()
+{
+	Flags flags= read_u32();
+	Place_Name place_name= read_place_name();
+	Place place= read_place();
+	if (flags & ~F_TARGET_TRANSIENT) {
+		failed= true;
+		flags= 0;
+	}
+	return Place_Param_Target(flags, move(place_name), place);
+}
+
+Ref <const Dep> Rule_Cache::Reader::read_dep()
+{
+	uint32_t kind= read_u32();
+	Flags flags= read_u32();
+	Place places[C_PLACED];
+	for (unsigned i= 0;  i < C_PLACED;  ++i) {
+		if (flags & (1 << i))
+			places[i]= read_place();
+	}
+	if (failed)
+		return nullptr;
+
+	switch (kind) {
+	default:
+		failed= true;
+		return nullptr;
+
+	case Dep::K_PLAIN: {
+		Place_Param_Target place_param_target= read_place_param_target();
+		Place place= read_place();
+		const string &variable_name= read_text();
+		if (failed)
+			return nullptr;
+		auto ret= make_dep <Plain_Dep> 
+			(flags, places, move(place_param_target), variable_name);
+		ret->place= place;
+		return ret;
+	}
+
+	case Dep::K_DYNAMIC: {
+		Ref <const Dep> dep= read_dep();
+		if (dep == nullptr)
+			return nullptr;
+		return make_dep <Dynamic_Dep> (flags, places, dep);
+	}
+
+	case Dep::K_CONCAT: {
+		auto ret= make_dep <Concat_Dep> (flags, places);
+		for (uint32_t count= read_count();  count;  --count) {
+			Ref <const Dep> dep= read_dep();
+			if (dep == nullptr)
+				return nullptr;
+			ret->push_back(dep);
+		}
+		return failed ? nullptr : ret;
+	}
+
+	case Dep::K_COMPOUND: {
+		Place place= read_place();
+		auto ret= make_dep <Compound_Dep> (flags, places, place);
+		for (uint32_t count= read_count();  count;  --count) {
+			Ref <const Dep> dep= read_dep();
+			if (dep == nullptr)
+				return nullptr;
+			ret->push_back(dep);
+		}
+		return failed ? nullptr : ret;
+	}
+	}
+}
+
+shared_ptr <const Rule> Rule_Cache::Reader::read_rule()
+{
+	vector <shared_ptr <const Place_Param_Target> > place_param_targets;
+	for (uint32_t count= read_count();  count;  --count) 
+		place_param_targets.push_back
+			(make_shared <Place_Param_Target> (read_place_param_target()));
+
+	vector <Ref <const Dep> > deps;
+	for (uint32_t count= read_count();  count;  --count) {
+		Ref <const Dep> dep= read_dep();
+		if (dep == nullptr)
+			return nullptr;
+		deps.push_back(dep);
+	}
+
+	Place place= read_place();
+
+	shared_ptr <const Command> command;
+	if (read_u32()) {
+		string text= read_string();
+		Place place_command= read_place();
+		Place place_start= read_place();
+		command= make_shared <Command> (move(text), place_command, place_start);
+	}
+
+	Name filename= read_name();
+	bool is_hardcode= read_u32();
+	int redirect_index= (int32_t) read_u32();
+	bool is_copy= read_u32();
+
+	Pool *pool= nullptr;
+	if (uint32_t text= read_u32()) {
+		if (text > strings.size() || 
+		    nullptr == (pool= Pool::get(strings[text - 1])))
+			failed= true;
+	}
+
+	if (failed || place_param_targets.empty() || redirect_index < -1 ||
+	    redirect_index >= (int) place_param_targets.size())
+		return nullptr;
+
+	return make_shared <Rule> (move(place_param_targets), move(deps), place,
+				   command, move(filename), is_hardcode,
+				   redirect_index, is_copy, pool);
+}
+
+bool Rule_Cache::Reader::read_token(Token_List &tokens, 
+				    shared_ptr <const Command> command)
+{
+	uint32_t kind= read_u32();
+	bool whitespace= read_u32();
+	if (failed)
+		return false;
+
+	switch (kind) {
+	default:
+		failed= true;
+		return false;
+
+	case Token::K_OPERATOR: {
+		char op= read_u32();
+		Place place= read_place();
+		if (failed || isalnum(op) || place.empty()) {
+			failed= true;
+			return false;
+		}
+		tokens.push <Operator> (op, place, whitespace);
+		return true;
+	}
+
+	case Token::K_FLAG: {
+		char flag= read_u32();
+		Place place= read_place();
+		if (failed || ! isalnum(flag) || place.empty() || place.column == 0) {
+			failed= true;
+			return false;
+		}
+		tokens.push <Flag_Token> (flag, place, whitespace);
+		return true;
+	}
+
+	case Token::K_NAME: {
+		Place_Name place_name= read_place_name();
+		if (failed)
+			return false;
+		tokens.push <Name_Token> (move(place_name), whitespace);
+		return true;
+	}
+
+	case Token::K_COMMAND:
+		if (command == nullptr) {
+			failed= true;
+			return false;
+		}
+		tokens.push <Command_Token> (command, whitespace);
+		return true;
+	}
+}
+
+unique_ptr <Rule_Body> Rule_Cache::Reader::read_body(const Rule &rule, 
+						     const Place &place_end)
+{
+	if (! read_u32())
+		return nullptr;
+
+	unique_ptr <Rule_Body> ret(new Rule_Body(place_end));
+	ret->place_nocommand= read_place();
+
+	/* At least one dependency, and the token that ends them */ 
+	uint32_t count= read_count();
+	if (count < 2)
+		failed= true;
+	for (uint32_t i= 0;  i < count && ! failed;  ++i) 
+		read_token(ret->tokens, i + 1 == count ? rule.command : nullptr); 
+
+	if (failed)
+		return nullptr;
+	return ret;
+}
+
+void Rule_Cache::Writer::append_u32(string &s, uint32_t n)
+{
+	s.append((const char *) &n, 4);
+}
+
+void Rule_Cache::Writer::append_u64(string &s, uint64_t n)
+{
+	s.append((const char *) &n, 8);
+}
+
+void Rule_Cache::Writer::append_string(string &s, const string &text)
+{
+	append_u32(s, text.size());
+	s += text;
+	s.append((4 - text.size() % 4) % 4, '\0');
+}
+
+uint32_t Rule_Cache::Writer::get_index(const string &text)
+{
+	auto i= indexes.emplace(text, strings.size());
+	if (i.second)
+		strings.push_back(&i.first->first);
+	return i.first->second;
+}
+
+void Rule_Cache::Writer::write_place(const Place &place)
+{
+	if (place.empty()) {
+		write_u32(0);
+		write_u32(0);
+		write_u32(0);
+		return;
+	}
+
+	/* Places in scripts are always in files, and standard input
+	 * is not cached */ 
+	if (place.get_type() != Place::Type::INPUT_FILE || place.get_text() == "") {
+		failed= true;
+		return;
+	}
+
+	if (&place.get_text() != text_last) {
+		text_last= &place.get_text();
+		index_last= get_index(*text_last);
+	}
+	write_u32(1 + index_last);
+	write_u32(place.line);
+	write_u32(place.column);
+}
+
+void Rule_Cache::Writer::write_name(const Name &name)
+{
+	const vector <string> &texts= name.get_texts();
+	const vector <string> &parameters= name.get_parameters();
+	write_u32(parameters.size());
+	write_text(texts[0]);
+	for (size_t i= 0;  i < parameters.size();  ++i) {
+		write_text(parameters[i]);
+		write_text(texts[i + 1]);
+	}
+}
+
+void Rule_Cache::Writer::write_place_name(const Place_Name &place_name)
+{
+	const vector <string> &texts= place_name.get_texts();
+	const vector <string> &parameters= place_name.get_parameters();
+	if (place_name.get_places().size() != parameters.size()) {
+		failed= true;
+		return;
+	}
+	write_place(place_name.place);
+	write_u32(parameters.size());
+	write_text(texts[0]);
+	for (size_t i= 0;  i < parameters.size();  ++i) {
+		write_text(parameters[i]);
+		write_place(place_name.get_places()[i]);
+		write_text(texts[i + 1]);
+	}
+}
+
+void Rule_Cache::Writer::write_place_param_target(const Place_Param_Target &place_param_target)
+{
+	write_u32(place_param_target.flags);
+	write_place_name(place_param_target.place_name);
+	write_place(place_param_target.place);
+}
+
+void Rule_Cache::Writer::write_dep(Ref <const Dep> dep)
+{
+	write_u32(dep->kind);
+	write_u32(dep->flags);
+	for (unsigned i= 0;  i < C_PLACED;  ++i) {
+		if (dep->flags & (1 << i))
+			write_place(dep->get_place_flag(i));
+	}
+
+	if (auto plain_dep= to <Plain_Dep> (dep)) {
+		write_place_param_target(plain_dep->place_param_target);
+		write_place(plain_dep->place);
+		write_text(plain_dep->variable_name);
+	} else if (auto dynamic_dep= to <Dynamic_Dep> (dep)) {
+		write_dep(dynamic_dep->dep);
+	} else if (auto concat_dep= to <Concat_Dep> (dep)) {
+		write_u32(concat_dep->deps.size());
+		for (const auto &d:  concat_dep->deps) 
+			write_dep(d);
+	} else if (auto compound_dep= to <Compound_Dep> (dep)) {
+		write_place(compound_dep->place);
+		write_u32(compound_dep->deps.size());
+		for (const auto &d:  compound_dep->deps) 
+			write_dep(d);
+	} else {
+		failed= true;
+	}
+}
+
+void Rule_Cache::Writer::write_rule(shared_ptr <const Rule> rule)
+{
+	write_u32(rule->place_param_targets.size());
+	for (const auto &place_param_target:  rule->place_param_targets) 
+		write_place_param_target(*place_param_target);
+
+	write_u32(rule->deps.size());
+	for (const auto &dep:  rule->deps) 
+		write_dep(dep);
+
+	write_place(rule->place);
+
+	write_u32(rule->command != nullptr);
+	if (rule->command != nullptr) {
+		append_string(out, rule->command->command);
+		write_place(rule->command->place);
+		write_place(rule->command->place_start);
+	}
+
+	write_name(rule->filename);
+	write_u32(rule->is_hardcode);
+	write_u32(rule->redirect_index);
+	write_u32(rule->is_copy);
+	write_u32(rule->pool == nullptr ? 0 : 1 + get_index(rule->pool->name));
+}
+
+void Rule_Cache::Writer::write_token(const Token *token)
+{
+	write_u32(token->kind);
+	write_u32(token->whitespace);
+	switch (token->kind) {
+	default:
+		failed= true;
+		break;
+	case Token::K_OPERATOR: {
+		const Operator *op= static_cast <const Operator *> (token);
+		write_u32(op->op);
+		write_place(op->place);
+		break;
+	}
+	case Token::K_FLAG: {
+		const Flag_Token *flag= static_cast <const Flag_Token *> (token);
+		write_u32(flag->flag);
+		write_place(flag->place);
+		break;
+	}
+	case Token::K_NAME:
+		write_place_name(*static_cast <const Name_Token *> (token));
+		break;
+	case Token::K_COMMAND:
+		/* The command of the rule */
+		break;
+	}
+}
+
+void Rule_Cache::Writer::write_body(const Rule_Body *body)
+{
+	write_u32(body != nullptr);
+	if (body == nullptr)
+		return;
+	write_place(body->place_nocommand);
+	write_u32(body->tokens.end() - body->tokens.begin());
+	for (const Token *token:  body->tokens) 
+		write_token(token);
+}
+
+string Rule_Cache::Writer::get_strings() const
+{
+	string ret;
+	append_u32(ret, strings.size());
+	for (const string *text:  strings) 
+		append_string(ret, *text);
+	return ret;
+}
+
+#endif /* ! RULECACHE_HH */
@@ -0,0 +1,190 @@
+#ifndef SCAN_HH
+#define SCAN_HH
+
+/*
+ * Finding the end of runs of ordinary characters in source code, used
+ * by the tokenizer to skip over names, commands and comments without
+ * looking at each byte individually.  Bytes are compared a whole vector
+ * at a time using SSE2, or AVX2 when the compiler is targeting it.  The
+ * last bytes of the input that do not fill a whole vector, and all
+ * bytes on other architectures, are tested one at a time.  Vectors are
+ * only loaded from within the input, because the input may be a
+ * memory-mapped file ending at the end of a page.
+ *
+ * The vectorized code is used when USE_SIMD is set, which is the
+ * default.  With USE_SIMD=0, only the scalar code is used, e.g. to
+ * compare the two.
+ */
+
+#ifndef USE_SIMD
+#    define USE_SIMD 1
+#endif
+
+#if USE_SIMD && defined(__AVX2__)
+#    include <immintrin.h>
+#    define SCAN_VECTOR __m256i
+#elif USE_SIMD && defined(__SSE2__)
+#    include <emmintrin.h>
+#    define SCAN_VECTOR __m128i
+#endif
+
+#include <string.h>
+#include <strings.h>
+
+class Scan
+{
+public:
+
+	static bool is_name_char(char c);
+	/* Whether C can be part of an unquoted name; see
+	 * Tokenizer::is_name_char()  */
+
+	static const char *name(const char *p, const char *p_end);
+	/* The first character from P on that cannot be part of an
+	 * unquoted name, or P_END  */
+
+	static const char *command(const char *p, const char *p_end);
+	/* The first character from P on that has a meaning for the
+	 * parsing of commands, i.e., one of the characters in
+	 * Tokenizer::parse_command(), or P_END  */
+
+	static const char *line_end(const char *p, const char *p_end);
+	/* The first newline from P on, or P_END */
+
+private:
+
+#ifdef SCAN_VECTOR
+
+	typedef SCAN_VECTOR Vector;
+
+	static Vector load(const char *p);
+	static Vector set(char c);
+	static Vector equal(Vector a, Vector b);
+	static Vector greater(Vector a, Vector b);
+	/* Compares bytes as signed integers */
+	static Vector either(Vector a, Vector b);
+	static Vector both(Vector a, Vector b);
+	static Vector but_not(Vector a, Vector b);
+	static unsigned mask(Vector a);
+	/* One bit for each byte, set when all bits of the byte are set */
+
+	static Vector is_name_end(Vector v);
+	static Vector is_command_char(Vector v);
+	/* Vectorized versions of the tests used by name() and command();
+	 * each byte is all ones when the test is true, and zero when
+	 * not  */
+
+	template <Vector (*TEST)(Vector)>
+	static const char *find(const char *p, const char *p_end);
+	/* The first byte for which TEST is true in the whole vectors
+	 * starting at P, or the start of the first incomplete vector
+	 * when there is none  */
+
+#endif /* SCAN_VECTOR */
+};
+
+bool Scan::is_name_char(char c)
+{
+	/* All ASCII printable characters except space and
+	 * []"':={}#<>@$;()%*\!?|& , as well as all non-ASCII
+	 * characters */
+	const unsigned char u= c;
+	return (u > 0x2A && u < 0x3A)
+		|| (u > 0x40 && u < 0x5B)
+		|| (u > 0x5D && u < 0x7B)
+		|| u == 0x7E
+		|| u >= 0x80;
+}
+
+const char *Scan::name(const char *p, const char *p_end)
+{
+#ifdef SCAN_VECTOR
+	p= find <is_name_end> (p, p_end);
+#endif
+	while (p < p_end && is_name_char(*p))
+		++p;
+	return p;
+}
+
+const char *Scan::command(const char *p, const char *p_end)
+{
+#ifdef SCAN_VECTOR
+	p= find <is_command_char> (p, p_end);
+#endif
+	while (p < p_end && (*p == '\0' || nullptr == strchr("}{\'\"`\\#()$\n", *p)))
+		++p;
+	return p;
+}
+
+const char *Scan::line_end(const char *p, const char *p_end)
+{
+	/* memchr() is vectorized by the C library */
+	const char *ret= (const char *) memchr(p, '\n', p_end - p);
+	return ret ? ret : p_end;
+}
+
+#ifdef SCAN_VECTOR
+
+#ifdef __AVX2__
+
+Scan::Vector Scan::load(const char *p) {  return _mm256_loadu_si256((const __m256i *) p);  }
+Scan::Vector Scan::set(char c) {  return _mm256_set1_epi8(c);  }
+Scan::Vector Scan::equal(Vector a, Vector b) {  return _mm256_cmpeq_epi8(a, b);  }
+Scan::Vector Scan::greater(Vector a, Vector b) {  return _mm256_cmpgt_epi8(a, b);  }
+Scan::Vector Scan::either(Vector a, Vector b) {  return _mm256_or_si256(a, b);  }
+Scan::Vector Scan::both(Vector a, Vector b) {  return _mm256_and_si256(a, b);  }
+Scan::Vector Scan::but_not(Vector a, Vector b) {  return _mm256_andnot_si256(b, a);  }
+unsigned Scan::mask(Vector a) {  return _mm256_movemask_epi8(a);  }
+
+#else
+
+Scan::Vector Scan::load(const char *p) {  return _mm_loadu_si128((const __m128i *) p);  }
+Scan::Vector Scan::set(char c) {  return _mm_set1_epi8(c);  }
+Scan::Vector Scan::equal(Vector a, Vector b) {  return _mm_cmpeq_epi8(a, b);  }
+Scan::Vector Scan::greater(Vector a, Vector b) {  return _mm_cmpgt_epi8(a, b);  }
+Scan::Vector Scan::either(Vector a, Vector b) {  return _mm_or_si128(a, b);  }
+Scan::Vector Scan::both(Vector a, Vector b) {  return _mm_and_si128(a, b);  }
+Scan::Vector Scan::but_not(Vector a, Vector b) {  return _mm_andnot_si128(b, a);  }
+unsigned Scan::mask(Vector a) {  return _mm_movemask_epi8(a);  }
+
+#endif /* ! __AVX2__ */
+
+Scan::Vector Scan::is_name_end(Vector v)
+{
+	/* The complement of is_name_char(), using signed comparisons:
+	 * non-ASCII characters are negative and thus never end a
+	 * name.  The ranges are 0x00-0x2A, 0x3A-0x40, 0x5B-0x5D, and
+	 * 0x7B-0x7F except 0x7E.  */
+	const Vector range_control= both(greater(v, set(-1)), greater(set(0x2B), v));
+	const Vector range_colon= both(greater(v, set(0x39)), greater(set(0x41), v));
+	const Vector range_bracket= both(greater(v, set(0x5A)), greater(set(0x5E), v));
+	const Vector range_brace= but_not(greater(v, set(0x7A)), equal(v, set(0x7E)));
+	return either(either(range_control, range_colon),
+		      either(range_bracket, range_brace));
+}
+
+Scan::Vector Scan::is_command_char(Vector v)
+{
+	return either(either(either(equal(v, set('}')), equal(v, set('{'))),
+			     either(equal(v, set('\'')), equal(v, set('"')))),
+		      either(either(either(equal(v, set('`')), equal(v, set('\\'))),
+				    either(equal(v, set('#')), equal(v, set('$')))),
+			     either(either(equal(v, set('(')), equal(v, set(')'))),
+				    equal(v, set('\n')))));
+}
+
+template <Scan::Vector (*TEST)(Scan::Vector)>
+const char *Scan::find(const char *p, const char *p_end)
+{
+	while (p_end - p >= (ptrdiff_t) sizeof(Vector)) {
+		const unsigned m= mask(TEST(load(p)));
+		if (m != 0)
+			return p + ffs((int) m) - 1;
+		p += sizeof(Vector);
+	}
+	return p;
+}
+
+#endif /* SCAN_VECTOR */
+
+#endif /* ! SCAN_HH */
@@ -0,0 +1,158 @@
+#ifndef SHA256_HH
+#define SHA256_HH
+
+/*
+ * The SHA-256 hash function, as specified in FIPS 180-4.  Used where
+ * digests must be collision-resistant, i.e., for the keys of the
+ * artifact cache.  Elsewhere, the faster State::hash() is used.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+class Sha256
+{
+public:
+
+	static const size_t SIZE= 32;
+	/* Size of a digest in bytes */
+
+	Sha256();
+
+	void update(const char *p, size_t size);
+
+	string finish();
+	/* The digest of all data passed to update(), as SIZE bytes.  The
+	 * object cannot be used anymore afterwards.  */
+
+	static string hash(const char *p, size_t size);
+	/* The digest of the given data */
+
+private:
+
+	uint32_t h[8];
+
+	uint64_t length;
+	/* Total number of bytes passed to update() */
+
+	unsigned char block[64];
+	/* The incomplete block; its first LENGTH % 64 bytes are used */
+
+	void compress(const unsigned char *p);
+
+	static uint32_t rotate(uint32_t x, int n) {
+		return (x >> n) | (x << (32 - n));
+	}
+};
+
+Sha256::Sha256()
+	:  length(0)
+{
+	static const uint32_t h_init[8]= {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	memcpy(h, h_init, sizeof(h));
+}
+
+void Sha256::update(const char *p, size_t size)
+{
+	size_t used= length % 64;
+	length += size;
+
+	if (used != 0) {
+		size_t n= 64 - used;
+		if (size < n) {
+			memcpy(block + used, p, size);
+			return;
+		}
+		memcpy(block + used, p, n);
+		compress(block);
+		p += n;
+		size -= n;
+	}
+
+	for (;  size >= 64;  p += 64, size -= 64)
+		compress((const unsigned char *) p);
+	memcpy(block, p, size);
+}
+
+string Sha256::finish()
+{
+	const uint64_t bits= length * 8;
+
+	/* Padding:  a one bit, zeroes, and the length in bits as a
+	 * 64-bit big-endian integer, filling up the last block */
+	unsigned char padding[72]= { 0x80 };
+	size_t size_padding= (119 - length % 64) % 64 + 1;
+	for (int i= 0;  i < 8;  ++i)
+		padding[size_padding + i]= bits >> (56 - 8 * i);
+	update((const char *) padding, size_padding + 8);
+	assert(length % 64 == 0);
+
+	string ret(SIZE, '\0');
+	for (int i= 0;  i < 8;  ++i) {
+		ret[4 * i]=     h[i] >> 24;
+		ret[4 * i + 1]= h[i] >> 16;
+		ret[4 * i + 2]= h[i] >> 8;
+		ret[4 * i + 3]= h[i];
+	}
+	return ret;
+}
+
+string Sha256::hash(const char *p, size_t size)
+{
+	Sha256 sha256;
+	sha256.update(p, size);
+	return sha256.finish();
+}
+
+void Sha256::compress(const unsigned char *p)
+{
+	static const uint32_t k[64]= {
+		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+		0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+		0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+		0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+		0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+		0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+		0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+		0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+		0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+		0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+		0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+	};
+
+	uint32_t w[64];
+	for (int i= 0;  i < 16;  ++i) {
+		w[i]= (uint32_t) p[4 * i] << 24 | (uint32_t) p[4 * i + 1] << 16
+			| (uint32_t) p[4 * i + 2] << 8 | (uint32_t) p[4 * i + 3];
+	}
+	for (int i= 16;  i < 64;  ++i) {
+		uint32_t s0= rotate(w[i - 15], 7) ^ rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		uint32_t s1= rotate(w[i - 2], 17) ^ rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i]= w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	uint32_t a= h[0], b= h[1], c= h[2], d= h[3],
+		e= h[4], f= h[5], g= h[6], hh= h[7];
+	for (int i= 0;  i < 64;  ++i) {
+		uint32_t s1= rotate(e, 6) ^ rotate(e, 11) ^ rotate(e, 25);
+		uint32_t ch= (e & f) ^ (~e & g);
+		uint32_t t1= hh + s1 + ch + k[i] + w[i];
+		uint32_t s0= rotate(a, 2) ^ rotate(a, 13) ^ rotate(a, 22);
+		uint32_t maj= (a & b) ^ (a & c) ^ (b & c);
+		uint32_t t2= s0 + maj;
+		hh= g;  g= f;  f= e;  e= d + t1;
+		d= c;  c= b;  b= a;  a= t1 + t2;
+	}
+	h[0] += a;  h[1] += b;  h[2] += c;  h[3] += d;
+	h[4] += e;  h[5] += f;  h[6] += g;  h[7] += hh;
+}
+
+#endif /* ! SHA256_HH */
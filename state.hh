@@ -0,0 +1,749 @@
+#ifndef STATE_HH
+#define STATE_HH
+
+/*
+ * The persistent state file, used with the -S option.  It allows Stu to
+ * decide whether a target must be rebuilt by comparing the content of
+ * files instead of their modification times.  It contains the following
+ * information:
+ *
+ *   - For each file whose content Stu has hashed, the device, inode,
+ *     size, modification time and status change time of the file at
+ *     that moment, and the digest of its content.  A file is hashed
+ *     again only when one of these values has changed, or when it was
+ *     modified within the second in which it was hashed.  The status
+ *     change time is included because it cannot be set by users,
+ *     unlike the modification time.
+ *   - For each target that was built (or found to be up to date), the
+ *     digests of its file targets ("outputs"), and the digests of the
+ *     files it depends on ("inputs").  A target with such a record is
+ *     rebuilt if and only if one of its inputs has changed.  The record
+ *     is only used when the outputs still have the recorded digests,
+ *     i.e., when the outputs are those that were built by Stu.
+ *   - For each target built by a command, the signature of the
+ *     command, which includes the command itself, the values of its
+ *     parameters and variables, the filenames of input and output
+ *     redirection and the shell.  A target whose signature has changed
+ *     is rebuilt regardless of its dependencies.  When no signature is
+ *     recorded for an up-to-date target, the current one is recorded. 
+ *   - For each target whose command was run, the wall time of the
+ *     command, and the length of the critical path of the target,
+ *     i.e., of the longest chain of commands that ends with its own
+ *     command, as measured in the last run of the command.  This is
+ *     used by the -m critical option.
+ *
+ * FORMAT
+ *
+ * The file starts with the eight bytes of STATE_MAGIC, followed by a
+ * sequence of records.  Each record starts with two 32-bit integers,
+ * the total size of the record in bytes (a multiple of eight), and its
+ * type.  All other integers are 64-bit.  Integers are in the native byte
+ * order, as the file is not meant to be shared between machines.
+ * Records of unknown type are skipped.  Records are only appended
+ * during a run of Stu; a later record replaces an earlier one with the
+ * same name.  An incomplete record at the end of the file, as left when
+ * Stu is killed while writing, is removed when the file is read.  When
+ * Stu exits normally and the file contains much more replaced records
+ * than current ones, the file is rewritten.
+ *
+ *   R_FILE:    dev, ino, size, mtime (seconds), mtime (nanoseconds),
+ *              ctime (seconds), ctime (nanoseconds), digest, length of
+ *              name, name
+ *   R_TARGET:  number of outputs, number of inputs, and then for each
+ *              output and input:  digest, length of name, name.  The
+ *              name of the record is that of the first output.
+ *   R_COMMAND: signature, length of name, name.  The name is that of
+ *              the first target. 
+ *   R_DURATION: duration, length of the critical path (both in
+ *              microseconds), length of name, name.  The name is the
+ *              internal representation of the first target, as it may
+ *              be a transient.
+ *
+ * Names are padded with null bytes to a multiple of eight bytes.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <stdint.h>
+
+#include <set>
+#include <unordered_map>
+
+#include "timestamp.hh"
+
+const char STATE_MAGIC[8]= {'S', 'T', 'U', 'S', 'T', 'A', 'T', '1'};
+
+class State
+{
+public:
+
+	static bool enabled() {  return fd >= 0;  }
+
+	static void open(const char *filename_);
+	/* Read the state file, creating it if it does not exist, and
+	 * enable content-based decisions.  Called for the -S option.  */
+
+	static void close();
+	/* Rewrite the state file if it contains many replaced records.
+	 * Called before Stu exits normally.  */
+
+	static bool check(const vector <Target> &targets,
+			  const set <string> &inputs,
+			  bool &changed);
+	/* Whether the targets have a valid record.  If so, set CHANGED
+	 * to whether one of the inputs has changed since the record was
+	 * written.  INPUTS are the names of the input files.  All
+	 * TARGETS must be files.  */
+
+	static void record(const vector <Target> &targets,
+			   const set <string> &inputs);
+	/* Write a record for the given targets, which must all be
+	 * existing files.  Does nothing if one of the files cannot be
+	 * hashed.  */
+
+	static bool signature_changed(const string &name, uint64_t signature); 
+	/* Whether a signature different from SIGNATURE was recorded for
+	 * the target NAME.  False if no signature was recorded.  */
+
+	static void record_signature(const string &name, uint64_t signature);
+
+	static uint64_t get_duration(const string &name); 
+	static uint64_t get_critical(const string &name); 
+	/* The recorded duration of the command, and length of the
+	 * critical path of the target with the given name, in
+	 * microseconds.  Zero when nothing is recorded.  NAME is as
+	 * returned by Target::get_text().  May also be used when the
+	 * state file is not enabled.  */
+
+	static void record_duration(const string &name, uint64_t duration, uint64_t critical); 
+
+	static void print_statistics();
+
+	static uint64_t hash(const char *p, size_t size);
+	/* The digest of a string */ 
+
+	static bool digest(const string &name, uint64_t &ret);
+	/* Get the digest of the content of the given file, hashing it
+	 * only if it changed since it was last hashed.  Return false when
+	 * the file cannot be hashed, e.g., because it does not exist or
+	 * is not a regular file.  May also be used when the state file
+	 * is not enabled.  */
+
+	static unsigned count_avoided;
+	/* Number of times a target was not rebuilt because none of its
+	 * inputs changed content, although it would have been rebuilt
+	 * based on timestamps */
+
+	static unsigned count_changed; 
+	/* Number of times a target was rebuilt because its signature
+	 * changed */
+
+private:
+
+	enum {
+		R_FILE   = 1,
+		R_TARGET = 2,
+		R_COMMAND= 3,
+		R_DURATION= 4,
+	};
+
+	struct File_Info
+	{
+		uint64_t dev, ino, size, sec, nsec, csec, cnsec;
+		uint64_t digest;
+
+		bool racy;
+		/* The file was modified in the same second in which it
+		 * was hashed, and could thus be modified again without
+		 * changing its modification time.  Such entries are
+		 * only used during the current run, and not written to
+		 * the file.  */
+
+		File_Info():  racy(false) { }
+		File_Info(const struct stat *buf);
+
+		bool operator == (const File_Info &that) const {
+			return dev == that.dev && ino == that.ino && size == that.size
+				&& sec == that.sec && nsec == that.nsec
+				&& csec == that.csec && cnsec == that.cnsec;
+		}
+	};
+
+	static int fd;
+	/* The state file, opened for appending.  -1 when not used.  */
+
+	static string filename;
+
+	static size_t size_written;
+	/* Total size of the records in the file */
+
+	static bool failed;
+	/* Writing to the file failed; don't write any more */
+
+	static unordered_map <string, File_Info> files;
+	/* By filename */
+
+	static unordered_map <string, vector <pair <string, uint64_t> > > targets_outputs,
+		targets_inputs;
+	/* By the name of the first output */
+
+	static unordered_map <string, uint64_t> signatures; 
+	/* By the name of the first target */ 
+
+	static unordered_map <string, pair <uint64_t, uint64_t> > durations; 
+	/* By the text of the first target; the duration and the length
+	 * of the critical path */
+
+	static unsigned count_hashed;
+	/* Number of files hashed */
+
+	static void read(const char *in, size_t size);
+	/* Read the records from the content of the file.  Set
+	 * SIZE_WRITTEN to the size of the valid part.  */
+
+	static void write(const string &record);
+
+	static string make_file(const string &name, const File_Info &info);
+	static string make_target(const vector <pair <string, uint64_t> > &outputs,
+				  const vector <pair <string, uint64_t> > &inputs);
+	static string make_command(const string &name, uint64_t signature); 
+	static string make_duration(const string &name, uint64_t duration, uint64_t critical); 
+	/* The content of a record */
+
+	static void append_u64(string &record, uint64_t n);
+	static void append_name(string &record, const string &name);
+	static void finish(string &record, uint32_t type);
+	/* Set the header of a record that was started with a
+	 * placeholder header */
+};
+
+int State::fd= -1;
+string State::filename;
+size_t State::size_written= 0;
+bool State::failed= false;
+unordered_map <string, State::File_Info> State::files;
+unordered_map <string, vector <pair <string, uint64_t> > > State::targets_outputs,
+	State::targets_inputs;
+unsigned State::count_hashed= 0;
+unsigned State::count_avoided= 0;
+unsigned State::count_changed= 0;
+unordered_map <string, uint64_t> State::signatures; 
+unordered_map <string, pair <uint64_t, uint64_t> > State::durations; 
+
+State::File_Info::File_Info(const struct stat *buf)
+	:  dev(buf->st_dev),
+	   ino(buf->st_ino),
+	   size(buf->st_size),
+	   sec(buf->st_mtime),
+#if USE_MTIM
+	   nsec(buf->st_mtim.tv_nsec),
+#else
+	   nsec(0),
+#endif
+	   csec(buf->st_ctime),
+#if USE_MTIM
+	   cnsec(buf->st_ctim.tv_nsec)
+#else
+	   cnsec(0)
+#endif
+{
+	racy= false; 
+}
+
+void State::open(const char *filename_)
+{
+	assert(fd < 0);
+	filename= filename_;
+
+	Place place(Place::Type::OPTION, 'S');
+	if (filename == "") {
+		place << "expected a non-empty argument";
+		exit(ERROR_FATAL);
+	}
+
+	fd= ::open(filename_, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC,
+		   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (fd < 0) {
+		place << system_format(name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+
+	struct stat buf;
+	if (fstat(fd, &buf) < 0) {
+		place << system_format(name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+
+	if (buf.st_size == 0) {
+		/* New file */
+		string header(STATE_MAGIC, sizeof(STATE_MAGIC));
+		write(header);
+		if (failed)
+			exit(ERROR_FATAL);
+		size_written= 0;
+		return;
+	}
+
+	const char *in= (const char *) mmap(nullptr, buf.st_size, PROT_READ,
+					    MAP_PRIVATE, fd, 0);
+	if (in == MAP_FAILED) {
+		place << system_format(name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+
+	if ((size_t) buf.st_size < sizeof(STATE_MAGIC) ||
+	    memcmp(in, STATE_MAGIC, sizeof(STATE_MAGIC))) {
+		place << fmt("%s is not a state file",
+			     name_format_word(filename));
+		exit(ERROR_FATAL);
+	}
+
+	read(in + sizeof(STATE_MAGIC), buf.st_size - sizeof(STATE_MAGIC));
+
+	if (munmap((void *) in, buf.st_size) < 0) {
+		print_error_system("munmap");
+	}
+
+	/* Remove an incomplete last record */
+	if (sizeof(STATE_MAGIC) + size_written < (size_t) buf.st_size) {
+		if (ftruncate(fd, sizeof(STATE_MAGIC) + size_written) < 0) {
+			place << system_format(name_format_word(filename));
+			exit(ERROR_FATAL);
+		}
+	}
+}
+
+void State::close()
+{
+	if (fd < 0)
+		return;
+
+	/* Rewrite the file when at least half of it consists of
+	 * replaced records */
+	size_t size_current= 0;
+	vector <string> records;
+	if (! failed) {
+		for (const auto &i:  files) {
+			if (i.second.racy)
+				continue;
+			records.push_back(make_file(i.first, i.second));
+			size_current += records.back().size();
+		}
+		for (const auto &i:  targets_outputs) {
+			records.push_back(make_target(i.second, targets_inputs.at(i.first)));
+			size_current += records.back().size();
+		}
+		for (const auto &i:  signatures) {
+			records.push_back(make_command(i.first, i.second));
+			size_current += records.back().size();
+		}
+		for (const auto &i:  durations) {
+			records.push_back(make_duration(i.first, i.second.first, i.second.second));
+			size_current += records.back().size();
+		}
+	}
+
+	if (failed || size_written <= 2 * size_current + 0x10000) {
+		::close(fd);
+		fd= -1;
+		return;
+	}
+
+	string filename_tmp= filename + ".tmp";
+	int fd_tmp= ::open(filename_tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			   S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
+	if (fd_tmp < 0) {
+		print_error_system(filename_tmp);
+		::close(fd);
+		fd= -1;
+		return;
+	}
+	::close(fd);
+	fd= fd_tmp;
+	write(string(STATE_MAGIC, sizeof(STATE_MAGIC)));
+	for (const string &record:  records)
+		write(record);
+	if (::close(fd) < 0) {
+		print_error_system(filename_tmp);
+		failed= true;
+	}
+	fd= -1;
+	if (failed || rename(filename_tmp.c_str(), filename.c_str()) < 0) {
+		print_error_system(filename);
+		unlink(filename_tmp.c_str());
+	}
+}
+
+bool State::check(const vector <Target> &targets,
+		  const set <string> &inputs,
+		  bool &changed)
+{
+	assert(enabled());
+	assert(targets.size() && targets[0].is_file());
+
+	auto i= targets_outputs.find(targets[0].get_name_nondynamic());
+	if (i == targets_outputs.end())
+		return false;
+	const vector <pair <string, uint64_t> > &outputs= i->second;
+	const vector <pair <string, uint64_t> > &inputs_old=
+		targets_inputs.at(targets[0].get_name_nondynamic());
+
+	/* The outputs must be exactly those that were recorded */
+	if (outputs.size() != targets.size())
+		return false;
+	for (size_t k= 0;  k < targets.size();  ++k) {
+		assert(targets[k].is_file());
+		uint64_t d;
+		if (outputs[k].first != targets[k].get_name_nondynamic() ||
+		    ! digest(outputs[k].first, d) || d != outputs[k].second)
+			return false;
+	}
+
+	changed= false;
+	if (inputs.size() != inputs_old.size()) {
+		changed= true;
+		return true;
+	}
+	size_t k= 0;
+	for (const string &input:  inputs) {
+		if (input != inputs_old[k].first) {
+			changed= true;
+			return true;
+		}
+		uint64_t d;
+		if (! digest(input, d))
+			return false;
+		if (d != inputs_old[k].second) {
+			changed= true;
+			return true;
+		}
+		++k;
+	}
+	return true;
+}
+
+void State::record(const vector <Target> &targets,
+		   const set <string> &inputs)
+{
+	assert(enabled());
+
+	vector <pair <string, uint64_t> > outputs_new, inputs_new;
+	for (const Target &target:  targets) {
+		assert(target.is_file());
+		uint64_t d;
+		if (! digest(target.get_name_nondynamic(), d))
+			return;
+		outputs_new.push_back(make_pair(target.get_name_nondynamic(), d));
+	}
+	for (const string &input:  inputs) {
+		uint64_t d;
+		if (! digest(input, d))
+			return;
+		inputs_new.push_back(make_pair(input, d));
+	}
+
+	const string &name= outputs_new[0].first;
+	auto i= targets_outputs.find(name);
+	if (i != targets_outputs.end() && i->second == outputs_new
+	    && targets_inputs.at(name) == inputs_new)
+		return;
+
+	write(make_target(outputs_new, inputs_new));
+	targets_outputs[name]= outputs_new;
+	targets_inputs[name]= inputs_new;
+}
+
+bool State::signature_changed(const string &name, uint64_t signature)
+{
+	assert(enabled());
+	auto i= signatures.find(name);
+	return i != signatures.end() && i->second != signature; 
+}
+
+void State::record_signature(const string &name, uint64_t signature)
+{
+	assert(enabled());
+	auto i= signatures.find(name);
+	if (i != signatures.end() && i->second == signature)
+		return;
+	write(make_command(name, signature));
+	signatures[name]= signature; 
+}
+
+uint64_t State::get_duration(const string &name)
+{
+	auto i= durations.find(name);
+	return i == durations.end() ? 0 : i->second.first; 
+}
+
+uint64_t State::get_critical(const string &name)
+{
+	auto i= durations.find(name);
+	return i == durations.end() ? 0 : i->second.second; 
+}
+
+void State::record_duration(const string &name, uint64_t duration, uint64_t critical)
+{
+	assert(enabled());
+	write(make_duration(name, duration, critical));
+	durations[name]= make_pair(duration, critical); 
+}
+
+void State::print_statistics()
+{
+	printf("STATISTICS  state file:  %u files hashed, %u rebuilds avoided, "
+	       "%u rebuilds because of changed commands\n",
+	       count_hashed, count_avoided, count_changed);
+}
+
+bool State::digest(const string &name, uint64_t &ret)
+{
+	struct stat buf;
+	if (stat(name.c_str(), &buf) < 0 || ! S_ISREG(buf.st_mode))
+		return false;
+
+	File_Info info(&buf);
+	auto i= files.find(name);
+	if (i != files.end() && i->second == info) {
+		ret= i->second.digest;
+		return true;
+	}
+
+	int fd_file= ::open(name.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd_file < 0)
+		return false;
+	if (fstat(fd_file, &buf) < 0 || ! S_ISREG(buf.st_mode)) {
+		::close(fd_file);
+		return false;
+	}
+	info= File_Info(&buf);
+
+	/* mmap() may fail on files of size zero */
+	if (buf.st_size == 0) {
+		info.digest= hash(nullptr, 0);
+	} else {
+		const char *in= (const char *) mmap(nullptr, buf.st_size, PROT_READ,
+						    MAP_PRIVATE, fd_file, 0);
+		if (in == MAP_FAILED) {
+			::close(fd_file);
+			return false;
+		}
+		info.digest= hash(in, buf.st_size);
+		munmap((void *) in, buf.st_size);
+	}
+	::close(fd_file);
+	++count_hashed;
+
+	time_t t= time(nullptr);
+	info.racy= (time_t) info.sec >= t || (time_t) info.csec >= t; 
+	files[name]= info;
+	if (! info.racy)
+		write(make_file(name, info));
+	ret= info.digest;
+	return true;
+}
+
+uint64_t State::hash(const char *p, size_t size)
+/* A 64-bit non-cryptographic hash function, processing eight bytes at
+ * a time, finalized as in MurmurHash3 */
+{
+	const uint64_t k1= 0x9e3779b97f4a7c15ULL, k2= 0xc2b2ae3d27d4eb4fULL;
+	uint64_t h= size * k1;
+	size_t i= 0;
+	for (;  i + 8 <= size;  i += 8) {
+		uint64_t w;
+		memcpy(&w, p + i, 8);
+		h ^= w * k2;
+		h= ((h << 31) | (h >> 33)) * k1;
+	}
+	if (i < size) {
+		uint64_t w= 0;
+		memcpy(&w, p + i, size - i);
+		h ^= w * k2;
+		h= ((h << 31) | (h >> 33)) * k1;
+	}
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+void State::read(const char *in, size_t size)
+{
+	/* Read one integer or name; return false when the record is
+	 * truncated */
+	auto read_u64= [](const char *&p, const char *end, uint64_t &n) -> bool {
+		if (end - p < 8)  return false;
+		memcpy(&n, p, 8);
+		p += 8;
+		return true;
+	};
+	auto read_name= [&read_u64](const char *&p, const char *end, string &name) -> bool {
+		uint64_t length;
+		if (! read_u64(p, end, length))  return false;
+		uint64_t length_padded= (length + 7) & ~(uint64_t) 7;
+		if (length == 0 || (uint64_t)(end - p) < length_padded)  return false;
+		name= string(p, length);
+		p += length_padded;
+		return true;
+	};
+	auto read_list= [&](const char *&p, const char *end, uint64_t count,
+			    vector <pair <string, uint64_t> > &list) -> bool {
+		for (uint64_t k= 0;  k < count;  ++k) {
+			uint64_t d;
+			string name;
+			if (! read_u64(p, end, d) || ! read_name(p, end, name))  return false;
+			list.push_back(make_pair(name, d));
+		}
+		return true;
+	};
+
+	size_written= 0;
+	while (size - size_written >= 8) {
+		const char *p= in + size_written;
+		uint32_t size_record, type;
+		memcpy(&size_record, p, 4);
+		memcpy(&type, p + 4, 4);
+		if (size_record < 8 || size_record % 8 || size_record > size - size_written)
+			break;
+		const char *end= p + size_record;
+		p += 8;
+
+		if (type == R_FILE) {
+			File_Info info;
+			string name;
+			if (! read_u64(p, end, info.dev) ||
+			    ! read_u64(p, end, info.ino) ||
+			    ! read_u64(p, end, info.size) ||
+			    ! read_u64(p, end, info.sec) ||
+			    ! read_u64(p, end, info.nsec) ||
+			    ! read_u64(p, end, info.csec) ||
+			    ! read_u64(p, end, info.cnsec) ||
+			    ! read_u64(p, end, info.digest) ||
+			    ! read_name(p, end, name))
+				break;
+			files[name]= info;
+		} else if (type == R_TARGET) {
+			uint64_t count_outputs, count_inputs;
+			vector <pair <string, uint64_t> > outputs, inputs;
+			if (! read_u64(p, end, count_outputs) ||
+			    ! read_u64(p, end, count_inputs) ||
+			    count_outputs == 0 ||
+			    ! read_list(p, end, count_outputs, outputs) ||
+			    ! read_list(p, end, count_inputs, inputs))
+				break;
+			targets_outputs[outputs[0].first]= outputs;
+			targets_inputs[outputs[0].first]= inputs;
+		} else if (type == R_COMMAND) {
+			uint64_t signature;
+			string name;
+			if (! read_u64(p, end, signature) || ! read_name(p, end, name))
+				break;
+			signatures[name]= signature; 
+		} else if (type == R_DURATION) {
+			uint64_t duration, critical;
+			string name;
+			if (! read_u64(p, end, duration) ||
+			    ! read_u64(p, end, critical) ||
+			    ! read_name(p, end, name))
+				break;
+			durations[name]= make_pair(duration, critical); 
+		}
+
+		size_written += size_record;
+	}
+}
+
+void State::write(const string &record)
+{
+	if (fd < 0 || failed)
+		return;
+	ssize_t r= ::write(fd, record.data(), record.size());
+	if (r < 0 || (size_t) r != record.size()) {
+		if (r >= 0)
+			errno= ENOSPC;
+		print_error_system(filename);
+		failed= true;
+		return;
+	}
+	size_written += record.size();
+}
+
+string State::make_file(const string &name, const File_Info &info)
+{
+	string record(8, '\0');
+	append_u64(record, info.dev);
+	append_u64(record, info.ino);
+	append_u64(record, info.size);
+	append_u64(record, info.sec);
+	append_u64(record, info.nsec);
+	append_u64(record, info.csec);
+	append_u64(record, info.cnsec);
+	append_u64(record, info.digest);
+	append_name(record, name);
+	finish(record, R_FILE);
+	return record;
+}
+
+string State::make_target(const vector <pair <string, uint64_t> > &outputs,
+			  const vector <pair <string, uint64_t> > &inputs)
+{
+	string record(8, '\0');
+	append_u64(record, outputs.size());
+	append_u64(record, inputs.size());
+	for (const auto &i:  outputs) {
+		append_u64(record, i.second);
+		append_name(record, i.first);
+	}
+	for (const auto &i:  inputs) {
+		append_u64(record, i.second);
+		append_name(record, i.first);
+	}
+	finish(record, R_TARGET);
+	return record;
+}
+
+string State::make_command(const string &name, uint64_t signature)
+{
+	string record(8, '\0');
+	append_u64(record, signature);
+	append_name(record, name);
+	finish(record, R_COMMAND);
+	return record;
+}
+
+string State::make_duration(const string &name, uint64_t duration, uint64_t critical)
+{
+	string record(8, '\0');
+	append_u64(record, duration);
+	append_u64(record, critical);
+	append_name(record, name);
+	finish(record, R_DURATION);
+	return record;
+}
+
+void State::append_u64(string &record, uint64_t n)
+{
+	record.append((const char *) &n, 8);
+}
+
+void State::append_name(string &record, const string &name)
+{
+	append_u64(record, name.size());
+	record += name;
+	record.append((8 - name.size() % 8) % 8, '\0');
+}
+
+void State::finish(string &record, uint32_t type)
+{
+	assert(record.size() % 8 == 0);
+	uint32_t size= record.size();
+	memcpy(&record[0], &size, 4);
+	memcpy(&record[4], &type, 4);
+}
+
+#endif /* ! STATE_HH */
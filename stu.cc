@@ -27,6 +27,7 @@ using namespace std;
 #include "rule.hh"
 #include "timestamp.hh"
 #include "color.hh"
+#include "rulecache.hh"
 
 /*
  * Note:  Stu does not call setlocale(), and therefore can make use of
@@ -39,7 +40,7 @@ using namespace std;
  * options, and not long options.  We avoid getopt_long() as it is a GNU
  * extension, and the short options are sufficient for now. 
  */
-const char OPTIONS[]= "0:ac:C:dEf:F:ghij:JkKm:M:n:o:p:PqsVxyYz"; 
+const char OPTIONS[]= "0:aA:c:C:dEf:F:ghij:JkKlLm:M:n:o:p:PqR:sS:VxyYz"; 
 
 /* The output of the help (-h) option.  The following strings do not
  * contain tabs, but only space characters.  */   
@@ -50,6 +51,8 @@ const char HELP[]=
 	"Options:\n"						       
 	"  -0 FILENAME      Read \\0-separated file targets from the given file\n"
 	"  -a               Treat all trivial dependencies as non-trivial\n"          
+	"  -A DIRECTORY     Restore built files from the given cache directory\n"
+	"                   instead of running their commands\n"
 	"  -c FILENAME      Pass a target filename without Stu syntax parsing\n"      
 	"  -C EXPRESSIONS   Pass a target in full Stu syntax\n"		              
 	"  -d               Debug mode: show execution information on stderr\n"     
@@ -63,9 +66,14 @@ const char HELP[]=
 	"  -J               Disable Stu syntax in arguments\n"                        
 	"  -k               Keep on running after errors\n"		              
 	"  -K               Don't delete target files on error or interruption\n"     
+	"  -l               Lazy mode: parse the dependencies of a rule only when\n"
+	"                   the rule is used\n"
+	"  -L               Hold back jobs while memory or CPU is under pressure\n"
 	"  -m ORDER         Order to run the targets:\n"			      
 	"     dfs           (default) Depth-first order, like in Make\n"	      
 	"     random        Random order\n"				              
+	"     critical      Longest critical path first, using durations recorded\n"
+	"                   in the state file (-S)\n"
 	"  -M STRING        Pseudorandom run order, seeded by given string\n"         
 	"  -n FILENAME      Read \\n-separated file targets from the given file\n"
 	"  -o FILENAME      Build an optional dependency, i.e., build it only if it\n"
@@ -73,7 +81,11 @@ const char HELP[]=
 	"  -p FILENAME      Build a persistent dependency, i.e., ignore its timestamp\n"
 	"  -P               Print the rules and exit\n"                               
 	"  -q               Question mode: check whether targets are up to date\n"    
+	"  -R FILENAME      Cache the rules read from Stu scripts in the given file,\n"
+	"                   and use them while the scripts are unchanged\n"
 	"  -s               Silent mode: don't use stdout\n"
+	"  -S FILENAME      Use the given state file to rebuild targets only when\n"
+	"                   the content of their dependencies has changed\n"
 	"  -V               Output version and exit\n"				      
 	"  -x               Output each line in a command individually\n"              
 	"  -y               Disable color in output\n"                                
@@ -92,7 +104,7 @@ const char VERSION_INFO[]=
 void init_buf(); 
 /* Initialize buffers; called once from main() */ 
 
-void add_deps_option_C(vector <shared_ptr <const Dep> > &deps,
+void add_deps_option_C(vector <Ref <const Dep> > &deps,
 		       const char *string_);
 /* Parse a string of dependencies and add them to the vector. Used for
  * the -C option.  Support the full Stu syntax.  */
@@ -156,7 +168,7 @@ int main(int argc, char **argv, char **envp)
 		 * unique and sorted as they were given, except for
 		 * duplicates. */   
 
-		vector <shared_ptr <const Dep> > deps; 
+		vector <Ref <const Dep> > deps; 
 		/* Assemble targets here */ 
 
 		shared_ptr <const Rule> rule_first;
@@ -203,6 +215,8 @@ int main(int argc, char **argv, char **envp)
 			case 'J': option_literal= true;        break;
 			case 'k': option_keep_going= true;     break;
 			case 'K': option_no_delete= true;      break;
+			case 'l': option_lazy= true;           break;
+			case 'L': option_pressure= true;       break;
 			case 'P': option_print= true;          break;  
 			case 'q': option_question= true;       break;
 
@@ -214,7 +228,7 @@ int main(int argc, char **argv, char **envp)
 					exit(ERROR_FATAL);
 				}
 				deps.push_back
-					(make_shared <Plain_Dep>
+					(make_dep <Plain_Dep>
 					 (0, Place_Param_Target
 					  (0, Place_Name(optarg, place))));
 				break;
@@ -289,12 +303,15 @@ int main(int argc, char **argv, char **envp)
 					buffer_generator.seed(tv.tv_sec + tv.tv_usec); 
 				}
 				else if (!strcmp(optarg, "dfs"))     /* Default */ ;
+				else if (!strcmp(optarg, "critical"))
+					order= Order::CRITICAL;
 				else {
-					print_error(fmt("Invalid argument %s for option %s-m%s; valid values are %s and %s", 
+					print_error(fmt("Invalid argument %s for option %s-m%s; valid values are %s, %s and %s", 
 							name_format_word(optarg),
 							Color::word, Color::end,
 							name_format_word("random"),
-							name_format_word("dfs"))); 
+							name_format_word("dfs"),
+							name_format_word("critical"))); 
 					exit(ERROR_FATAL); 
 				}
 				break;
@@ -313,9 +330,9 @@ int main(int argc, char **argv, char **envp)
 					exit(ERROR_FATAL);
 				}
 				deps.push_back
-					(make_shared <Dynamic_Dep>
+					(make_dep <Dynamic_Dep>
 					 (0,
-					  make_shared <Plain_Dep>
+					  make_dep <Plain_Dep>
 					  (1 << flag_get_index(c), 
 					   Place_Param_Target
 					   (0, Place_Name(optarg, place)))));
@@ -333,15 +350,43 @@ int main(int argc, char **argv, char **envp)
 				Place places[C_PLACED];
 				places[c == 'p' ? I_PERSISTENT : I_OPTIONAL]= place; 
 				deps.push_back
-					(make_shared <Plain_Dep>
+					(make_dep <Plain_Dep>
 					 (c == 'p' ? F_PERSISTENT : F_OPTIONAL, places,
 					  Place_Param_Target(0, Place_Name(optarg, place))));
 				break; 
 			}
 
+			case 'A':
+				if (Cache::enabled()) {
+					Place(Place::Type::OPTION, 'A') 
+						<< "the cache directory must not be given more than once"; 
+					exit(ERROR_FATAL); 
+				}
+				Cache::open(optarg); 
+				break;
+
+			case 'R':
+				if (Rule_Cache::enabled()) {
+					Place(Place::Type::OPTION, 'R') 
+						<< "the rule cache file must not be given more than once"; 
+					exit(ERROR_FATAL); 
+				}
+				Rule_Cache::open(optarg); 
+				break;
+
+			case 'S':
+				if (State::enabled()) {
+					Place(Place::Type::OPTION, 'S') 
+						<< "the state file must not be given more than once"; 
+					exit(ERROR_FATAL); 
+				}
+				State::open(optarg); 
+				break;
+
 			case 'V': 
 				fputs(VERSION_INFO, stdout); 
 				printf("USE_MTIM = %u\n", USE_MTIM); 
+				printf("USE_ARENA = %u\n", USE_ARENA); 
 				exit(0);
 
 			default:  
@@ -364,6 +409,12 @@ int main(int argc, char **argv, char **envp)
 			exit(ERROR_FATAL); 
 		}
 
+		if (option_parallel) 
+			Jobserver::init(Execution::jobs); 
+
+		if (option_pressure)
+			Pressure::init(); 
+
 		/* Targets passed on the command line, outside of options */ 
 		for (int i= optind;  i < argc;  ++i) {
 
@@ -380,12 +431,12 @@ int main(int argc, char **argv, char **envp)
 			}
 
 			if (! option_literal) {
-				shared_ptr <const Dep> dep= 
+				Ref <const Dep> dep= 
 					Parser::get_target_dep(argv[i], place);
 				deps.push_back(dep); 
 			} else {
 				deps.push_back
-					(make_shared <Plain_Dep>
+					(make_dep <Plain_Dep>
 					 (0, Place_Param_Target
 					  (0, Place_Name(argv[i], place))));
 			}
@@ -418,6 +469,8 @@ int main(int argc, char **argv, char **envp)
 			}
 		}
 
+		Rule_Cache::close(); 
+
 		if (option_print) {
 			Execution::rule_set.print(); 
 			exit(0); 
@@ -445,7 +498,7 @@ int main(int argc, char **argv, char **envp)
 			}
 
 			deps.push_back
-				(make_shared <Plain_Dep> (*(rule_first->place_param_targets[0])));  
+				(make_dep <Plain_Dep> (*(rule_first->place_param_targets[0])));  
 		}
 
 		/* Execute */
@@ -463,8 +516,17 @@ int main(int argc, char **argv, char **envp)
 	
 	if (option_statistics) {
 		Job::print_statistics();
+		Execution::print_statistics(); 
+		if (State::enabled())
+			State::print_statistics(); 
+		if (Cache::enabled())
+			Cache::print_statistics(); 
+		if (Rule_Cache::enabled())
+			Rule_Cache::print_statistics(); 
 	}
 
+	State::close(); 
+
 	if (fclose(stdout)) {
 		perror("fclose(stdout)");
 		exit(ERROR_FATAL);
@@ -503,10 +565,10 @@ void init_buf()
 	}
 }
 
-void add_deps_option_C(vector <shared_ptr <const Dep> > &deps,
+void add_deps_option_C(vector <Ref <const Dep> > &deps,
 		       const char *string_)
 {
-	vector <shared_ptr <Token> > tokens;
+	Token_List tokens;
 	Place place_end;
 				
 	Tokenizer::parse_tokens_string
@@ -515,7 +577,7 @@ void add_deps_option_C(vector <shared_ptr <const Dep> > &deps,
 		 place_end, string_,
 		 Place(Place::Type::OPTION, 'C'));
 
-	vector <shared_ptr <const Dep> > deps_option;
+	vector <Ref <const Dep> > deps_option;
 	Place_Name input; /* remains empty */ 
 	Place place_input; /* remains empty */ 
 
@@ -545,22 +607,35 @@ void read_file(string filename,
 	string filename_passed= filename;
 	if (filename_passed == "-")  filename_passed= ""; 
 
-	/* Tokenize */ 
-	vector <shared_ptr <Token> > tokens;
-	Place place_end;
-	Tokenizer::parse_tokens_file
-		(tokens, 
-		 Tokenizer::SOURCE,
-		 place_end, filename_passed, 
-		 place_diagnostic, 
-		 file_fd); 
-
-	/* Build rules */
 	vector <shared_ptr <const Rule> > rules;
-	Parser::get_rule_list(rules, tokens, place_end); 
+	Rule_Bodies bodies;
+	Place place_end;
+	if (Rule_Cache::load(filename_passed, rules, bodies, place_end)) {
+		if (file_fd >= 0 && close(file_fd) < 0) {
+			print_error_system(filename); 
+			exit(ERROR_FATAL); 
+		}
+	} else {
+		Rule_Cache::begin(); 
+
+		/* Tokenize */ 
+		Token_List tokens;
+		Tokenizer::parse_tokens_file
+			(tokens, 
+			 Tokenizer::SOURCE,
+			 place_end, filename_passed, 
+			 place_diagnostic, 
+			 file_fd); 
+
+		/* Build rules */
+		Parser::get_rule_list(rules, tokens, place_end, 
+				      option_lazy ? &bodies : nullptr); 
+
+		Rule_Cache::store(filename_passed, rules, bodies, place_end); 
+	}
 
 	/* Add to set */
-	rule_set.add(rules);
+	rule_set.add(rules, move(bodies));
 
 	/* Set the first one */
 	if (rule_first == nullptr) {
@@ -580,7 +655,7 @@ void read_option_F(const char *s,
 		   shared_ptr <const Rule> &rule_first)
 {
 	/* Tokenize */ 
-	vector <shared_ptr <Token> > tokens;
+	Token_List tokens;
 	Place place_end;
 	Tokenizer::parse_tokens_string
 		(tokens, 
@@ -590,10 +665,12 @@ void read_option_F(const char *s,
 
 	/* Build rules */
 	vector <shared_ptr <const Rule> > rules;
-	Parser::get_rule_list(rules, tokens, place_end);
+	Rule_Bodies bodies;
+	Parser::get_rule_list(rules, tokens, place_end, 
+			      option_lazy ? &bodies : nullptr);
 
 	/* Add to set */
-	rule_set.add(rules);
+	rule_set.add(rules, move(bodies));
 
 	/* Set the first one */
 	if (rule_first == nullptr) {
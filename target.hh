@@ -225,6 +225,123 @@ namespace std {
 	};
 }
 
+typedef uint32_t Target_Id;
+/* The ID of an interned target */
+
+/*
+ * The table of all interned targets.  Each distinct Target is given a
+ * stable ID, which is used as the key of the caches that are consulted
+ * during the expansion of the dependency graph, so that these do not
+ * have to hash and compare strings.  Targets are never removed.  Looking
+ * up a target that is already interned does not allocate memory.
+ */
+class Target_Table
+{
+public:
+
+	static Target_Id intern(const Target &target) {
+		return intern(target.get_text().data(), target.get_text().size(),
+			      "", 0);
+	}
+
+	static Target_Id intern(Flags flags, const string &name)
+	/* Same as intern(Target(FLAGS, NAME)), but without constructing
+	 * the Target when it is already interned.  FLAGS may contain
+	 * any flags of the front word, except F_TARGET_DYNAMIC.  */
+	{
+		assert((flags & ~F_TARGET_BYTE) == 0);
+		assert((flags & F_TARGET_DYNAMIC) == 0);
+		const word_t word= (word_t) flags;
+		return intern((const char *) &word, sizeof(word_t),
+			      name.data(), name.size());
+	}
+
+	static size_t size() {  return entries.size();  }
+	/* Number of interned targets; all IDs are smaller */
+
+private:
+
+	struct Entry
+	{
+		Target target;
+		size_t hash;
+	};
+
+	static vector <Entry> entries;
+	/* Indexed by ID */
+
+	static vector <Target_Id> buckets;
+	/* Open addressing with linear probing.  Each bucket contains an
+	 * ID plus one, or zero when empty.  The size is zero or a power
+	 * of two, and is kept at least twice the number of entries.  */
+
+	static Target_Id intern(const char *text_1, size_t length_1,
+				const char *text_2, size_t length_2);
+	/* Intern the target whose text is the concatenation of the two
+	 * given strings */
+
+	static size_t hash_bytes(size_t h, const char *p, size_t length) {
+		/* FNV-1a */
+		for (size_t i= 0;  i < length;  ++i) {
+			h ^= (unsigned char) p[i];
+			h *= (size_t) 1099511628211ULL;
+		}
+		return h;
+	}
+
+	static void grow();
+};
+
+vector <Target_Table::Entry> Target_Table::entries;
+vector <Target_Id> Target_Table::buckets;
+
+Target_Id Target_Table::intern(const char *text_1, size_t length_1,
+			       const char *text_2, size_t length_2)
+{
+	const size_t h= hash_bytes(hash_bytes((size_t) 14695981039346656037ULL,
+					      text_1, length_1),
+				   text_2, length_2);
+
+	if (2 * (entries.size() + 1) > buckets.size())
+		grow();
+
+	const size_t mask= buckets.size() - 1;
+	size_t i= h & mask;
+	for (;  buckets[i];  i= (i + 1) & mask) {
+		const Entry &entry= entries[buckets[i] - 1];
+		const string &text= entry.target.get_text();
+		if (entry.hash == h &&
+		    text.size() == length_1 + length_2 &&
+		    ! memcmp(text.data(), text_1, length_1) &&
+		    ! memcmp(text.data() + length_1, text_2, length_2))
+			return buckets[i] - 1;
+	}
+
+	if (entries.size() >= (size_t) UINT32_MAX) {
+		print_error("Too many targets");
+		exit(ERROR_FATAL);
+	}
+	const Target_Id id= entries.size();
+	string text(text_1, length_1);
+	text.append(text_2, length_2);
+	entries.push_back(Entry{Target(text), h});
+	buckets[i]= id + 1;
+	return id;
+}
+
+void Target_Table::grow()
+{
+	vector <Target_Id> buckets_new(buckets.empty() ? 1024 : 2 * buckets.size());
+	const size_t mask= buckets_new.size() - 1;
+	for (Target_Id id= 0;  id < entries.size();  ++id) {
+		size_t i= entries[id].hash & mask;
+		while (buckets_new[i])
+			i= (i + 1) & mask;
+		buckets_new[i]= id + 1;
+	}
+	swap(buckets, buckets_new);
+}
+
 /* 
  * A parametrized name.  Each name has N >= 0 parameters.  When N > 0,
  * the name is parametrized, otherwise it is unparametrized.   
@@ -330,12 +447,21 @@ public:
 		return texts[0]; 
 	}
 
-	bool match(string name, 
-		   map <string, string> &mapping,
+	bool match(const char *name, size_t length, 
 		   vector <size_t> &anchoring) const;
-	/* Check whether NAME matches this name.  If it does, return
-	 * TRUE and set MAPPING and ANCHORING accordingly. 
-	 * MAPPING must be empty.  */
+	/* Check whether NAME, which has the given LENGTH and does not
+	 * need to be null-terminated, matches this name.  If it does,
+	 * return TRUE and set ANCHORING accordingly:  the value of the
+	 * parameter I goes from ANCHORING[2*I] to ANCHORING[2*I+1].
+	 * Does not allocate memory when ANCHORING already has the
+	 * needed capacity, so the caller should reuse it.  The values
+	 * of the parameters are extracted with get_mapping().  */
+
+	void get_mapping(const char *name, 
+			 const vector <size_t> &anchoring, 
+			 map <string, string> &mapping) const;
+	/* Set MAPPING to the values of the parameters, after NAME was
+	 * matched with ANCHORING.  MAPPING must be empty.  */
 	
 	/* No escape characters */
 	string raw() const {
@@ -577,19 +703,19 @@ public:
 	 * as well as for individual parameters.  */ 
 
 	Place_Param_Target(Flags flags_,
-			   const Place_Name &place_name_)
+			   Place_Name place_name_)
 		:  flags(flags_),
-		   place_name(place_name_),
-		   place(place_name_.place)
+		   place_name(move(place_name_)),
+		   place(place_name.place)
 	{ 
 		assert((flags_ & ~F_TARGET_TRANSIENT) == 0); 
 	}
 
 	Place_Param_Target(Flags flags_,
-			   const Place_Name &place_name_,
+			   Place_Name place_name_,
 			   const Place &place_)
 		:  flags(flags_),
-		   place_name(place_name_),
+		   place_name(move(place_name_)),
 		   place(place_)
 	{ 
 		assert((flags_ & ~F_TARGET_TRANSIENT) == 0); 
@@ -601,6 +727,12 @@ public:
 		   place(that.place)
 	{  }
 
+	Place_Param_Target(Place_Param_Target &&that)
+		:  flags(that.flags),
+		   place_name(move(that.place_name)),
+		   place(that.place)
+	{  }
+
 	/* Compares only the content, not the place. */ 
 	bool operator == (const Place_Param_Target &that) const {
 		return this->flags == that.flags && 
@@ -827,8 +959,7 @@ string Name::instantiate(const map <string, string> &mapping) const
 	return ret; 
 }
 
-bool Name::match(const string name, 
-		 map <string, string> &mapping,
+bool Name::match(const char *name, size_t length, 
 		 vector <size_t> &anchoring) const
 {
 	/* 
@@ -842,21 +973,17 @@ bool Name::match(const string name,
 	 * naive trivial implementations of regular expression
 	 * matching.  */
 
-	assert(mapping.size() == 0); 
-
-	map <string, string> ret;
-
 	const size_t n= get_n(); 
 
-	if (name == "") {
+	if (length == 0) {
 		return n == 0 && texts[0] == ""; 
 	}
 
 	anchoring.resize(2 * n);
 
-	const char *const p_begin= name.c_str();
+	const char *const p_begin= name;
 	const char *p= p_begin;
-	const char *const p_end= name.c_str() + name.size(); 
+	const char *const p_end= name + length; 
 
 	size_t k= texts[0].size(); 
 
@@ -886,17 +1013,21 @@ bool Name::match(const string name,
 			if (memcmp(p_end - size_last, texts[n].c_str(), size_last))
 				return false;
 
-			ret[parameters[i]]= string(p, p_end - p - size_last); 
 			anchoring[2*i + 1]= p_end - size_last - p_begin;
 
-			assert(ret.at(parameters[i]).size() > 0); 
+			assert(anchoring[2*i + 1] > anchoring[2*i]); 
 
 		} else {
 			/* Intermediate texts must not be empty, i.e.,
 			 * two parameters cannot be unseparated */ 
 			assert(texts[i+1].size() != 0); 
 
-			const char *q= strstr(p+1, texts[i+1].c_str());
+			if (p_end - p < 2)
+				return false; 
+
+			const char *q= (const char *)
+				memmem(p+1, p_end - (p+1), 
+				       texts[i+1].c_str(), texts[i+1].size());
 
 			if (q == nullptr) 
 				return false;
@@ -905,20 +1036,30 @@ bool Name::match(const string name,
 			
 			anchoring[i * 2 + 1]= q - p_begin; 
 
-			ret[parameters[i]]= string(p, q-p);
 			p= q + texts[i+1].size();
 
 			anchoring[i * 2 + 2]= p - p_begin; 
 		}
 	}
 
-	swap(mapping, ret); 
-
 	assert(anchoring.size() == 2 * n); 
 
 	return true;
 }
 
+void Name::get_mapping(const char *name, 
+		       const vector <size_t> &anchoring, 
+		       map <string, string> &mapping) const
+{
+	assert(mapping.size() == 0); 
+	assert(anchoring.size() == 2 * get_n()); 
+
+	for (size_t i= 0;  i < get_n();  ++i) {
+		mapping[parameters[i]]= 
+			string(name + anchoring[2*i], anchoring[2*i + 1] - anchoring[2*i]); 
+	}
+}
+
 string Name::get_duplicate_parameter() const
 {
 	vector <string> seen;
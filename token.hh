@@ -12,19 +12,30 @@
  */
 
 #include <memory>
+#include <new>
 
 /* 
- * A token.  This class is mainly used through unique_ptr/shared_ptr. 
+ * A token.  Tokens are created in a Token_List, which owns them.  The
+ * type of a token is stored in KIND, and checked with
+ * Parser::is<>(), which is used instead of dynamic casts. 
  */
 class Token
 {
 public:
 
+	enum Kind {
+		K_OPERATOR, K_FLAG, K_NAME, K_COMMAND
+	};
+
+	const Kind kind;
+	/* The type of the object, i.e., the derived class */ 
+
 	const bool whitespace;
 	/* Whether the token is preceded by whitespace */ 
 
-	Token(bool whitespace_)
-		:  whitespace(whitespace_)
+	Token(Kind kind_, bool whitespace_)
+		:  kind(kind_),
+		   whitespace(whitespace_)
 	{  }
 
 	virtual ~Token(); 
@@ -49,13 +60,15 @@ class Operator
 {
 public: 
 
+	static const Kind KIND= K_OPERATOR;
+
 	const char op; 
 	/* The operator as a character, e.g. ':', '[', etc.  */
 
 	const Place place; 
 
 	Operator(char op_, Place place_, bool whitespace_)
-		:  Token(whitespace_),
+		:  Token(K_OPERATOR, whitespace_),
 		   op(op_),
 		   place(place_)
 	{ 
@@ -82,6 +95,8 @@ class Flag_Token
 {
 public:
 
+	static const Kind KIND= K_FLAG;
+
 	const char flag;
 	/* The flag character */
 
@@ -93,7 +108,7 @@ public:
 
 	/* PLACE is the place of the letter */
 	Flag_Token(char flag_, const Place place_, bool whitespace_)
-		:  Token(whitespace_),
+		:  Token(K_FLAG, whitespace_),
 		   flag(flag_),
 		   place(place_)
 	{
@@ -130,10 +145,13 @@ class Name_Token
 	:  public Token, public Place_Name
 {
 public:
-	Name_Token(const Place_Name &place_name_, 
+
+	static const Kind KIND= K_NAME;
+
+	Name_Token(Place_Name &&place_name_, 
 		   bool whitespace_) 
-		:  Token(whitespace_),
-		   Place_Name(place_name_)
+		:  Token(K_NAME, whitespace_),
+		   Place_Name(move(place_name_))
 	{  }
 
 	const Place &get_place() const {
@@ -151,10 +169,11 @@ public:
 
 /* 
  * A command delimited by braces, or the content of a file, also
- * delimited by braces.  
+ * delimited by braces.  Commands are kept by the rules built from
+ * them, and therefore are not tokens themselves; the token is a
+ * Command_Token. 
  */
 class Command
-	:  public Token
 {
 private:
 
@@ -177,32 +196,104 @@ public:
 
 	Command(string command_, 
 		const Place &place_,
-		const Place &place_start_,
-		bool whitespace_); 
+		const Place &place_start_); 
+
+	const vector <string> &get_lines() const;
+};
+
+class Command_Token
+	:  public Token
+{
+public:
+
+	static const Kind KIND= K_COMMAND;
+
+	const shared_ptr <const Command> command;
+
+	Command_Token(shared_ptr <const Command> command_,
+		      bool whitespace_)
+		:  Token(K_COMMAND, whitespace_),
+		   command(move(command_))
+	{  }
 
 	const Place &get_place() const {
-		return place; 
+		return command->place; 
 	}
 
 	const Place &get_place_start() const {
-		return place_start; 
+		return command->place_start; 
 	}
 
 	string format_start_word() const {
 		return char_format_word('{'); 
 	}
+};
 
-	const vector <string> &get_lines() const;
+/*
+ * The tokens of one piece of source code, in order.  The tokens are
+ * allocated one after the other in large chunks owned by the list,
+ * instead of individually, and are all destroyed together with the
+ * list.  Nothing that the parser builds from the tokens refers to
+ * them, and therefore the list is destroyed as soon as its rules have
+ * been added to the rule set.  In lazy mode (-l), each rule keeps a
+ * copy of the tokens of its dependencies in a list of its own.
+ */
+class Token_List
+{
+public:
+
+	typedef vector <Token *> ::const_iterator iterator; 
+
+	Token_List()
+		:  chunk_begin(nullptr),
+		   chunk_end(nullptr)
+	{  }
+
+	Token_List(iterator begin, iterator end); 
+	/* Copy the given tokens of another list.  All tokens are
+	 * allocated in a single chunk of the needed size.  */
+
+	~Token_List(); 
+
+	Token_List(const Token_List &)= delete;
+	Token_List &operator=(const Token_List &)= delete;
+
+	iterator begin() const {  return tokens.begin();  }
+	iterator end() const {  return tokens.end();  }
+	bool empty() const {  return tokens.empty();  }
+
+	template <typename T, typename... Args>
+	T *push(Args&&... args);
+	/* Create a token of type T at the end of the list */ 
+
+private:
+
+	static const size_t ALIGN= alignof(max_align_t);
+
+	static const size_t SIZE_CHUNK= 1 << 16;
+
+	vector <Token *> tokens;
+
+	vector <char *> chunks;
+
+	char *chunk_begin, *chunk_end;
+	/* The unused part of the last chunk */
+
+	static size_t get_size(const Token *token); 
+	/* The space used by the token in a chunk */
+
+	template <typename T>
+	static size_t get_size() {
+		return (sizeof(T) + ALIGN - 1) / ALIGN * ALIGN;
+	}
 };
 
 Token::~Token() { }
 
 Command::Command(string command_, 
 		 const Place &place_,
-		 const Place &place_start_,
-		 bool whitespace_)
-	:  Token(whitespace_),
-	   command(command_),
+		 const Place &place_start_)
+	:  command(move(command_)),
 	   place(place_),
 	   place_start(place_start_)
 {  }	
@@ -280,6 +371,76 @@ Command::get_lines() const
 	return *lines; 
 }
 
+Token_List::Token_List(iterator begin, iterator end)
+	:  chunk_begin(nullptr),
+	   chunk_end(nullptr)
+{
+	size_t size= 0;
+	for (iterator i= begin;  i != end;  ++i) 
+		size += get_size(*i); 
+	if (size != 0) {
+		chunk_begin= (char *) ::operator new(size);
+		chunk_end= chunk_begin + size;
+		chunks.push_back(chunk_begin); 
+	}
+	tokens.reserve(end - begin); 
+
+	for (iterator i= begin;  i != end;  ++i) {
+		switch ((*i)->kind) {
+		default:  assert(false);  break;
+		case Token::K_OPERATOR:
+			push <Operator> (*static_cast <const Operator *> (*i));
+			break;
+		case Token::K_FLAG:
+			push <Flag_Token> (*static_cast <const Flag_Token *> (*i));
+			break;
+		case Token::K_NAME:
+			push <Name_Token> (*static_cast <const Name_Token *> (*i));
+			break;
+		case Token::K_COMMAND:
+			push <Command_Token> (*static_cast <const Command_Token *> (*i));
+			break;
+		}
+	}
+	assert(chunk_begin == chunk_end); 
+}
+
+Token_List::~Token_List()
+{
+	for (Token *token:  tokens)
+		token->~Token();
+	for (char *chunk:  chunks)
+		::operator delete(chunk); 
+}
+
+template <typename T, typename... Args>
+T *Token_List::push(Args&&... args)
+{
+	static_assert(sizeof(T) <= SIZE_CHUNK, "token too large");
+	const size_t size= get_size <T> ();
+	if ((size_t)(chunk_end - chunk_begin) < size) {
+		/* The rest of the previous chunk is lost */
+		chunk_begin= (char *) ::operator new(SIZE_CHUNK);
+		chunk_end= chunk_begin + SIZE_CHUNK;
+		chunks.push_back(chunk_begin); 
+	}
+	T *ret= new (chunk_begin) T(std::forward <Args> (args)...);
+	chunk_begin += size;
+	tokens.push_back(ret);
+	return ret;
+}
+
+size_t Token_List::get_size(const Token *token)
+{
+	switch (token->kind) {
+	default:  assert(false);  return 0; 
+	case Token::K_OPERATOR:  return get_size <Operator> (); 
+	case Token::K_FLAG:      return get_size <Flag_Token> (); 
+	case Token::K_NAME:      return get_size <Name_Token> (); 
+	case Token::K_COMMAND:   return get_size <Command_Token> (); 
+	}
+}
+
 string Operator::format_long_word() const
 {
 	string t;
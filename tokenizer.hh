@@ -12,9 +12,10 @@
 
 #include "token.hh"
 #include "version.hh"
-
-const char *const FILENAME_INPUT_DEFAULT= "main.stu"; 
-/* The default filename read  */
+#include "pool.hh"
+#include "scan.hh"
+#include "state.hh"
+#include "preload.hh"
 
 class Tokenizer
 {
@@ -22,7 +23,7 @@ public:
 	
 	enum Context { SOURCE, DYNAMIC, OPTION_C, OPTION_F };
 
-	static void parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
+	static void parse_tokens_file(Token_List &tokens, 
 				      Context context,
 				      Place &place_end,
 				      string filename, 
@@ -49,16 +50,24 @@ public:
 		vector <Trace> traces;
 		vector <string> filenames; 
 		set <string> includes;
-		parse_tokens_file(tokens, 
-				  context,
-				  place_end, filename, 
-				  traces, filenames, includes,
-				  place_diagnostic,
-				  fd,
-				  allow_enoent);
+		if (context == SOURCE && filename != "")
+			preload(filename, fd); 
+		try {
+			parse_tokens_file(tokens, 
+					  context,
+					  place_end, filename, 
+					  traces, filenames, includes,
+					  place_diagnostic,
+					  fd,
+					  allow_enoent);
+		} catch (int) {
+			Preload::clear(); 
+			throw; 
+		}
+		Preload::clear(); 
 	}
 
-	static void parse_tokens_string(vector <shared_ptr <Token> > &tokens, 
+	static void parse_tokens_string(Token_List &tokens, 
 					Context context,
 					Place &place_end,
 					string text,
@@ -66,6 +75,31 @@ public:
 	/* Parse tokens from the given TEXT.  Other arguments are
 	 * identical to parse_tokens_file().  */
 
+	struct Source
+	/* A file read by parse_tokens_file() */ 
+	{
+		string filename;
+		bool is_regular;
+		uint64_t dev, ino;
+		uint64_t size, sec, nsec;
+		uint64_t digest;
+		/* Of the content that was tokenized */ 
+	};
+
+	struct Declaration
+	/* A pool declared with %pool */ 
+	{
+		string name;
+		long size;
+		Place place;
+	};
+
+	static vector <Source> *sources; 
+	static vector <Declaration> *declarations; 
+	/* When not null, each file read by parse_tokens_file(),
+	 * including included files, and each pool declared in them, are
+	 * appended.  Used by the rule cache.  */
+
 private:
 
 	/* Stacks of included files */ 
@@ -92,6 +126,11 @@ private:
 	bool whitespace= true;
 	/* Whether there was whitespace previously */ 
 
+	vector <string> *filenames_include= nullptr;
+	/* When not null, the names of included files are appended to
+	 * it, and the files are not read.  Pools are not declared.  Used
+	 * by parse_includes().  */
+
 	Tokenizer(vector <Trace> &traces_,
 		  vector <string> &filenames_,
 		  set <string> &includes_,
@@ -110,15 +149,16 @@ private:
 		   p_end(p_ + length)
 	{ }
 
-	void parse_tokens(vector <shared_ptr <Token> > &tokens, 
+	void parse_tokens(Token_List &tokens, 
 			  Context context,
 			  const Place &place_diagnostic);
 
 	shared_ptr <Command> parse_command();
 	
-	shared_ptr <Place_Name> parse_name();
-	/* Returns null when no name could be parsed.  Prints and throws
-	 * on other errors, including on empty names.  */ 
+	bool parse_name(Place_Name &ret);
+	/* Write the name into RET, which must be empty.  Returns false
+	 * when no name could be parsed.  Prints and throws on other
+	 * errors, including on empty names.  */ 
 
 	bool parse_parameter(string &parameter, Place &place_dollar); 
 	/* Parse a parameter starting with '$'.  Return whether a
@@ -134,7 +174,7 @@ private:
 	void parse_double_quote(Place_Name &ret);
 	void parse_single_quote(Place_Name &ret); 
 
-	void parse_directive(vector <shared_ptr <Token> > &tokens,
+	void parse_directive(Token_List &tokens,
 			     Context context,
 			     const Place &place_diagnostic);
 	/* Parse a directive.  The pointer must be on the '%'
@@ -146,7 +186,7 @@ private:
 		return Place(place_type, filename, line, p - p_line); 
 	}
 
-	static void parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
+	static void parse_tokens_file(Token_List &tokens, 
 				      Context context,
 				      Place &place_end,
 				      string filename, 
@@ -166,6 +206,24 @@ private:
 	 * included in FILENAMES. 
 	 */
 
+	static void add_source(const string &filename,
+			       const struct stat *buf,
+			       const char *in, size_t in_size);
+	/* Append the file to SOURCES when it is not null */
+
+	static void preload(const string &filename, int fd);
+	/* Preload the file FILENAME and all files it includes directly
+	 * or indirectly, level by level.  FD is as for
+	 * parse_tokens_file().  See preload.hh.  */
+
+	static void parse_includes(const string &filename,
+				   const char *in, size_t in_size,
+				   vector <string> &filenames_include);
+	/* Tokenize the given content of the file FILENAME only to find
+	 * the files it includes, which are appended to
+	 * FILENAMES_INCLUDE in order.  Nothing is printed; on errors,
+	 * the files included before the error are found.  */
+
 	static bool is_name_char(char);
 	/* Whether the given character can be used as part of a bare
 	 * filename in Stu.  Note that all non-ASCII characters are
@@ -188,7 +246,10 @@ private:
 	 * given after "%version", and PLACE its place.  */
 };
 
-void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens, 
+vector <Tokenizer::Source> *Tokenizer::sources= nullptr; 
+vector <Tokenizer::Declaration> *Tokenizer::declarations= nullptr; 
+
+void Tokenizer::parse_tokens_file(Token_List &tokens, 
 				  Context context,
 				  Place &place_end,
 				  string filename, 
@@ -227,6 +288,15 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 		}
 
 		if (fd < 0) {
+			Preload::File file_preloaded; 
+			if (Preload::take(filename, file_preloaded)) {
+				filename= file_preloaded.filename;
+				buf= file_preloaded.buf;
+				in= file_preloaded.in;
+				in_size= file_preloaded.in_size;
+				use_malloc= false; 
+				goto tokenize; 
+			}
 			fd= open(filename.c_str(), O_RDONLY); 
 			if (fd < 0) {
 				if (allow_enoent) {
@@ -263,6 +333,7 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 		 * on it, i.e., return an error and refuse to create a memory
 		 * map of length zero. */  
 		if (S_ISREG(buf.st_mode) && buf.st_size == 0) {
+			add_source(filename, &buf, nullptr, 0); 
 			place_end= Place(Place::Type::INPUT_FILE, filename, 1, 0); 
 			goto return_close; 
 		}
@@ -339,6 +410,9 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 				goto error;
 		}
 
+	tokenize:
+		add_source(filename, &buf, in, in_size); 
+
 		{
 			Tokenizer tokenizer(traces, filenames, includes,
 					    Place::Type::INPUT_FILE, filename, 
@@ -410,6 +484,82 @@ void Tokenizer::parse_tokens_file(vector <shared_ptr <Token> > &tokens,
 	}
 }
 
+void Tokenizer::add_source(const string &filename,
+			   const struct stat *buf,
+			   const char *in, size_t in_size)
+{
+	if (sources == nullptr)
+		return;
+	Source source;
+	source.filename= filename;
+	source.is_regular= S_ISREG(buf->st_mode);
+	source.dev= buf->st_dev;
+	source.ino= buf->st_ino;
+	source.size= in_size;
+	source.sec= buf->st_mtime;
+#if USE_MTIM
+	source.nsec= buf->st_mtim.tv_nsec;
+#else
+	source.nsec= 0;
+#endif
+	source.digest= State::hash(in, in_size);
+	sources->push_back(source); 
+}
+
+void Tokenizer::preload(const string &filename, int fd)
+{
+	Preload::load(filename, fd); 
+	set <string> filenames_seen= {filename};
+	vector <string> filenames_level= {filename}; 
+
+	while (! filenames_level.empty()) {
+		vector <string> filenames_next;
+		for (const string &filename_level:  filenames_level) {
+			const Preload::File *file= Preload::get(filename_level);
+			if (file == nullptr)
+				continue; 
+			/* A file without the word "include" does not
+			 * include files, and is not tokenized here */
+			if (! memmem(file->in, file->in_size, "include", strlen("include")))
+				continue; 
+			vector <string> filenames_include;
+			parse_includes(file->filename, file->in, file->in_size,
+				       filenames_include); 
+			for (string &filename_include:  filenames_include) {
+				if (filenames_seen.insert(filename_include).second)
+					filenames_next.push_back(filename_include); 
+			}
+		}
+		Preload::load(filenames_next); 
+		filenames_level= move(filenames_next); 
+	}
+}
+
+void Tokenizer::parse_includes(const string &filename,
+			       const char *in, size_t in_size,
+			       vector <string> &filenames_include)
+{
+	vector <Trace> traces;
+	vector <string> filenames;
+	set <string> includes;
+	Tokenizer tokenizer(traces, filenames, includes,
+			    Place::Type::INPUT_FILE, filename, 
+			    in, in_size); 
+	tokenizer.filenames_include= &filenames_include; 
+
+	Token_List tokens;
+	const bool option_explain_old= option_explain;
+	option_explain= false;
+	Place::quiet= true;
+	try {
+		tokenizer.parse_tokens(tokens, SOURCE, Place()); 
+	} catch (int) {
+		/* The error is printed when the file is tokenized
+		 * again by parse_tokens_file() */
+	}
+	Place::quiet= false;
+	option_explain= option_explain_old;
+}
 
 shared_ptr <Command> Tokenizer::parse_command()
 /* 
@@ -447,6 +597,14 @@ shared_ptr <Command> Tokenizer::parse_command()
 	 * syntax.  May contain:  {'"`( */ 
 
 	while (p < p_end) {
+
+		/* Once the place of the command is known, skip over
+		 * characters that don't change the state */ 
+		if (! begin) {
+			p= Scan::command(p, p_end); 
+			if (p == p_end)
+				break; 
+		}
 		
 		const char last= stack[stack.size() - 1]; 
 
@@ -480,7 +638,7 @@ shared_ptr <Command> Tokenizer::parse_command()
 					const Place place_command
 						(place_type, filename, line_command, column_command); 
 					return make_shared <Command> 
-						(command, place_command, place_open, whitespace); 
+						(command, place_command, place_open); 
 				} else {
 					++p; 
 				}
@@ -551,7 +709,7 @@ shared_ptr <Command> Tokenizer::parse_command()
 		case '#':
 			++p;
 			if (last == '{' || last == '(' || last == '`') {
-				while (p < p_end && *p != '\n')  ++p;
+				p= Scan::line_end(p, p_end); 
 			}
 			break;
 
@@ -599,38 +757,41 @@ shared_ptr <Command> Tokenizer::parse_command()
 	throw ERROR_LOGICAL;
 }
 
-shared_ptr <Place_Name> Tokenizer::parse_name()
+bool Tokenizer::parse_name(Place_Name &ret)
 {
 	const char *const p_begin= p; 
 	Place place_begin= current_place(); 
 
-	shared_ptr <Place_Name> ret= make_shared <Place_Name> ("", place_begin);
+	assert(ret.empty()); 
+	ret.place= place_begin; 
 
 	/* Don't allow '-', '+' and '~' at beginning of name. */
 	if (p < p_end) {
 		if (*p == '-' || *p == '+' || *p == '~') {
-			return nullptr;
+			return false;
 		}
 	}
 
 	while (p < p_end) {
 		if (*p == '"') {
-			parse_double_quote(*ret); 
+			parse_double_quote(ret); 
 		} else if (*p == '\'') {
-			parse_single_quote(*ret); 
+			parse_single_quote(ret); 
 		} else if (*p == '$') {
 			string parameter;
 			Place place_dollar;
 			if (parse_parameter(parameter, place_dollar)) {
-				ret->append_parameter(parameter, place_dollar);
+				ret.append_parameter(parameter, place_dollar);
 			} else {
 				assert(false); 
 			}
 		} else if (is_name_char(*p)) {
-			/* An ordinary character */ 
+			/* A run of ordinary characters */ 
 			assert(p != p_begin ||
 			       (*p != '-' && *p != '+' && *p != '~'));
-			ret->last_text() += *p++;
+			const char *const p_run= p; 
+			p= Scan::name(p, p_end); 
+			ret.last_text().append(p_run, p - p_run); 
 		}
 		else {
 			/* As soon as the name cannot be parsed
@@ -639,14 +800,14 @@ shared_ptr <Place_Name> Tokenizer::parse_name()
 		}	
 	}
 
-	if (ret->empty()) {
+	if (ret.empty()) {
 		if (p == p_begin)
-			return nullptr; 
+			return false; 
 		place_begin << "name must not be empty";
 		throw ERROR_LOGICAL;
 	}
 
-	return ret;
+	return true;
 }
 
 bool Tokenizer::parse_parameter(string &parameter, Place &place_dollar)
@@ -718,9 +879,7 @@ bool Tokenizer::parse_parameter(string &parameter, Place &place_dollar)
 
 bool Tokenizer::is_name_char(char c) 
 {
-	return (c > 0x20 && c < 0x7F /* ASCII printable character except space */ 
-		&& nullptr == strchr("[]\"\':={}#<>@$;()%*\\!?|&", c))
-		|| ((unsigned char) c) >= 0x80;
+	return Scan::is_name_char(c); 
 }
 
 bool Tokenizer::is_operator_char(char c) 
@@ -798,7 +957,7 @@ void Tokenizer::parse_version(string version_req,
 	throw ERROR_LOGICAL;
 }
 
-void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens, 
+void Tokenizer::parse_tokens(Token_List &tokens, 
 			     Context context,
 			     const Place &place_diagnostic)
 {
@@ -807,7 +966,7 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 		/* Operators except '$' */ 
 		if (is_operator_char(*p)) {
 			Place place= current_place(); 
-			tokens.push_back(make_shared <Operator> (*p, place, whitespace));
+			tokens.push <Operator> (*p, place, whitespace);
 			++p;
 		}
 
@@ -815,21 +974,20 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 		else if (*p == '$' && p + 1 < p_end && p[1] == '[') {
 			Place place_dollar= current_place(); 
 			Place place_langle(place_type, filename, line, p + 1 - p_line);
-			tokens.push_back(make_shared <Operator> ('$', place_dollar, whitespace));
-			tokens.push_back(make_shared <Operator> ('[', place_langle, whitespace)); 
+			tokens.push <Operator> ('$', place_dollar, whitespace);
+			tokens.push <Operator> ('[', place_langle, whitespace); 
 			p += 2;
 		}
 
 		/* Command */ 
 		else if (*p == '{') {
-			shared_ptr <Command> token= parse_command();
-			tokens.push_back(token); 
+			tokens.push <Command_Token> (parse_command(), whitespace); 
 		}
 
 		/* Comment */ 
 		else if (*p == '#') {
 			/* Skip the comment without generating any token */ 
-			do  ++p;  while (p < p_end && *p != '\n');
+			p= Scan::line_end(p + 1, p_end); 
 		} 
 
 		/* Whitespace */
@@ -890,9 +1048,8 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 					throw ERROR_LOGICAL; 
 				}
 				assert(isalnum(op)); 
-				shared_ptr <Flag_Token> token= make_shared <Flag_Token> 
+				const Flag_Token *token= tokens.push <Flag_Token> 
 					(op, current_place(), whitespace); 
-				tokens.push_back(token); 
 				++p;
 				if (p < p_end && 
 				    (is_name_char(*p) || *p == '"' || *p == '\'' || *p == '$' || *p == '@')) {
@@ -907,8 +1064,8 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 				}
 			} else {
 
-			shared_ptr <Place_Name> place_name= parse_name();
-			if (place_name == nullptr) {
+			Place_Name place_name; 
+			if (! parse_name(place_name)) {
 				if (*p == '!') {
 					current_place() <<
 						fmt("character %s is invalid for persistent dependencies; use %s instead",
@@ -932,9 +1089,8 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 				}
 				throw ERROR_LOGICAL;
 			}
-			assert(! place_name->empty());
-			tokens.push_back(make_shared <Name_Token>
-					 (*place_name, whitespace)); 
+			assert(! place_name.empty());
+			tokens.push <Name_Token> (move(place_name), whitespace); 
 			}
 		}
 		
@@ -944,7 +1100,7 @@ void Tokenizer::parse_tokens(vector <shared_ptr <Token> > &tokens,
 	}
 }
 
-void Tokenizer::parse_tokens_string(vector <shared_ptr <Token> > &tokens, 
+void Tokenizer::parse_tokens_string(Token_List &tokens, 
 				    Context context,
 				    Place &place_end,
 				    string string_,
@@ -1085,7 +1241,7 @@ void Tokenizer::parse_single_quote(Place_Name &ret)
  end_of_single_quote:;
 }
 
-void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens, 
+void Tokenizer::parse_directive(Token_List &tokens, 
 				Context context,
 				const Place &place_diagnostic)
 {
@@ -1132,9 +1288,9 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 			throw ERROR_LOGICAL;
 		}
 
-		shared_ptr <Place_Name> place_name= parse_name(); 
+		Place_Name place_name; 
 
-		if (place_name == nullptr) {
+		if (! parse_name(place_name)) {
 			current_place() <<
 				(p == p_end
 				 ? "expected a filename"
@@ -1144,19 +1300,24 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 			throw ERROR_LOGICAL;
 		}
 				
-		if (place_name->get_n() != 0) {
-			place_name->place <<
+		if (place_name.get_n() != 0) {
+			place_name.place <<
 				fmt("name %s must not be parametrized",
-				    place_name->format_word());
+				    place_name.format_word());
 			place_percent << frmt("after %s%%include%s",
 					      Color::word, Color::end); 
 			throw ERROR_LOGICAL;
 		}
 			
-		const string filename_include= place_name->unparametrized();
+		const string filename_include= place_name.unparametrized();
+
+		if (filenames_include != nullptr) {
+			filenames_include->push_back(filename_include); 
+			return; 
+		}
 
 		Trace trace_stack
-			(place_name->place,
+			(place_name.place,
 			 fmt("%s is included from here", 
 			     name_format_word(filename_include))); 
 
@@ -1221,6 +1382,69 @@ void Tokenizer::parse_directive(vector <shared_ptr <Token> > &tokens,
 
 		parse_version(version_required, place_version, place_percent); 
 				
+	} else if (name == "pool") {
+
+		if (context == DYNAMIC) {
+			place_percent 
+				<< frmt("%s%%pool%s must not appear in dynamic dependencies",
+					Color::word, Color::end);
+			throw ERROR_LOGICAL;
+		}
+
+		Place_Name place_name; 
+
+		if (! parse_name(place_name)) {
+			current_place() <<
+				(p == p_end
+				 ? "expected the name of a pool"
+				 : fmt("expected the name of a pool, not %s", char_format_word(*p)));
+			place_percent << frmt("after %s%%pool%s",
+					      Color::word, Color::end); 
+			throw ERROR_LOGICAL;
+		}
+				
+		if (place_name.get_n() != 0) {
+			place_name.place <<
+				fmt("name %s must not be parametrized",
+				    place_name.format_word());
+			place_percent << frmt("after %s%%pool%s",
+					      Color::word, Color::end); 
+			throw ERROR_LOGICAL;
+		}
+
+		skip_space(); 
+
+		if (p < p_end && isdigit(*p)) {
+			/* Declaration of the pool with its size */ 
+			Place place_size= current_place(); 
+			const char *const p_size= p;
+			while (p < p_end && is_name_char(*p)) {
+				++p;
+			}
+			const string text_size(p_size, p - p_size);
+			char *endptr;
+			errno= 0;
+			long size= strtol(text_size.c_str(), &endptr, 10); 
+			if (errno != 0 || *endptr != '\0' || size < 1) {
+				place_size << fmt("expected a positive number of slots, not %s",
+						  name_format_word(text_size)); 
+				place_percent << frmt("after %s%%pool%s",
+						      Color::word, Color::end); 
+				throw ERROR_LOGICAL;
+			}
+			if (filenames_include != nullptr)
+				return; 
+			Pool::declare(place_name.unparametrized(), size, place_name.place); 
+			if (declarations != nullptr) 
+				declarations->push_back({place_name.unparametrized(), 
+							 size, place_name.place}); 
+		} else {
+			/* Use of the pool in a rule, which is passed on to the
+			 * parser as the operator '%' followed by the name */
+			tokens.push <Operator> ('%', place_percent, true);
+			tokens.push <Name_Token> (move(place_name), true); 
+		}
+				
 	} else {
 		/* Invalid directive */ 
 		place_percent << 